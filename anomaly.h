@@ -0,0 +1,431 @@
+/*
+ * Common harness definitions shared by the anomaly reproducers.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef ANOMALY_H
+#define ANOMALY_H 1
+#include <stdint.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
+#include "drx.h"
+#include "intercepts.h"
+#include "sprt.h"
+
+/**
+ * Identifiers of the anomaly reproducers, recorded in binary trial logs.
+ */
+enum anomaly_test_id {
+	ANOMALY_TEST_PENDING_DBG_CAUSES = 1,
+	ANOMALY_TEST_DR_FUZZ = 2,
+};
+
+/**
+ * Mechanism used to arm the watchpoint and observe the resulting #DB.
+ */
+enum anomaly_backend {
+	ANOMALY_BACKEND_PTRACE = 0,     /* Traced child, DRx programmed through PTRACE_POKEUSER */
+	ANOMALY_BACKEND_PERF,           /* In-process perf_event breakpoint and SIGTRAP handler */
+};
+
+/**
+ * Background load generators run on every CPU alongside the trials (Linux
+ * only). A noise profile is a mask of generators running together, and each
+ * profile of a sweep is a separate pass over the intercepts.
+ */
+enum anomaly_noise {
+	ANOMALY_NOISE_TIMER,            /* High-rate POSIX timer signals */
+	ANOMALY_NOISE_IPI,              /* membarrier() IPIs to every CPU running a trial */
+	ANOMALY_NOISE_YIELD,            /* sched_yield() storms competing for the CPU */
+	ANOMALY_NOISE_FAULT,            /* Page faults and TLB shootdowns from mmap/munmap churn */
+	ANOMALY_NOISE_COUNT
+};
+
+#define ANOMALY_NOISE_MASK(n)           (1u << (n))
+#define ANOMALY_NOISE_ALL               (ANOMALY_NOISE_MASK(ANOMALY_NOISE_COUNT) - 1)
+#define ANOMALY_NOISE_PROFILES_MAX      16
+
+static const char *const anomaly_noise_names[ANOMALY_NOISE_COUNT] = {
+	[ANOMALY_NOISE_TIMER] = "timer",
+	[ANOMALY_NOISE_IPI]   = "ipi",
+	[ANOMALY_NOISE_YIELD] = "yield",
+	[ANOMALY_NOISE_FAULT] = "fault",
+};
+
+static const char *const anomaly_noise_descriptions[ANOMALY_NOISE_COUNT] = {
+	[ANOMALY_NOISE_TIMER] = "High-rate POSIX timer signals",
+	[ANOMALY_NOISE_IPI]   = "membarrier() IPIs to every CPU running trials",
+	[ANOMALY_NOISE_YIELD] = "sched_yield() storm competing for the CPU",
+	[ANOMALY_NOISE_FAULT] = "mmap/touch/munmap page-fault and TLB shootdown churn",
+};
+
+/**
+ * Parse a comma separated list of noise profiles, each "none", "all" or
+ * generator names joined with '+', e.g. "none,timer,ipi+yield,all".
+ * Returns the number of profiles, or -1 when the list is invalid.
+ */
+static inline int anomaly_parse_noise(const char *list, uint32_t *profiles, unsigned int max)
+{
+	const char *p = list;
+	unsigned int n = 0;
+
+	while (*p != '\0') {
+		const char *const end = p + strcspn(p, ",");
+		uint32_t mask = 0;
+
+		if (n == max || end == p)
+			return -1;
+		if ((size_t)(end - p) == 4 && strncmp(p, "none", 4) == 0) {
+			p = end;
+		} else if ((size_t)(end - p) == 3 && strncmp(p, "all", 3) == 0) {
+			mask = ANOMALY_NOISE_ALL;
+			p = end;
+		}
+		while (p < end) {
+			const size_t len = strcspn(p, "+,");
+			unsigned int id;
+
+			for (id = 0; id < ANOMALY_NOISE_COUNT; id++) {
+				if (strlen(anomaly_noise_names[id]) == len &&
+				    strncmp(anomaly_noise_names[id], p, len) == 0)
+					break;
+			}
+			if (id == ANOMALY_NOISE_COUNT)
+				return -1;
+			mask |= ANOMALY_NOISE_MASK(id);
+			p += len;
+			if (*p == '+')
+				p++;
+		}
+		profiles[n++] = mask;
+		if (*p == ',')
+			p++;
+	}
+	return n != 0 ? (int)n : -1;
+}
+
+/* Name of a noise profile as accepted by anomaly_parse_noise() */
+static inline const char *anomaly_noise_profile_name(uint32_t mask, char *buf, size_t size)
+{
+	size_t len = 0;
+
+	if (mask == 0)
+		return "none";
+	if (mask == ANOMALY_NOISE_ALL)
+		return "all";
+	buf[0] = '\0';
+	for (unsigned int id = 0; id < ANOMALY_NOISE_COUNT; id++) {
+		if ((mask & ANOMALY_NOISE_MASK(id)) != 0 && len < size)
+			len += (size_t)snprintf(buf + len, size - len, "%s%s", len != 0 ? "+" : "",
+						anomaly_noise_names[id]);
+	}
+	return buf;
+}
+
+/**
+ * Where the probe DR0 watches is placed, for comparing how the memory behind
+ * the watchpoint affects the #DB and the exits around it (Linux only). Each
+ * placement of a matrix is a separate pass over the intercepts.
+ */
+enum anomaly_placement {
+	ANOMALY_PLACEMENT_DEFAULT,      /* The worker's own probe, as without --placement */
+	ANOMALY_PLACEMENT_PAGE,         /* Start of a regular page of its own */
+	ANOMALY_PLACEMENT_LINE_SPLIT,   /* Straddling two cache lines */
+	ANOMALY_PLACEMENT_PAGE_SPLIT,   /* Straddling two regular pages */
+	ANOMALY_PLACEMENT_HUGE_2M,      /* MAP_HUGETLB 2 MiB page */
+	ANOMALY_PLACEMENT_HUGE_1G,      /* MAP_HUGETLB 1 GiB page */
+	ANOMALY_PLACEMENT_THP,          /* Transparent huge page */
+	ANOMALY_PLACEMENT_CODE,         /* Same page as the trial code */
+	ANOMALY_PLACEMENT_STACK,        /* Next to the trial loop's stack frames */
+	ANOMALY_PLACEMENT_COUNT
+};
+
+#define ANOMALY_PLACEMENT_MASK(n)       (1u << (n))
+#define ANOMALY_PLACEMENT_ALL           (ANOMALY_PLACEMENT_MASK(ANOMALY_PLACEMENT_COUNT) - 1)
+
+static const char *const anomaly_placement_names[ANOMALY_PLACEMENT_COUNT] = {
+	[ANOMALY_PLACEMENT_DEFAULT]    = "default",
+	[ANOMALY_PLACEMENT_PAGE]       = "page",
+	[ANOMALY_PLACEMENT_LINE_SPLIT] = "line-split",
+	[ANOMALY_PLACEMENT_PAGE_SPLIT] = "page-split",
+	[ANOMALY_PLACEMENT_HUGE_2M]    = "huge-2m",
+	[ANOMALY_PLACEMENT_HUGE_1G]    = "huge-1g",
+	[ANOMALY_PLACEMENT_THP]        = "thp",
+	[ANOMALY_PLACEMENT_CODE]       = "code",
+	[ANOMALY_PLACEMENT_STACK]      = "stack",
+};
+
+static const char *const anomaly_placement_descriptions[ANOMALY_PLACEMENT_COUNT] = {
+	[ANOMALY_PLACEMENT_DEFAULT]    = "The harness' own cache-line aligned probe",
+	[ANOMALY_PLACEMENT_PAGE]       = "Start of a regular page of its own",
+	[ANOMALY_PLACEMENT_LINE_SPLIT] = "Straddling two cache lines",
+	[ANOMALY_PLACEMENT_PAGE_SPLIT] = "Straddling two regular pages",
+	[ANOMALY_PLACEMENT_HUGE_2M]    = "MAP_HUGETLB 2 MiB page, needs vm.nr_hugepages",
+	[ANOMALY_PLACEMENT_HUGE_1G]    = "MAP_HUGETLB 1 GiB page, needs reserved 1 GiB pages",
+	[ANOMALY_PLACEMENT_THP]        = "Transparent huge page requested with MADV_HUGEPAGE",
+	[ANOMALY_PLACEMENT_CODE]       = "On the executable page holding the trial code",
+	[ANOMALY_PLACEMENT_STACK]      = "Next to the trial loop's stack frames",
+};
+
+/**
+ * Parse a comma separated list of placement names (or "all") into a mask.
+ */
+static inline int anomaly_parse_placements(const char *list, uint32_t *result_mask)
+{
+	return anomaly_parse_name_list(list, anomaly_placement_names, ANOMALY_PLACEMENT_COUNT,
+				       ANOMALY_PLACEMENT_ALL, result_mask);
+}
+
+/**
+ * Options controlling how an anomaly reproducer is run. Parsed once in main()
+ * and handed to every test entry point.
+ */
+struct anomaly_options {
+	uint64_t iterations;            /* Number of trials to run in a single tracee */
+	int iterations_set;             /* --iterations was given, iterations is not the default */
+	enum anomaly_backend backend;   /* How trials are armed and observed (Linux only) */
+	int all_cpus;                   /* Run one pinned worker per online CPU (Linux only) */
+	unsigned int threads;           /* Trial threads in one traced process, 0 for one (Linux only) */
+	unsigned int tracees;           /* Concurrent traced processes per CPU, 0 for one (Linux only) */
+	unsigned int timeout_ms;        /* Watchdog: kill a tracee making no progress for this long */
+	unsigned int zygote;            /* Pre-forked, stopped tracees kept ready (Linux only) */
+	uint32_t intercepts;            /* ANOMALY_INTERCEPT_MASK() of instructions to sweep */
+	const char *log_path;           /* Binary trial log to write, NULL for none (Linux only) */
+	const char *snapshot_dir;       /* Where anomalous trials' full state goes, NULL for none (Linux only) */
+	const char *trace_path;         /* Chrome trace JSON of harness events, NULL for none (Linux only) */
+	const char *corpus_path;        /* Failing configurations are added to this corpus (Linux only) */
+	int minimize;                   /* Replay: shrink every configuration that reproduces */
+	int latency;                    /* Report latency histograms and a baseline (Linux only) */
+	int profile;                    /* Count the harness' own cost per phase (Linux only) */
+	int simd;                       /* Check vector registers survive every trial (Linux only) */
+	uint32_t noise[ANOMALY_NOISE_PROFILES_MAX]; /* ANOMALY_NOISE_MASK()s, one pass each (Linux only) */
+	unsigned int noise_profiles;    /* Passes in noise, 0 for a single run without noise */
+	uint32_t placements;            /* ANOMALY_PLACEMENT_MASK()s of probe layouts, one pass each (Linux only) */
+	int daemon;                     /* Run trials continuously as a canary (Linux only) */
+	unsigned int rate;              /* Daemon: target trials per second */
+	uint32_t cpu_budget_ppm;        /* Daemon: share of one CPU it may use, in millionths */
+	const char *shm_path;           /* Daemon: shared-memory file with its counters */
+	const char *socket_path;        /* Daemon: Unix socket answering status queries */
+	uint64_t seed;                  /* Random seed for randomized tests, 0 picks one */
+	int adaptive;                   /* Stop as soon as the SPRT reaches a decision */
+	struct sprt_params sprt;        /* Hypotheses and error rates for adaptive runs */
+};
+
+/* A trial normally completes in microseconds, a second without progress is a hang */
+#define ANOMALY_DEFAULT_TIMEOUT_MS      1000
+
+/* Snapshots of anomalous trials written per intercept, the rest are only counted */
+#define ANOMALY_SNAPSHOT_MAX            8
+
+/* Trials of every corpus entry in a replay unless --iterations says otherwise */
+#define ANOMALY_DEFAULT_REPLAY_REPEAT   100
+
+/* The canary daemon's defaults: a steady trickle of trials within 1% of a CPU */
+#define ANOMALY_DEFAULT_DAEMON_RATE     100
+#define ANOMALY_DEFAULT_CPU_BUDGET_PPM  10000
+#define ANOMALY_DEFAULT_SHM_PATH        "/dev/shm/debug_test.stats"
+#define ANOMALY_DEFAULT_SOCKET_PATH     "/tmp/debug_test.sock"
+
+#define ANOMALY_OPTIONS_INIT { \
+	.iterations = 1, \
+	.backend = ANOMALY_BACKEND_PTRACE, \
+	.intercepts = ANOMALY_INTERCEPT_MASK(ANOMALY_INTERCEPT_CPUID), \
+	.timeout_ms = ANOMALY_DEFAULT_TIMEOUT_MS, \
+	.rate = ANOMALY_DEFAULT_DAEMON_RATE, \
+	.cpu_budget_ppm = ANOMALY_DEFAULT_CPU_BUDGET_PPM, \
+	.shm_path = ANOMALY_DEFAULT_SHM_PATH, \
+	.socket_path = ANOMALY_DEFAULT_SOCKET_PATH, \
+	.sprt = SPRT_PARAMS_DEFAULT, \
+}
+
+/**
+ * Maximum number of trials per worker. Adaptive runs treat --iterations as a
+ * cap and fall back to SPRT_DEFAULT_MAX_TRIALS when it was not given.
+ */
+static inline uint64_t anomaly_trial_budget(const struct anomaly_options *opts)
+{
+	if (opts->adaptive && !opts->iterations_set)
+		return SPRT_DEFAULT_MAX_TRIALS;
+	return opts->iterations;
+}
+
+/**
+ * Outcome of running one test. Test entry points return ANOMALY_RESULT_PASS
+ * when the platform behaved architecturally, ANOMALY_RESULT_DETECTED when the
+ * reproducer observed the anomaly, and anything else when the harness failed.
+ */
+enum anomaly_result {
+	ANOMALY_RESULT_PASS = 0,
+	ANOMALY_RESULT_FAIL = 1,
+	ANOMALY_RESULT_DETECTED = 2,
+};
+
+static inline enum anomaly_result anomaly_classify(int rc)
+{
+	if (rc == ANOMALY_RESULT_PASS || rc == ANOMALY_RESULT_DETECTED)
+		return (enum anomaly_result)rc;
+	return ANOMALY_RESULT_FAIL;
+}
+
+static inline const char *anomaly_result_name(enum anomaly_result result)
+{
+	switch (result) {
+	case ANOMALY_RESULT_PASS:       return "pass";
+	case ANOMALY_RESULT_DETECTED:   return "anomaly";
+	default:                        return "fail";
+	}
+}
+
+#define ANOMALY_PLATFORM_LINUX          0x1
+#define ANOMALY_PLATFORM_WINDOWS        0x2
+#define ANOMALY_PLATFORM_ALL            (ANOMALY_PLATFORM_LINUX | ANOMALY_PLATFORM_WINDOWS)
+#if defined(_WIN32)
+#define ANOMALY_PLATFORM_CURRENT        ANOMALY_PLATFORM_WINDOWS
+#else
+#define ANOMALY_PLATFORM_CURRENT        ANOMALY_PLATFORM_LINUX
+#endif
+
+/**
+ * Entry in the static test registry in main.c.
+ */
+struct anomaly_test {
+	const char *name;
+	const char *description;
+	unsigned int platforms;         /* ANOMALY_PLATFORM_* mask */
+	int (*run)(const struct anomaly_options *opts);
+};
+
+struct anomaly_test_result {
+	enum anomaly_result result;
+	int status;                     /* Exit code, or terminating signal when negative */
+	uint64_t elapsed_ns;
+};
+
+/** Alignment used to keep per-worker state on separate cache lines. */
+#define ANOMALY_CACHE_LINE      64
+
+/**
+ * DR6 outcome histogram.
+ *
+ * Only the DR6_VOLATILE bits carry information, so each observed DR6 value is
+ * folded into an 8-bit key (B0-B3 in the low nibble, BD/BS/BT/RTM in the high
+ * nibble) which directly indexes the count table.
+ */
+#define DR6_HIST_KEYS   256
+
+struct dr6_hist {
+	uint64_t count[DR6_HIST_KEYS];
+	uint64_t no_trap;       /* Trials which never raised a #DB */
+};
+
+static inline unsigned int dr6_hist_key(uint64_t dr6)
+{
+	return (unsigned int)((dr6 & DR6_TRAP_BITS) | ((dr6 >> 9) & 0xF0));
+}
+
+static inline uint64_t dr6_hist_value(unsigned int key)
+{
+	return DR6_FIXED | (key & DR6_TRAP_BITS) | ((uint64_t)(key & 0xF0) << 9);
+}
+
+static inline void dr6_hist_add(struct dr6_hist *hist, uint64_t dr6)
+{
+	hist->count[dr6_hist_key(dr6)]++;
+}
+
+static inline void dr6_hist_merge(struct dr6_hist *dst, const struct dr6_hist *src)
+{
+	for (unsigned int key = 0; key < DR6_HIST_KEYS; key++)
+		dst->count[key] += src->count[key];
+	dst->no_trap += src->no_trap;
+}
+
+static inline uint64_t dr6_hist_total(const struct dr6_hist *hist)
+{
+	uint64_t total = hist->no_trap;
+	for (unsigned int key = 0; key < DR6_HIST_KEYS; key++)
+		total += hist->count[key];
+	return total;
+}
+
+static inline void dr6_hist_print(const struct dr6_hist *hist)
+{
+	const uint64_t total = dr6_hist_total(hist);
+	char bits[DR6_BITS_STR_MAX];
+
+	if (total == 0)
+		return;
+
+	for (unsigned int key = 0; key < DR6_HIST_KEYS; key++) {
+		if (hist->count[key] == 0)
+			continue;
+		format_dr6_bits(dr6_hist_value(key), bits, sizeof(bits));
+		printf("  %12" PRIu64 " (%6.2f%%)  DR6: 0x%" PRIx64 "  %s\n",
+		       hist->count[key], 100.0 * hist->count[key] / total,
+		       dr6_hist_value(key), bits);
+	}
+	if (hist->no_trap != 0) {
+		printf("  %12" PRIu64 " (%6.2f%%)  no #DB observed\n",
+		       hist->no_trap, 100.0 * hist->no_trap / total);
+	}
+}
+
+/**
+ * Monotonic wall clock in nanoseconds, used for throughput reporting.
+ */
+static inline uint64_t anomaly_now_ns(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * xorshift64* generator. Cheap, reproducible from a logged seed, and good
+ * enough to drive configuration fuzzing. The state must never be zero.
+ */
+static inline uint64_t anomaly_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1Dull;
+}
+
+static inline void anomaly_print_rate(const char *name, uint64_t trials, uint64_t elapsed_ns)
+{
+	const double secs = (double)elapsed_ns / 1e9;
+	printf("%s: %" PRIu64 " trials in %.3f s (%.0f trials/sec)\n",
+	       name, trials, secs, secs > 0 ? (double)trials / secs : 0.0);
+}
+
+#endif /* ANOMALY_H */
@@ -0,0 +1,630 @@
+/*
+ * Aggregates debug_test results from many guests into anomaly matrices.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "drx.h"
+#include "anomaly.h"
+#include "trial_log.h"
+
+/*
+ * Inputs are either binary trial logs (--log) or captured debug_test text
+ * output: print_dr6() blocks, DR6 outcome histograms, and the "No SIGTRAP"
+ * and hang messages. Text results carry no machine description of their own, so the
+ * fleet wrapper prepends "host: ", "kernel: " and "cpu: " lines (a leading
+ * "# " is accepted, as written by --dump); every result that follows is
+ * charged to them. Binary logs carry the same description in their header.
+ */
+
+enum agg_class {
+	AGG_CLEAN,                              /* B0 and BS both reported */
+	AGG_NO_B0,                              /* Single-step only, the watchpoint hit was lost */
+	AGG_NO_BS,                              /* Watchpoint only, the single-step was lost */
+	AGG_NO_B0_BS,
+	AGG_NO_TRAP,                            /* No #DB at all */
+	AGG_MISMATCH,                           /* dr-fuzz: DR6 differed from the software model */
+	AGG_FAULT,                              /* Intercept faulted, the pending #DB is discarded */
+	AGG_HANG,                               /* Tracee made no progress and was killed */
+	AGG_CLASS_COUNT
+};
+
+static const char *const agg_class_names[AGG_CLASS_COUNT] = {
+	"clean", "no-B0", "no-BS", "no-B0/BS", "no-#DB", "mismatch", "fault", "hang",
+};
+
+enum agg_dim {
+	AGG_DIM_HOST,
+	AGG_DIM_KERNEL,
+	AGG_DIM_CPU,
+	AGG_DIM_COUNT
+};
+
+static const char *const agg_dim_names[AGG_DIM_COUNT] = { "host", "kernel", "cpu model" };
+
+/* Binary logs are split into chunks of this many records across threads */
+#define AGG_CHUNK_RECORDS       (1u << 20)
+
+#define AGG_NAME_MAX            TRIAL_LOG_META_STR
+
+/**
+ * Record classification by [dr-fuzz][TRIAL_F_* flags][DR6 histogram key]. The
+ * key folds the DR6_VOLATILE bits into 8 bits, so classifying a record is a
+ * single load from an 8 KiB table built once at startup.
+ */
+static uint8_t agg_lut[2][16][DR6_HIST_KEYS];
+
+static void agg_build_lut(void)
+{
+	for (unsigned int fuzz = 0; fuzz < 2; fuzz++) {
+		for (unsigned int flags = 0; flags < 16; flags++) {
+			for (unsigned int key = 0; key < DR6_HIST_KEYS; key++) {
+				const uint64_t dr6 = dr6_hist_value(key);
+				const int b0 = (dr6 & DR6_B0_BIT) != 0, bs = (dr6 & DR6_BS_BIT) != 0;
+				uint8_t cls;
+
+				if (flags & TRIAL_F_HANG)
+					cls = AGG_HANG;
+				else if (!(flags & TRIAL_F_TRAP))
+					cls = AGG_NO_TRAP;
+				else if (flags & TRIAL_F_FAULT)
+					cls = AGG_FAULT;
+				else if (fuzz)
+					cls = (flags & TRIAL_F_MISMATCH) ? AGG_MISMATCH : AGG_CLEAN;
+				else
+					cls = b0 ? (bs ? AGG_CLEAN : AGG_NO_BS) : (bs ? AGG_NO_B0 : AGG_NO_B0_BS);
+				agg_lut[fuzz][flags][key] = cls;
+			}
+		}
+	}
+}
+
+static inline unsigned int agg_classify(const struct trial_record *rec)
+{
+	return agg_lut[rec->test == ANOMALY_TEST_DR_FUZZ][rec->flags & 15][dr6_hist_key(rec->dr6)];
+}
+
+/*
+ * Open-addressed name -> class counts table, one per dimension. Workers only
+ * touch it when a file, chunk or text section ends, under agg_lock.
+ */
+struct agg_row {
+	char name[AGG_NAME_MAX];
+	uint64_t count[AGG_CLASS_COUNT];
+};
+
+struct agg_table {
+	struct agg_row **slots;
+	size_t capacity;
+	size_t used;
+};
+
+static struct agg_table agg_tables[AGG_DIM_COUNT];
+static pthread_mutex_t agg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t agg_hash(const char *name)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+
+	while (*name != '\0')
+		h = (h ^ (uint8_t)*name++) * 0x100000001b3ull;
+	return h;
+}
+
+static struct agg_row *agg_table_get(struct agg_table *t, const char *name)
+{
+	size_t i;
+
+	if (t->used * 2 >= t->capacity) {
+		struct agg_table grown = { .capacity = t->capacity ? t->capacity * 2 : 64 };
+
+		grown.slots = calloc(grown.capacity, sizeof(*grown.slots));
+		if (grown.slots == NULL)
+			return NULL;
+		for (size_t j = 0; j < t->capacity; j++) {
+			if (t->slots[j] == NULL)
+				continue;
+			i = agg_hash(t->slots[j]->name) & (grown.capacity - 1);
+			while (grown.slots[i] != NULL)
+				i = (i + 1) & (grown.capacity - 1);
+			grown.slots[i] = t->slots[j];
+		}
+		grown.used = t->used;
+		free(t->slots);
+		*t = grown;
+	}
+
+	i = agg_hash(name) & (t->capacity - 1);
+	while (t->slots[i] != NULL) {
+		if (strcmp(t->slots[i]->name, name) == 0)
+			return t->slots[i];
+		i = (i + 1) & (t->capacity - 1);
+	}
+
+	t->slots[i] = calloc(1, sizeof(**t->slots));
+	if (t->slots[i] == NULL)
+		return NULL;
+	snprintf(t->slots[i]->name, sizeof(t->slots[i]->name), "%s", name);
+	t->used++;
+	return t->slots[i];
+}
+
+struct agg_meta {
+	char name[AGG_DIM_COUNT][AGG_NAME_MAX];
+};
+
+static void agg_meta_init(struct agg_meta *meta)
+{
+	for (unsigned int d = 0; d < AGG_DIM_COUNT; d++)
+		snprintf(meta->name[d], sizeof(meta->name[d]), "unknown");
+}
+
+/*
+ * Charge a batch of class counts to the batch's host, kernel and CPU model.
+ */
+static int agg_flush(const struct agg_meta *meta, uint64_t *count)
+{
+	uint64_t total = 0;
+	int err = 0;
+
+	for (unsigned int c = 0; c < AGG_CLASS_COUNT; c++)
+		total += count[c];
+	if (total == 0)
+		return 0;
+
+	pthread_mutex_lock(&agg_lock);
+	for (unsigned int d = 0; d < AGG_DIM_COUNT; d++) {
+		struct agg_row *const row = agg_table_get(&agg_tables[d], meta->name[d]);
+
+		if (row == NULL) {
+			err = -1;
+			break;
+		}
+		for (unsigned int c = 0; c < AGG_CLASS_COUNT; c++)
+			row->count[c] += count[c];
+	}
+	pthread_mutex_unlock(&agg_lock);
+
+	memset(count, 0, AGG_CLASS_COUNT * sizeof(*count));
+	return err;
+}
+
+struct agg_file {
+	const char *path;
+	const char *base;
+	size_t size;
+	int binary;
+	struct trial_log log;
+};
+
+struct agg_work {
+	struct agg_file *file;
+	uint64_t first;                         /* Binary logs only: record range */
+	uint64_t count;
+};
+
+struct agg_state {
+	struct agg_work *work;
+	size_t nwork;
+	size_t next;                            /* Next work item, taken atomically */
+	uint64_t records;                       /* Results classified, all threads */
+	int err;
+};
+
+static void agg_binary(const struct agg_work *work, struct agg_state *st)
+{
+	const struct trial_log *const log = &work->file->log;
+	const struct trial_record *const rec = log->records + work->first;
+	uint64_t count[AGG_CLASS_COUNT] = { 0 };
+	struct agg_meta meta;
+
+	agg_meta_init(&meta);
+	if (log->meta != NULL) {
+		snprintf(meta.name[AGG_DIM_HOST], AGG_NAME_MAX, "%.63s", log->meta->host);
+		snprintf(meta.name[AGG_DIM_KERNEL], AGG_NAME_MAX, "%.63s", log->meta->kernel);
+		snprintf(meta.name[AGG_DIM_CPU], AGG_NAME_MAX, "%.63s", log->meta->cpu_model);
+	}
+
+	for (uint64_t i = 0; i < work->count; i++)
+		count[agg_classify(&rec[i])]++;
+
+	__atomic_fetch_add(&st->records, work->count, __ATOMIC_RELAXED);
+	if (agg_flush(&meta, count) != 0)
+		st->err = 1;
+}
+
+/* Unsigned decimal or 0x-prefixed hex at p, bounded by end. */
+static const char *agg_parse_u64(const char *p, const char *end, uint64_t *value)
+{
+	const char *const start = p;
+	unsigned int base = 10;
+
+	*value = 0;
+	if (end - p > 2 && p[0] == '0' && p[1] == 'x') {
+		base = 16;
+		p += 2;
+	}
+	for (; p < end; p++) {
+		unsigned int digit;
+
+		if (*p >= '0' && *p <= '9')
+			digit = (unsigned int)(*p - '0');
+		else if (base == 16 && (*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+			digit = (unsigned int)((*p | 0x20) - 'a' + 10);
+		else
+			break;
+		*value = *value * base + digit;
+	}
+	return p == start ? NULL : p;
+}
+
+static int agg_starts_with(const char *p, const char *end, const char *prefix)
+{
+	const size_t n = strlen(prefix);
+	return (size_t)(end - p) >= n && memcmp(p, prefix, n) == 0;
+}
+
+/*
+ * Scan captured debug_test output line by line. The "all CPUs", "all threads"
+ * and "all tracees" totals repeat the per-worker histograms above them and are
+ * skipped. Hung trials are part of a histogram's "no #DB" count and are moved
+ * out of it by the hang line that follows.
+ */
+static void agg_text(const struct agg_work *work, struct agg_state *st)
+{
+	static const char *const meta_keys[AGG_DIM_COUNT] = { "host:", "kernel:", "cpu:" };
+	const char *p = work->file->base;
+	const char *const end = p + work->file->size;
+	uint64_t count[AGG_CLASS_COUNT] = { 0 };
+	uint64_t records = 0;
+	struct agg_meta meta;
+	int skip = 0;
+
+	agg_meta_init(&meta);
+	while (p < end) {
+		const char *eol = memchr(p, '\n', (size_t)(end - p));
+		const char *line = p, *q;
+		uint64_t n = 1, dr6;
+		unsigned int d;
+
+		if (eol == NULL)
+			eol = end;
+		p = eol + 1;
+		while (eol > line && eol[-1] == '\r')
+			eol--;
+
+		/* Machine description for the results that follow */
+		q = agg_starts_with(line, eol, "# ") ? line + 2 : line;
+		for (d = 0; d < AGG_DIM_COUNT; d++) {
+			if (agg_starts_with(q, eol, meta_keys[d]))
+				break;
+		}
+		if (d < AGG_DIM_COUNT) {
+			if (agg_flush(&meta, count) != 0)
+				st->err = 1;
+			q += strlen(meta_keys[d]);
+			while (q < eol && *q == ' ')
+				q++;
+			snprintf(meta.name[d], AGG_NAME_MAX, "%.*s",
+				 (int)(eol - q < AGG_NAME_MAX - 1 ? eol - q : AGG_NAME_MAX - 1), q);
+			continue;
+		}
+
+		if (line < eol && *line != ' ')
+			skip = agg_starts_with(line, eol, "all CPUs:") ||
+			       agg_starts_with(line, eol, "all threads:") ||
+			       agg_starts_with(line, eol, "all tracees:");
+		if (skip)
+			continue;
+
+		q = line;
+		while (q < eol && *q == ' ')
+			q++;
+
+		if (agg_starts_with(q, eol, "No SIGTRAP/#DB observed")) {
+			count[AGG_NO_TRAP]++;
+			records++;
+			continue;
+		}
+		if (agg_starts_with(q, eol, "Trial hung")) {
+			count[AGG_HANG]++;
+			records++;
+			continue;
+		}
+
+		/* Histogram line: "<count> (<pct>%)  DR6: 0x...", or a bare print_dr6() */
+		if (q < eol && *q >= '0' && *q <= '9') {
+			q = agg_parse_u64(q, eol, &n);
+			if (q != NULL && agg_starts_with(q, eol, " trials hung") && n <= count[AGG_NO_TRAP]) {
+				count[AGG_NO_TRAP] -= n;
+				count[AGG_HANG] += n;
+				continue;
+			}
+			if (q == NULL || !agg_starts_with(q, eol, " ("))
+				continue;
+			q = memchr(q, ')', (size_t)(eol - q));
+			if (q == NULL)
+				continue;
+			q++;
+			while (q < eol && *q == ' ')
+				q++;
+			if (agg_starts_with(q, eol, "no #DB observed")) {
+				count[AGG_NO_TRAP] += n;
+				records += n;
+				continue;
+			}
+		}
+
+		if (!agg_starts_with(q, eol, "DR6: ") ||
+		    agg_parse_u64(q + 5, eol, &dr6) == NULL)
+			continue;
+
+		count[agg_lut[0][TRIAL_F_TRAP][dr6_hist_key(dr6)]] += n;
+		records += n;
+	}
+
+	__atomic_fetch_add(&st->records, records, __ATOMIC_RELAXED);
+	if (agg_flush(&meta, count) != 0)
+		st->err = 1;
+}
+
+static void *agg_thread(void *arg)
+{
+	struct agg_state *const st = arg;
+
+	for (;;) {
+		const size_t i = __atomic_fetch_add(&st->next, 1, __ATOMIC_RELAXED);
+
+		if (i >= st->nwork)
+			break;
+		if (st->work[i].file->binary)
+			agg_binary(&st->work[i], st);
+		else
+			agg_text(&st->work[i], st);
+	}
+	return NULL;
+}
+
+static int agg_open(struct agg_file *file)
+{
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(file->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	file->size = (size_t)st.st_size;
+	if (file->size == 0) {
+		close(fd);
+		file->base = "";
+		return 0;
+	}
+
+	base = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -1;
+	madvise(base, file->size, MADV_SEQUENTIAL);
+
+	file->base = base;
+	file->binary = trial_log_attach(&file->log, base, file->size) == 0;
+	return 0;
+}
+
+static int agg_row_cmp(const void *a, const void *b)
+{
+	return strcmp((*(struct agg_row *const *)a)->name, (*(struct agg_row *const *)b)->name);
+}
+
+static void agg_print(int csv)
+{
+	for (unsigned int d = 0; d < AGG_DIM_COUNT; d++) {
+		struct agg_table *const t = &agg_tables[d];
+		struct agg_row **rows;
+		size_t n = 0;
+
+		rows = calloc(t->used ? t->used : 1, sizeof(*rows));
+		if (rows == NULL)
+			return;
+		for (size_t i = 0; i < t->capacity; i++) {
+			if (t->slots[i] != NULL)
+				rows[n++] = t->slots[i];
+		}
+		qsort(rows, n, sizeof(*rows), agg_row_cmp);
+
+		if (!csv) {
+			printf("\nby %s:\n%-32s %12s", agg_dim_names[d], agg_dim_names[d], "trials");
+			for (unsigned int c = 0; c < AGG_CLASS_COUNT; c++)
+				printf(" %10s", agg_class_names[c]);
+			printf(" %9s\n", "anomaly%");
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			const uint64_t *const count = rows[i]->count;
+			uint64_t total = 0, anomalies;
+
+			for (unsigned int c = 0; c < AGG_CLASS_COUNT; c++)
+				total += count[c];
+			anomalies = total - count[AGG_CLEAN] - count[AGG_FAULT];
+
+			if (csv) {
+				printf("%s,\"%s\",%" PRIu64, agg_dim_names[d], rows[i]->name, total);
+				for (unsigned int c = 0; c < AGG_CLASS_COUNT; c++)
+					printf(",%" PRIu64, count[c]);
+				printf("\n");
+				continue;
+			}
+
+			printf("%-32.32s %12" PRIu64, rows[i]->name, total);
+			for (unsigned int c = 0; c < AGG_CLASS_COUNT; c++)
+				printf(" %10" PRIu64, count[c]);
+			printf(" %8.3f%%\n", total - count[AGG_FAULT] != 0 ?
+			       100.0 * (double)anomalies / (double)(total - count[AGG_FAULT]) : 0.0);
+		}
+		free(rows);
+	}
+}
+
+static void print_help(const char *progname)
+{
+	printf("Usage: %s [--jobs N] [--csv] FILE...\n", progname);
+	printf("Classify debug_test results and print anomaly matrices per host, kernel and CPU model.\n");
+	printf("FILE is a binary trial log written with --log, or captured text output. Text results\n");
+	printf("are charged to the most recent \"host: \", \"kernel: \" and \"cpu: \" lines before them.\n");
+	printf("Options:\n");
+	printf("  --jobs N              Parser threads (default: online CPUs)\n");
+	printf("  --csv                 Print dimension,name,trials,<class counts...> rows\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct agg_state st = { 0 };
+	struct agg_file *files;
+	pthread_t *threads;
+	size_t nfiles = 0;
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t start_ns, elapsed_ns;
+	int csv = 0;
+	int nthreads = 0;
+
+	files = calloc((size_t)argc, sizeof(*files));
+	if (files == NULL) {
+		perror("alloc files");
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+			print_help(argv[0]);
+			return 1;
+		} else if (strcmp(argv[i], "--csv") == 0) {
+			csv = 1;
+		} else if (strcmp(argv[i], "--jobs") == 0) {
+			char *end;
+
+			jobs = i + 1 < argc ? strtol(argv[++i], &end, 0) : 0;
+			if (jobs <= 0 || jobs > 4096 || *end != '\0') {
+				fprintf(stderr, "--jobs requires a count between 1 and 4096\n");
+				return EINVAL;
+			}
+		} else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+			fprintf(stderr, "Unknown option: %s\n", argv[i]);
+			return EINVAL;
+		} else {
+			files[nfiles++].path = argv[i];
+		}
+	}
+
+	if (nfiles == 0) {
+		print_help(argv[0]);
+		return 1;
+	}
+
+	start_ns = anomaly_now_ns();
+	agg_build_lut();
+
+	/* Map every input and split binary logs into per-thread chunks */
+	for (size_t f = 0; f < nfiles; f++) {
+		if (agg_open(&files[f]) != 0) {
+			perror(files[f].path);
+			return 1;
+		}
+		st.nwork += files[f].binary ?
+			    (trial_log_count(&files[f].log) + AGG_CHUNK_RECORDS - 1) / AGG_CHUNK_RECORDS : 1;
+	}
+
+	st.work = calloc(st.nwork ? st.nwork : 1, sizeof(*st.work));
+	threads = calloc((size_t)jobs, sizeof(*threads));
+	if (st.work == NULL || threads == NULL) {
+		perror("alloc work");
+		return 1;
+	}
+	st.nwork = 0;
+	for (size_t f = 0; f < nfiles; f++) {
+		const uint64_t count = files[f].binary ? trial_log_count(&files[f].log) : 0;
+
+		if (!files[f].binary) {
+			st.work[st.nwork++].file = &files[f];
+			continue;
+		}
+		for (uint64_t first = 0; first < count; first += AGG_CHUNK_RECORDS) {
+			st.work[st.nwork].file = &files[f];
+			st.work[st.nwork].first = first;
+			st.work[st.nwork].count = count - first < AGG_CHUNK_RECORDS ?
+						  count - first : AGG_CHUNK_RECORDS;
+			st.nwork++;
+		}
+	}
+
+	if ((size_t)jobs > st.nwork)
+		jobs = st.nwork ? (long)st.nwork : 1;
+	for (long t = 0; t < jobs; t++) {
+		if (pthread_create(&threads[t], NULL, agg_thread, &st) != 0) {
+			perror("pthread_create");
+			break;
+		}
+		nthreads++;
+	}
+	if (nthreads == 0)
+		agg_thread(&st);
+	for (int t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+	elapsed_ns = anomaly_now_ns() - start_ns;
+
+	if (csv) {
+		printf("dimension,name,trials");
+		for (unsigned int c = 0; c < AGG_CLASS_COUNT; c++)
+			printf(",%s", agg_class_names[c]);
+		printf("\n");
+	} else {
+		printf("# %zu files, %" PRIu64 " results in %.3f s (%.0f results/sec, %d threads)\n",
+		       nfiles, st.records, (double)elapsed_ns / 1e9,
+		       elapsed_ns ? (double)st.records * 1e9 / (double)elapsed_ns : 0.0,
+		       nthreads ? nthreads : 1);
+	}
+	agg_print(csv);
+
+	for (size_t f = 0; f < nfiles; f++) {
+		if (files[f].size != 0)
+			munmap((void *)files[f].base, files[f].size);
+	}
+	free(threads);
+	free(st.work);
+	free(files);
+	return st.err ? 1 : 0;
+}
@@ -0,0 +1,672 @@
+/*
+ * Regression benchmarks of the pending-dbg-causes trial path.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <errno.h>
+#include "drx.h"
+#include "anomaly.h"
+#include "tsc.h"
+#include "latency.h"
+#include "trial_log.h"
+#include "corpus.h"
+#include "dr6_model.h"
+#include "simd_state.h"
+
+/* The trial path under test, built exactly as debug_test builds it */
+#include "pending_dbg_causes.inl"
+
+/*
+ * Every workload is fixed so results compare across builds. Rates are trials
+ * per second of wall time, latencies TSC cycles per trial:
+ * - oneshot-ptrace: single-trial runs, each forking a fresh tracee, which is
+ *                   what a plain "debug_test pending-dbg-causes" does
+ * - batch-ptrace:   one tracee running a batch, serviced stop by stop
+ * - batch-perf:     the same batch in-process with a perf breakpoint
+ * - cpuid-baseline: MOV SS + CPUID without TF or a watchpoint armed
+ */
+#define BENCH_ONESHOT_RUNS      200
+#define BENCH_BATCH_TRIALS      20000
+#define BENCH_BASELINE_TRIALS   100000
+
+/*
+ * Each workload runs this often, the fastest repetition is reported. The
+ * repetitions take turns across workloads, so a busy phase of a shared host
+ * slows every workload rather than all repetitions of one, relative values
+ * included.
+ */
+#define BENCH_REPEATS           5
+
+/*
+ * Exit code CTest treats as skipped, when no workload could run here or the
+ * baseline is from another machine
+ */
+#define BENCH_SKIPPED           77
+
+/*
+ * Absolute rates and cycles only hold for the host a baseline was recorded
+ * on, so by default every workload is checked relative to cpuid-baseline of
+ * the same run instead, which a slower or faster host scales alike. The absolute
+ * values are checked as well with --absolute, on the recording host. CPUID
+ * itself exits to the hypervisor and costs orders of magnitude more or less
+ * elsewhere, so even relative values only compare on the same CPU model under
+ * the same hypervisor, and a baseline from any other is skipped.
+ */
+#define BENCH_REFERENCE         "cpuid-baseline"
+
+/*
+ * Default allowed slowdown relative to the reference, for the time per trial,
+ * p50 and p99. Tails jitter far more than medians on a shared host.
+ */
+#define BENCH_THROUGHPUT_TOLERANCE      0.20
+#define BENCH_LATENCY_TOLERANCE         0.20
+#define BENCH_TAIL_TOLERANCE            0.75
+
+/* Default allowed slowdown of absolute values: throughput may drop by half, latency may double */
+#define BENCH_ABSOLUTE_THROUGHPUT_TOLERANCE     0.5
+#define BENCH_ABSOLUTE_LATENCY_TOLERANCE        1.0
+
+/*
+ * A host showing the anomalies this project hunts for still measures, so
+ * traps and anomalous trials are counted and reported, and only harness
+ * errors fail a workload.
+ */
+struct bench_result {
+	uint64_t trials;
+	uint64_t traps;
+	uint64_t anomalies;                     /* Trials whose DR6 missed B0 or BS, or never trapped */
+	uint64_t elapsed_ns;
+	struct latency_hist lat;
+	int skipped;
+};
+
+/* The machine a run measured, recorded with its results */
+struct bench_host {
+	struct trial_log_meta meta;
+	char hypervisor[TRIAL_LOG_META_STR];
+};
+
+struct bench_workload {
+	const char *name;
+	int (*run)(struct bench_result *r);
+};
+
+static struct pending_dbg_causes_worker bench_worker;
+
+static struct pending_dbg_causes_worker *bench_worker_init(const struct anomaly_options *opts,
+							   struct tracee_pool *pool)
+{
+	struct pending_dbg_causes_worker *const w = &bench_worker;
+
+	memset(w, 0, sizeof(*w));
+	w->cpu = -1;
+	w->intercept = ANOMALY_INTERCEPT_CPUID;
+	w->opts = opts;
+	w->pool = pool;
+	return w;
+}
+
+static int bench_oneshot_ptrace(struct bench_result *r)
+{
+	const struct anomaly_options opts = ANOMALY_OPTIONS_INIT;
+	struct tracee_pool pool;
+	uint64_t start_ns;
+	int err = 0;
+
+	if (tracee_pool_init(&pool, sizeof(struct pending_dbg_causes_job), 0) != 0)
+		return 1;
+
+	start_ns = anomaly_now_ns();
+	for (unsigned int i = 0; i < BENCH_ONESHOT_RUNS && !err; i++) {
+		struct pending_dbg_causes_worker *const w = bench_worker_init(&opts, &pool);
+		const uint64_t start = rdtsc();
+
+		err = pending_dbg_causes_run(w) != 0;
+		latency_add(&r->lat, rdtsc() - start);
+		r->trials += w->trials;
+		r->traps += w->traps;
+		r->anomalies += w->anomalies;
+	}
+	r->elapsed_ns = anomaly_now_ns() - start_ns;
+	tracee_pool_destroy(&pool);
+	return err;
+}
+
+static int bench_batch(struct bench_result *r, enum anomaly_backend backend)
+{
+	struct anomaly_options opts = ANOMALY_OPTIONS_INIT;
+	struct pending_dbg_causes_worker *w;
+	struct tracee_pool pool;
+	int err;
+
+	opts.iterations = BENCH_BATCH_TRIALS;
+	opts.backend = backend;
+	if (tracee_pool_init(&pool, sizeof(struct pending_dbg_causes_job), 0) != 0)
+		return 1;
+
+	w = bench_worker_init(&opts, &pool);
+	err = pending_dbg_causes_run(w) != 0;
+	r->trials = w->trials;
+	r->traps = w->traps;
+	r->anomalies = w->anomalies;
+	r->elapsed_ns = w->elapsed_ns;
+	latency_merge(&r->lat, &w->lat[PDC_LAT_ROUND_TRIP]);
+	tracee_pool_destroy(&pool);
+	return err;
+}
+
+static int bench_batch_ptrace(struct bench_result *r)
+{
+	return bench_batch(r, ANOMALY_BACKEND_PTRACE);
+}
+
+static int bench_batch_perf(struct bench_result *r)
+{
+	struct sigaction old_signals[3];
+	uint16_t probe = 0;
+	int fd, err;
+
+	/* perf_event_paranoid may forbid breakpoints, nothing to measure then */
+	fd = perf_bp_open((uintptr_t)&probe, HW_BREAKPOINT_LEN_2, HW_BREAKPOINT_RW);
+	if (fd < 0) {
+		r->skipped = 1;
+		return 0;
+	}
+	close(fd);
+
+	if (pending_dbg_causes_perf_signals(old_signals) != 0)
+		return 1;
+	err = bench_batch(r, ANOMALY_BACKEND_PERF);
+	pending_dbg_causes_perf_restore(old_signals);
+	return err;
+}
+
+static int bench_cpuid_baseline(struct bench_result *r)
+{
+	struct anomaly_options opts = ANOMALY_OPTIONS_INIT;
+	struct pending_dbg_causes_worker *w;
+	uint64_t start_ns;
+
+	opts.iterations = BENCH_BASELINE_TRIALS;
+	w = bench_worker_init(&opts, NULL);
+	pending_dbg_causes_init(w);
+
+	start_ns = anomaly_now_ns();
+	pending_dbg_causes_baseline(w);
+	r->elapsed_ns = anomaly_now_ns() - start_ns;
+	r->trials = w->lat[PDC_LAT_BASELINE].count;
+	latency_merge(&r->lat, &w->lat[PDC_LAT_BASELINE]);
+	return 0;
+}
+
+static const struct bench_workload bench_workloads[] = {
+	{ "oneshot-ptrace", bench_oneshot_ptrace },
+	{ "batch-ptrace",   bench_batch_ptrace },
+	{ "batch-perf",     bench_batch_perf },
+	{ "cpuid-baseline", bench_cpuid_baseline },
+};
+
+#define BENCH_WORKLOAD_COUNT (sizeof(bench_workloads) / sizeof(bench_workloads[0]))
+
+static double bench_rate(const struct bench_result *r)
+{
+	return r->elapsed_ns != 0 ? (double)r->trials * 1e9 / (double)r->elapsed_ns : 0.0;
+}
+
+/* The reference workload's result, NULL when it did not run */
+static const struct bench_result *bench_reference(const struct bench_result *results)
+{
+	for (size_t i = 0; i < BENCH_WORKLOAD_COUNT; i++) {
+		if (strcmp(bench_workloads[i].name, BENCH_REFERENCE) == 0)
+			return results[i].skipped ? NULL : &results[i];
+	}
+	return NULL;
+}
+
+/*
+ * A workload relative to the reference, all lower is better: time per trial
+ * as a multiple of the reference's, p50 and p99 as multiples of its p50. The
+ * reference's own p99 is too jittery to divide by. 0 without a reference.
+ */
+struct bench_relative {
+	double cost;
+	double p50;
+	double p99;
+};
+
+static struct bench_relative bench_relative(const struct bench_result *r, const struct bench_result *ref)
+{
+	struct bench_relative rel = { 0 };
+	uint64_t p50;
+
+	if (ref == NULL || bench_rate(r) == 0 || (p50 = latency_percentile(&ref->lat, 50.0)) == 0)
+		return rel;
+	rel.cost = bench_rate(ref) / bench_rate(r);
+	rel.p50 = (double)latency_percentile(&r->lat, 50.0) / (double)p50;
+	rel.p99 = (double)latency_percentile(&r->lat, 99.0) / (double)p50;
+	return rel;
+}
+
+static void bench_host_init(struct bench_host *host)
+{
+	trial_log_fill_meta(&host->meta);
+	trial_log_hypervisor(host->hypervisor, sizeof(host->hypervisor));
+}
+
+static void bench_write_string(FILE *out, const char *key, const char *value)
+{
+	fprintf(out, "  \"%s\": \"", key);
+	for (; *value != '\0'; value++) {
+		if (*value == '"' || *value == '\\')
+			fputc('\\', out);
+		fputc(*value, out);
+	}
+	fprintf(out, "\",\n");
+}
+
+static void bench_write_json(FILE *out, const struct bench_host *host, const struct bench_result *results)
+{
+	const struct bench_result *const ref = bench_reference(results);
+	int first = 1;
+
+	fprintf(out, "{\n");
+	bench_write_string(out, "host", host->meta.host);
+	bench_write_string(out, "kernel", host->meta.kernel);
+	bench_write_string(out, "cpu_model", host->meta.cpu_model);
+	bench_write_string(out, "hypervisor", host->hypervisor);
+	fprintf(out, "  \"throughput_tolerance\": %.2f,\n", BENCH_THROUGHPUT_TOLERANCE);
+	fprintf(out, "  \"latency_tolerance\": %.2f,\n", BENCH_LATENCY_TOLERANCE);
+	fprintf(out, "  \"tail_tolerance\": %.2f,\n", BENCH_TAIL_TOLERANCE);
+	fprintf(out, "  \"absolute_throughput_tolerance\": %.2f,\n", BENCH_ABSOLUTE_THROUGHPUT_TOLERANCE);
+	fprintf(out, "  \"absolute_latency_tolerance\": %.2f,\n", BENCH_ABSOLUTE_LATENCY_TOLERANCE);
+	fprintf(out, "  \"workloads\": [");
+	for (size_t i = 0; i < BENCH_WORKLOAD_COUNT; i++) {
+		const struct bench_result *const r = &results[i];
+		const struct bench_relative rel = bench_relative(r, ref);
+
+		if (r->skipped)
+			continue;
+		fprintf(out, "%s\n    { \"name\": \"%s\", \"trials\": %" PRIu64 ", \"traps\": %" PRIu64 ", "
+			"\"anomalies\": %" PRIu64 ", \"trials_per_sec\": %.1f, "
+			"\"p50_cycles\": %" PRIu64 ", \"p99_cycles\": %" PRIu64 ", \"relative_cost\": %.3f, "
+			"\"p50_relative\": %.3f, \"p99_relative\": %.3f }",
+			first ? "" : ",", bench_workloads[i].name, r->trials, r->traps, r->anomalies, bench_rate(r),
+			latency_percentile(&r->lat, 50.0), latency_percentile(&r->lat, 99.0),
+			rel.cost, rel.p50, rel.p99);
+		first = 0;
+	}
+	fprintf(out, "\n  ]\n}\n");
+}
+
+/*
+ * Just enough JSON for baselines written by bench_write_json(): numbers are
+ * looked up by key within [p, end), and a workload's keys within the braces
+ * around its "name". Per-workload tolerance keys override the top-level ones.
+ */
+static int bench_json_number(const char *p, const char *end, const char *key, double *value)
+{
+	const size_t len = strlen(key);
+
+	for (; p + len + 2 <= end; p++) {
+		char *num_end;
+
+		if (p[0] != '"' || strncmp(p + 1, key, len) != 0 || p[len + 1] != '"')
+			continue;
+		p += len + 2;
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == ':'))
+			p++;
+		*value = strtod(p, &num_end);
+		return num_end != p && num_end <= end ? 0 : -1;
+	}
+	return -1;
+}
+
+/* A string value written by bench_write_string(), unescaped into buf */
+static int bench_json_string(const char *p, const char *end, const char *key, char *buf, size_t size)
+{
+	const size_t len = strlen(key);
+	size_t n = 0;
+
+	for (; p + len + 2 <= end; p++) {
+		if (p[0] != '"' || strncmp(p + 1, key, len) != 0 || p[len + 1] != '"')
+			continue;
+		p += len + 2;
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == ':'))
+			p++;
+		if (p == end || *p++ != '"')
+			return -1;
+		for (; p < end && *p != '"'; p++) {
+			if (*p == '\\' && p + 1 < end)
+				p++;
+			if (n + 1 < size)
+				buf[n++] = *p;
+		}
+		buf[n] = '\0';
+		return p < end ? 0 : -1;
+	}
+	return -1;
+}
+
+static int bench_json_workload(const char *json, const char *name, const char **start, const char **end)
+{
+	char pattern[64];
+	const char *p;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\"", name);
+	p = strstr(json, pattern);
+	if (p == NULL)
+		return -1;
+	for (*start = p; *start > json && **start != '{'; (*start)--)
+		;
+	*end = strchr(p, '}');
+	if (*end == NULL)
+		*end = p + strlen(p);
+	return 0;
+}
+
+/*
+ * Whether the baseline was recorded where its values mean something: on the
+ * same CPU model under the same hypervisor, and on the same host for absolute
+ * values. Says why not when it was not.
+ */
+static int bench_host_matches(const char *json, const struct bench_host *host, int absolute)
+{
+	const char *const end = json + strlen(json);
+	const struct {
+		const char *key;
+		const char *value;
+		int absolute_only;
+	} fields[] = {
+		{ "cpu_model",  host->meta.cpu_model, 0 },
+		{ "hypervisor", host->hypervisor,     0 },
+		{ "host",       host->meta.host,      1 },
+	};
+	char recorded[TRIAL_LOG_META_STR];
+
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+		if (fields[i].absolute_only && !absolute)
+			continue;
+		if (bench_json_string(json, end, fields[i].key, recorded, sizeof(recorded)) != 0) {
+			fprintf(stderr, "baseline records no %s\n", fields[i].key);
+			return 0;
+		}
+		if (strcmp(recorded, fields[i].value) != 0) {
+			fprintf(stderr, "baseline %s is \"%s\", this one is \"%s\"\n", fields[i].key, recorded,
+				fields[i].value);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static char *bench_read_file(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	char *buf;
+	long size;
+
+	if (f == NULL)
+		return NULL;
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		fclose(f);
+		return NULL;
+	}
+	buf = malloc((size_t)size + 1);
+	if (buf != NULL) {
+		buf[fread(buf, 1, (size_t)size, f)] = '\0';
+	}
+	fclose(f);
+	return buf;
+}
+
+/*
+ * Compare one metric against its baseline. Higher is better for throughput,
+ * lower for latency. Returns 1 on a regression beyond the tolerance.
+ */
+static int bench_check(const char *workload, const char *metric, double value, double base,
+		       double tolerance, int higher_is_better)
+{
+	const double limit = higher_is_better ? base * (1.0 - tolerance) : base * (1.0 + tolerance);
+	const int regressed = higher_is_better ? value < limit : value > limit;
+
+	fprintf(stderr, "  %-16s %-16s %14.1f %14.1f %+9.1f%%  %s\n", workload, metric, value, base,
+		base != 0 ? (value - base) * 100.0 / base : 0.0, regressed ? "REGRESSION" : "ok");
+	return regressed;
+}
+
+/*
+ * A tolerance for a workload: the top-level key, then the workload's own,
+ * then the command line.
+ */
+static double bench_tolerance(const char *json, const char *start, const char *end, const char *key,
+			      double def, double cli)
+{
+	double value = def;
+
+	bench_json_number(json, json + strlen(json), key, &value);
+	bench_json_number(start, end, key, &value);
+	return cli >= 0 ? cli : value;
+}
+
+static int bench_compare(const char *json, const struct bench_result *results, int absolute,
+			 double throughput_tolerance, double latency_tolerance)
+{
+	const struct bench_result *const ref = bench_reference(results);
+	int regressions = 0;
+
+	if (ref == NULL)
+		fprintf(stderr, "  %s did not run, relative checks skipped\n", BENCH_REFERENCE);
+
+	fprintf(stderr, "  %-16s %-16s %14s %14s %10s\n", "workload", "metric", "value", "baseline", "change");
+	for (size_t i = 0; i < BENCH_WORKLOAD_COUNT; i++) {
+		const struct bench_result *const r = &results[i];
+		const struct bench_relative rel = bench_relative(r, ref);
+		const char *name = bench_workloads[i].name;
+		double base_cost, base_p50, base_p99;
+		const char *start, *end;
+
+		if (r->skipped)
+			continue;
+		if (bench_json_workload(json, name, &start, &end) != 0) {
+			fprintf(stderr, "  %-16s no baseline\n", name);
+			continue;
+		}
+
+		/* The reference is 1.0 relative to itself, only absolute values say anything about it */
+		if (ref != NULL && r != ref) {
+			if (bench_json_number(start, end, "relative_cost", &base_cost) != 0 ||
+			    bench_json_number(start, end, "p50_relative", &base_p50) != 0 ||
+			    bench_json_number(start, end, "p99_relative", &base_p99) != 0) {
+				fprintf(stderr, "  %-16s no relative baseline\n", name);
+			} else {
+				regressions += bench_check(name, "relative cost", rel.cost, base_cost,
+							   bench_tolerance(json, start, end, "throughput_tolerance",
+									   BENCH_THROUGHPUT_TOLERANCE,
+									   throughput_tolerance), 0);
+				regressions += bench_check(name, "p50 relative", rel.p50, base_p50,
+							   bench_tolerance(json, start, end, "latency_tolerance",
+									   BENCH_LATENCY_TOLERANCE,
+									   latency_tolerance), 0);
+				regressions += bench_check(name, "p99 relative", rel.p99, base_p99,
+							   bench_tolerance(json, start, end, "tail_tolerance",
+									   BENCH_TAIL_TOLERANCE,
+									   latency_tolerance), 0);
+			}
+		}
+
+		if (absolute) {
+			double base_rate, tput, lat;
+
+			if (bench_json_number(start, end, "trials_per_sec", &base_rate) != 0 ||
+			    bench_json_number(start, end, "p50_cycles", &base_p50) != 0 ||
+			    bench_json_number(start, end, "p99_cycles", &base_p99) != 0) {
+				fprintf(stderr, "  %-16s no absolute baseline\n", name);
+				continue;
+			}
+			tput = bench_tolerance(json, start, end, "absolute_throughput_tolerance",
+					       BENCH_ABSOLUTE_THROUGHPUT_TOLERANCE, throughput_tolerance);
+			lat = bench_tolerance(json, start, end, "absolute_latency_tolerance",
+					      BENCH_ABSOLUTE_LATENCY_TOLERANCE, latency_tolerance);
+			regressions += bench_check(name, "trials/sec", bench_rate(r), base_rate, tput, 1);
+			regressions += bench_check(name, "p50 cycles", (double)latency_percentile(&r->lat, 50.0),
+						   base_p50, lat, 0);
+			regressions += bench_check(name, "p99 cycles", (double)latency_percentile(&r->lat, 99.0),
+						   base_p99, lat, 0);
+		}
+	}
+	return regressions;
+}
+
+static void print_help(const char *progname)
+{
+	printf("Usage: %s [--baseline FILE [--absolute]] [--json FILE] [--throughput-tolerance F]\n"
+	       "       [--latency-tolerance F]\n", progname);
+	printf("Run fixed pending-dbg-causes workloads and print trials/sec and p50/p99 latency as JSON,\n");
+	printf("absolute and relative to %s of the same run.\n", BENCH_REFERENCE);
+	printf("Options:\n");
+	printf("  --baseline FILE              Compare against FILE (JSON as printed) and fail on regressions,\n");
+	printf("                               relative to %s, skipped (exit %d) when it was recorded on\n",
+	       BENCH_REFERENCE, BENCH_SKIPPED);
+	printf("                               another CPU model or hypervisor\n");
+	printf("  --absolute                   Also compare absolute trials/sec and cycles, only meaningful on\n");
+	printf("                               the host the baseline was recorded on, skipped on any other\n");
+	printf("                               (default tolerances %.2f and %.2f)\n",
+	       BENCH_ABSOLUTE_THROUGHPUT_TOLERANCE, BENCH_ABSOLUTE_LATENCY_TOLERANCE);
+	printf("  --json FILE                  Also write the results to FILE, e.g. to update the baseline\n");
+	printf("  --throughput-tolerance F     Allowed relative cost increase (trials/sec drop with --absolute)\n");
+	printf("                               as a fraction, overrides the baseline's (default %.2f)\n",
+	       BENCH_THROUGHPUT_TOLERANCE);
+	printf("  --latency-tolerance F        Allowed p50/p99 increase as a fraction, overrides the baseline's\n");
+	printf("                               (default %.2f, %.2f for p99)\n", BENCH_LATENCY_TOLERANCE,
+	       BENCH_TAIL_TOLERANCE);
+}
+
+int main(int argc, char *argv[])
+{
+	static struct bench_result results[BENCH_WORKLOAD_COUNT];
+	struct bench_host host;
+	const char *baseline_path = NULL, *json_path = NULL;
+	double throughput_tolerance = -1, latency_tolerance = -1;
+	unsigned int ran = 0;
+	int absolute = 0;
+	int err = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+			print_help(argv[0]);
+			return 1;
+		} else if (strcmp(argv[i], "--baseline") == 0 || strcmp(argv[i], "--json") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "%s requires a file name\n", argv[i]);
+				return EINVAL;
+			}
+			if (argv[i][2] == 'b')
+				baseline_path = argv[++i];
+			else
+				json_path = argv[++i];
+		} else if (strcmp(argv[i], "--absolute") == 0) {
+			absolute = 1;
+		} else if (strcmp(argv[i], "--throughput-tolerance") == 0 ||
+			   strcmp(argv[i], "--latency-tolerance") == 0) {
+			char *end = NULL;
+			const double value = i + 1 < argc ? strtod(argv[i + 1], &end) : -1;
+
+			if (end == NULL || *end != '\0' || !(value >= 0.0)) {
+				fprintf(stderr, "%s requires a non-negative fraction\n", argv[i]);
+				return EINVAL;
+			}
+			if (argv[i][2] == 't')
+				throughput_tolerance = value;
+			else
+				latency_tolerance = value;
+			i++;
+		} else {
+			fprintf(stderr, "Unknown option: %s\n", argv[i]);
+			return EINVAL;
+		}
+	}
+
+	for (unsigned int rep = 0; rep < BENCH_REPEATS; rep++) {
+		fprintf(stderr, "repetition %u of %u...\n", rep + 1, BENCH_REPEATS);
+		for (size_t i = 0; i < BENCH_WORKLOAD_COUNT; i++) {
+			static struct bench_result r;
+
+			memset(&r, 0, sizeof(r));
+			if (bench_workloads[i].run(&r) != 0) {
+				fprintf(stderr, "%s: workload failed\n", bench_workloads[i].name);
+				return ANOMALY_RESULT_FAIL;
+			}
+			/* Noise on a shared host only ever slows a run down */
+			if (rep == 0 || bench_rate(&r) > bench_rate(&results[i]))
+				results[i] = r;
+		}
+	}
+	for (size_t i = 0; i < BENCH_WORKLOAD_COUNT; i++) {
+		if (results[i].skipped) {
+			fprintf(stderr, "%s: not available here, skipped\n", bench_workloads[i].name);
+			continue;
+		}
+		if (results[i].anomalies != 0)
+			fprintf(stderr, "%s: %" PRIu64 " of %" PRIu64 " trials anomalous, %" PRIu64 " traps, "
+				"not a benchmark failure\n", bench_workloads[i].name, results[i].anomalies,
+				results[i].trials, results[i].traps);
+		ran++;
+	}
+	if (ran == 0)
+		return BENCH_SKIPPED;
+
+	bench_host_init(&host);
+	bench_write_json(stdout, &host, results);
+	if (json_path != NULL) {
+		FILE *f = fopen(json_path, "w");
+
+		if (f == NULL) {
+			perror(json_path);
+			return ANOMALY_RESULT_FAIL;
+		}
+		bench_write_json(f, &host, results);
+		fclose(f);
+	}
+
+	if (baseline_path != NULL) {
+		char *json = bench_read_file(baseline_path);
+
+		if (json == NULL) {
+			perror(baseline_path);
+			return ANOMALY_RESULT_FAIL;
+		}
+		if (!bench_host_matches(json, &host, absolute)) {
+			fprintf(stderr, "%s was recorded on another machine, comparison skipped\n", baseline_path);
+			free(json);
+			return BENCH_SKIPPED;
+		}
+		err = bench_compare(json, results, absolute, throughput_tolerance, latency_tolerance) != 0;
+		free(json);
+	}
+	return err ? ANOMALY_RESULT_FAIL : ANOMALY_RESULT_PASS;
+}
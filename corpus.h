@@ -0,0 +1,221 @@
+/*
+ * Corpus of failing debug register configurations, kept for replay.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef ANOMALY_CORPUS_H
+#define ANOMALY_CORPUS_H 1
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#if !defined(_WIN32)
+#include <sys/utsname.h>
+#endif
+#include "drx.h"
+#include "dr6_model.h"
+#include "intercepts.h"
+
+/**
+ * On-disk layout: a corpus_header followed by fixed-size corpus_entry
+ * records up to the end of the file, so entries are added by appending.
+ * All fields are little-endian. Breakpoint addresses and the probe are
+ * offsets into a CORPUS_SPAN-byte buffer aligned to a cache line, which
+ * keeps every entry meaningful in any process that replays it.
+ */
+#define CORPUS_MAGIC            "KVMACORP"
+#define CORPUS_VERSION          1
+#define CORPUS_SPAN             64
+
+struct corpus_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+	char kernel[48];                /* uname release of the host that created it */
+};
+
+struct corpus_entry {
+	uint64_t dr7;
+	uint64_t expected;              /* Model DR6 when it was found, bits it covers only */
+	uint64_t observed;              /* DR6 then observed under the same mask, 0 for no #DB */
+	uint8_t addr[4];                /* DR0-DR3 as offsets into the buffer */
+	uint8_t probe;                  /* Offset of the 2-byte SS selector */
+	uint8_t intercept;              /* ANOMALY_INTERCEPT_* id */
+	uint16_t test;                  /* ANOMALY_TEST_* that found it */
+	int32_t cpu;                    /* CPU it failed on, -1 for any */
+	uint32_t reserved;
+};
+
+_Static_assert(sizeof(struct corpus_header) == 64, "corpus header must be 64 bytes");
+_Static_assert(sizeof(struct corpus_entry) == 40, "corpus entry must be 40 bytes");
+
+/* Whether two entries describe the same configuration, where found aside */
+static inline int corpus_entry_same(const struct corpus_entry *a, const struct corpus_entry *b)
+{
+	return a->dr7 == b->dr7 && memcmp(a->addr, b->addr, sizeof(a->addr)) == 0 &&
+	       a->probe == b->probe && a->intercept == b->intercept;
+}
+
+/* The configuration of an entry with its buffer at base */
+static inline void corpus_entry_config(const struct corpus_entry *e, uintptr_t base, struct dr_config *cfg)
+{
+	cfg->dr7 = e->dr7;
+	for (unsigned int n = 0; n < 4; n++)
+		cfg->addr[n] = base + e->addr[n];
+}
+
+/**
+ * Append entries to a corpus, creating it with a header first if it does not
+ * exist or is empty.
+ */
+static inline int corpus_append(const char *path, const struct corpus_entry *entries, size_t count)
+{
+	FILE *f = fopen(path, "ab");
+	int err = 0;
+
+	if (f == NULL)
+		return -1;
+	if (fseek(f, 0, SEEK_END) != 0 || ftell(f) == 0) {
+		struct corpus_header header = {
+			.version = CORPUS_VERSION, .entry_size = sizeof(struct corpus_entry)
+		};
+
+#if !defined(_WIN32)
+		struct utsname uts;
+
+		if (uname(&uts) == 0)
+			snprintf(header.kernel, sizeof(header.kernel), "%s", uts.release);
+#endif
+		memcpy(header.magic, CORPUS_MAGIC, sizeof(header.magic));
+		if (fwrite(&header, sizeof(header), 1, f) != 1)
+			err = -1;
+	}
+	if (err == 0 && count != 0 && fwrite(entries, sizeof(*entries), count, f) != count)
+		err = -1;
+	if (fclose(f) != 0)
+		err = -1;
+	return err;
+}
+
+/**
+ * Read a whole corpus into a malloc()ed array. Entries of a corpus whose
+ * intercept this build does not know are rejected along with the file.
+ */
+static inline int corpus_load(const char *path, struct corpus_header *header,
+			      struct corpus_entry **entries, size_t *count)
+{
+	FILE *f = fopen(path, "rb");
+	struct corpus_entry *e = NULL;
+	size_t n = 0, cap = 0;
+
+	if (f == NULL)
+		return -1;
+	if (fread(header, sizeof(*header), 1, f) != 1 ||
+	    memcmp(header->magic, CORPUS_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version == 0 || header->version > CORPUS_VERSION ||
+	    header->entry_size != sizeof(struct corpus_entry))
+		goto invalid;
+
+	for (;;) {
+		if (n == cap) {
+			struct corpus_entry *const grown = realloc(e, (cap = cap ? cap * 2 : 64) * sizeof(*e));
+
+			if (grown == NULL)
+				goto fail;
+			e = grown;
+		}
+		if (fread(&e[n], sizeof(*e), 1, f) != 1)
+			break;
+		if (e[n].intercept >= ANOMALY_INTERCEPT_COUNT || e[n].probe > CORPUS_SPAN - 2)
+			goto invalid;
+		for (unsigned int i = 0; i < 4; i++) {
+			if (e[n].addr[i] >= CORPUS_SPAN)
+				goto invalid;
+		}
+		n++;
+	}
+	if (ferror(f))
+		goto fail;
+	fclose(f);
+	*entries = e;
+	*count = n;
+	return 0;
+
+invalid:
+	errno = EINVAL;
+fail:
+	free(e);
+	fclose(f);
+	return -1;
+}
+
+/**
+ * Append the entries a corpus does not hold yet, so repeated runs do not
+ * grow it with copies. entries is compacted to those and count updated. A
+ * corpus that cannot be read, missing or not a corpus, is appended to as
+ * corpus_append() would.
+ */
+static inline int corpus_append_new(const char *path, struct corpus_entry *entries, size_t *count)
+{
+	struct corpus_header header;
+	struct corpus_entry *old = NULL;
+	size_t nold = 0, n = 0;
+
+	if (corpus_load(path, &header, &old, &nold) != 0)
+		nold = 0;
+	for (size_t i = 0; i < *count; i++) {
+		size_t j;
+
+		for (j = 0; j < nold && !corpus_entry_same(&old[j], &entries[i]); j++)
+			;
+		if (j == nold)
+			entries[n++] = entries[i];
+	}
+	free(old);
+	*count = n;
+	return n != 0 ? corpus_append(path, entries, n) : 0;
+}
+
+/* One line per entry, in the notation dr-fuzz prints mismatches in */
+static inline void corpus_entry_print(FILE *out, const struct corpus_entry *e)
+{
+	char exp_bits[DR6_BITS_STR_MAX], obs_bits[DR6_BITS_STR_MAX];
+
+	format_dr6_bits(e->expected, exp_bits, sizeof(exp_bits));
+	if (e->observed == 0)
+		snprintf(obs_bits, sizeof(obs_bits), "no #DB");
+	else
+		format_dr6_bits(e->observed, obs_bits, sizeof(obs_bits));
+	fprintf(out, "%-8s probe=+%-2u DR7=0x%08" PRIx64, anomaly_intercepts[e->intercept].name,
+		e->probe, e->dr7);
+	for (unsigned int n = 0; n < 4; n++) {
+		if (dr7_enabled(e->dr7, n))
+			fprintf(out, " DR%u=+%u/%c%u", n, e->addr[n], "xwir"[dr7_rw(e->dr7, n)],
+				dr7_len_bytes(e->dr7, n));
+	}
+	if (e->cpu >= 0)
+		fprintf(out, " cpu=%d", e->cpu);
+	fprintf(out, " (expected %s, observed %s)\n", exp_bits, obs_bits);
+}
+
+#endif /* ANOMALY_CORPUS_H */
@@ -0,0 +1,99 @@
+/*
+ * Rolling counters the canary daemon publishes in shared memory.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef ANOMALY_DAEMON_STATS_H
+#define ANOMALY_DAEMON_STATS_H 1
+#include <stdint.h>
+#include <string.h>
+#include "intercepts.h"
+
+/**
+ * Layout of the daemon's shared-memory file. A scraper maps it read-only and
+ * takes consistent snapshots with daemon_stats_read(), no syscalls needed
+ * after the mmap(). The writer bumps seq to an odd value before touching the
+ * counters and back to even afterwards. Counters only grow for the lifetime
+ * of the daemon; times are CLOCK_REALTIME nanoseconds.
+ */
+#define DAEMON_STATS_MAGIC      "KVMADSTA"
+#define DAEMON_STATS_VERSION    1
+#define DAEMON_STATS_INTERCEPTS 16
+
+struct daemon_stats {
+	char magic[8];
+	uint32_t version;
+	uint32_t size;                  /* sizeof(struct daemon_stats) */
+	uint64_t seq;                   /* Odd while an update is in progress */
+	uint32_t pid;
+	uint32_t intercepts;            /* ANOMALY_INTERCEPT_MASK() of intercepts rotated through */
+	uint64_t rate;                  /* Target trials per second */
+	uint64_t budget_ppm;            /* CPU budget in millionths of one CPU */
+	uint64_t start_ns;
+	uint64_t update_ns;             /* Heartbeat, refreshed every tick */
+	uint64_t trials;
+	uint64_t traps;
+	uint64_t anomalies;
+	uint64_t faults;                /* The intercepting instruction faulted and was skipped */
+	uint64_t throttled;             /* Trials skipped to stay within the CPU budget */
+	uint64_t cpu_ns;                /* CPU time used by the daemon, user and system */
+	uint64_t last_dr6;              /* DR6 of the most recent #DB */
+	uint64_t last_anomaly_ns;       /* 0 until the first anomaly */
+	uint64_t intercept_trials[DAEMON_STATS_INTERCEPTS];
+	uint64_t intercept_anomalies[DAEMON_STATS_INTERCEPTS];
+};
+
+_Static_assert(ANOMALY_INTERCEPT_COUNT <= DAEMON_STATS_INTERCEPTS, "too many intercepts for the stats layout");
+_Static_assert(sizeof(struct daemon_stats) % 64 == 0, "daemon stats must fill whole cache lines");
+
+static inline void daemon_stats_begin(struct daemon_stats *s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void daemon_stats_end(struct daemon_stats *s)
+{
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy a consistent snapshot of s into out, retrying while the daemon is in
+ * the middle of an update. Returns -1 if s is not a daemon stats block.
+ */
+static inline int daemon_stats_read(const struct daemon_stats *s, struct daemon_stats *out)
+{
+	uint64_t seq;
+
+	if (memcmp(s->magic, DAEMON_STATS_MAGIC, sizeof(s->magic)) != 0 ||
+	    s->version != DAEMON_STATS_VERSION)
+		return -1;
+
+	do {
+		while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1)
+			__builtin_ia32_pause();
+		memcpy(out, (const void *)s, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq);
+	return 0;
+}
+
+#endif /* ANOMALY_DAEMON_STATS_H */
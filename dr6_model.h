@@ -0,0 +1,117 @@
+/*
+ * Software model of the architectural DR6 value for data breakpoints.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef ANOMALY_DR6_MODEL_H
+#define ANOMALY_DR6_MODEL_H 1
+#include <stdint.h>
+#include "drx.h"
+
+/**
+ * Debug register configuration for one trial: DR0-DR3 and DR7.
+ */
+struct dr_config {
+	uint64_t addr[4];
+	uint64_t dr7;
+};
+
+#define DR7_EN_SHIFT(n)         ((n) * 2)
+#define DR7_RW_SHIFT(n)         (16 + (n) * 4)
+#define DR7_LEN_SHIFT(n)        (18 + (n) * 4)
+
+#define DR7_RW_EX               0u
+#define DR7_RW_DATA_W           1u
+#define DR7_RW_IO_RW            2u
+#define DR7_RW_DATA_RW          3u
+
+#define DR7_LEN_1_BYTE          0u
+#define DR7_LEN_2_BYTE          1u
+#define DR7_LEN_8_BYTE          2u
+#define DR7_LEN_4_BYTE          3u
+
+/** Local or global enable of breakpoint n. */
+static inline int dr7_enabled(uint64_t dr7, unsigned int n)
+{
+	return ((dr7 >> DR7_EN_SHIFT(n)) & 3) != 0;
+}
+
+static inline unsigned int dr7_rw(uint64_t dr7, unsigned int n)
+{
+	return (unsigned int)(dr7 >> DR7_RW_SHIFT(n)) & 3;
+}
+
+static inline unsigned int dr7_len_bytes(uint64_t dr7, unsigned int n)
+{
+	static const unsigned int bytes[4] = { 1, 2, 8, 4 };
+	return bytes[(dr7 >> DR7_LEN_SHIFT(n)) & 3];
+}
+
+/**
+ * Expected DR6 for a #DB raised after a data read of access_len bytes at
+ * access, optionally with a pending single-step. A breakpoint matches when it
+ * is enabled, conditioned on data reads or writes, and its length-aligned
+ * range overlaps the access. LE/GE do not change which conditions are
+ * reported on any processor since the P6 family.
+ */
+static inline uint64_t dr6_model_read(const struct dr_config *cfg, uint64_t access,
+				      unsigned int access_len, int single_step)
+{
+	uint64_t dr6 = DR6_INIT;
+
+	for (unsigned int n = 0; n < 4; n++) {
+		uint64_t base, len;
+
+		if (!dr7_enabled(cfg->dr7, n) || dr7_rw(cfg->dr7, n) != DR7_RW_DATA_RW)
+			continue;
+
+		len = dr7_len_bytes(cfg->dr7, n);
+		base = cfg->addr[n] & ~(len - 1);
+		if (access < base + len && base < access + access_len)
+			dr6 |= DR6_B0_BIT << n;
+	}
+
+	if (single_step)
+		dr6 |= DR6_BS_BIT;
+	return dr6;
+}
+
+/**
+ * DR6 bits the model makes a statement about. Bn of a disabled breakpoint
+ * may or may not be set by the processor and is excluded.
+ */
+static inline uint64_t dr6_model_mask(const struct dr_config *cfg)
+{
+	uint64_t mask = DR6_BD_BIT | DR6_BS_BIT | DR6_BT_BIT;
+
+	for (unsigned int n = 0; n < 4; n++) {
+		if (dr7_enabled(cfg->dr7, n))
+			mask |= DR6_B0_BIT << n;
+	}
+	return mask;
+}
+
+static inline int dr6_model_matches(const struct dr_config *cfg, uint64_t expected, uint64_t observed)
+{
+	return ((expected ^ observed) & dr6_model_mask(cfg)) == 0;
+}
+
+#endif /* ANOMALY_DR6_MODEL_H */
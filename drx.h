@@ -199,4 +199,29 @@ static inline void print_dr6(uint64_t dr6)
 	printf("  BT (task switch): %i\n", (dr6 & DR6_BT_BIT) != 0);
 }
 
+/**
+ * Compact single-line form of print_dr6(), listing only the status bits which are set
+ * (e.g. "B0 BS"). Used wherever many DR6 values are reported at once.
+ */
+#define DR6_BITS_STR_MAX        32
+
+static inline const char *format_dr6_bits(uint64_t dr6, char *buf, size_t size)
+{
+	static const struct { uint64_t bit; const char *name; } dr6_bits[] = {
+		{ DR6_B0_BIT, "B0" }, { DR6_B1_BIT, "B1" }, { DR6_B2_BIT, "B2" }, { DR6_B3_BIT, "B3" },
+		{ DR6_BD_BIT, "BD" }, { DR6_BS_BIT, "BS" }, { DR6_BT_BIT, "BT" },
+	};
+	size_t len = 0;
+
+	buf[0] = '\0';
+	for (size_t i = 0; i < sizeof(dr6_bits) / sizeof(dr6_bits[0]); i++) {
+		if ((dr6 & dr6_bits[i].bit) == 0 || len + 4 > size)
+			continue;
+		len += (size_t)snprintf(buf + len, size - len, "%s%s", len ? " " : "", dr6_bits[i].name);
+	}
+	if (len == 0)
+		snprintf(buf, size, "-");
+	return buf;
+}
+
 #endif /* _ARCH_X86_DRX_ */
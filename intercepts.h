@@ -0,0 +1,172 @@
+/*
+ * Table of user-mode instructions which can force a VM exit while a
+ * MOV SS shadow holds a pending debug exception.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef ANOMALY_INTERCEPTS_H
+#define ANOMALY_INTERCEPTS_H 1
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * X(id, name, instruction, fault length, description)
+ *
+ * The fault length is non-zero for instructions which raise #UD/#GP at CPL3;
+ * the harness skips over them when the fault is delivered so the pending
+ * single-step still completes the trial.
+ */
+#define ANOMALY_INTERCEPTS(X) \
+	X(CPUID,   cpuid,   "cpuid",   0, "CPUID, unconditionally exits") \
+	X(RDTSC,   rdtsc,   "rdtsc",   0, "RDTSC, exits with RDTSC exiting enabled") \
+	X(RDTSCP,  rdtscp,  "rdtscp",  0, "RDTSCP, exits with RDTSC exiting enabled") \
+	X(RDPMC,   rdpmc,   "rdpmc",   2, "RDPMC, exits with RDPMC exiting, #GP without CR4.PCE") \
+	X(PAUSE,   pause,   "pause",   0, "PAUSE, exits under pause-loop exiting") \
+	X(UD2,     ud2,     "ud2",     2, "UD2, exits when #UD is intercepted") \
+	X(VMCALL,  vmcall,  "vmcall",  3, "VMCALL, exits unconditionally, #UD outside VMX") \
+	X(VMMCALL, vmmcall, "vmmcall", 3, "VMMCALL, exits unconditionally, #UD outside SVM")
+
+enum anomaly_intercept_id {
+#define X(id, name, insn, fault_len, desc) ANOMALY_INTERCEPT_##id,
+	ANOMALY_INTERCEPTS(X)
+#undef X
+	ANOMALY_INTERCEPT_COUNT
+};
+
+#define ANOMALY_INTERCEPT_MASK(id)      (1u << (id))
+#define ANOMALY_INTERCEPT_ALL           ((1u << ANOMALY_INTERCEPT_COUNT) - 1)
+
+/*
+ * Generate one trial kernel per intercepting instruction.
+ * - DR7 should be programmed to watch the probe
+ * - Enable single-stepping
+ * - MOV SS from probe page, to cause delayed B0+BS conditions
+ * - Execute the intercepting instruction
+ *
+ * EAX/ECX are zeroed so CPUID leaf 0 and RDPMC counter 0 are used.
+ */
+#define X(id, name, insn, fault_len, desc) \
+static void intercept_trial_##name(uint16_t *probe) \
+{ \
+	uint32_t eax = 0, ecx = 0; \
+	__asm__ __volatile__( \
+		"pushq %%rbx\n" \
+		"pushfq\n" \
+		"orl $0x100, (%%rsp)\n" /* set TF in saved RFLAGS on stack */ \
+		"popfq\n" \
+		"movw (%2), %%ss\n"     /* block exceptions on mov ss */ \
+		insn "\n"               /* trigger vm intercept */ \
+		"popq %%rbx\n"          /* only single #DB should fire here with DR6 B0+BS set */ \
+		: "+a"(eax), "+c"(ecx) : "r"(probe) : "rdx", "memory" \
+	); \
+}
+ANOMALY_INTERCEPTS(X)
+#undef X
+
+/*
+ * Same sequence without TF and meant to run without a watchpoint armed, the
+ * cost of the bare MOV SS + intercept to compare trial latencies against.
+ */
+#define X(id, name, insn, fault_len, desc) \
+static void intercept_baseline_##name(uint16_t *probe) \
+{ \
+	uint32_t eax = 0, ecx = 0; \
+	__asm__ __volatile__( \
+		"pushq %%rbx\n" \
+		"movw (%2), %%ss\n" \
+		insn "\n" \
+		"popq %%rbx\n" \
+		: "+a"(eax), "+c"(ecx) : "r"(probe) : "rdx", "memory" \
+	); \
+}
+ANOMALY_INTERCEPTS(X)
+#undef X
+
+struct anomaly_intercept {
+	const char *name;
+	const char *description;
+	unsigned int fault_len;
+	void (*trial)(uint16_t *probe);
+	void (*baseline)(uint16_t *probe);
+};
+
+static const struct anomaly_intercept anomaly_intercepts[ANOMALY_INTERCEPT_COUNT] = {
+#define X(id, name, insn, fault_len, desc) \
+	[ANOMALY_INTERCEPT_##id] = { #name, desc, fault_len, intercept_trial_##name, \
+				       intercept_baseline_##name },
+	ANOMALY_INTERCEPTS(X)
+#undef X
+};
+
+/**
+ * Parse a comma separated list of names out of names[count] (or "all", for
+ * all_mask) into a mask with bit n set for names[n].
+ */
+static inline int anomaly_parse_name_list(const char *list, const char *const *names, unsigned int count,
+					  uint32_t all_mask, uint32_t *result_mask)
+{
+	uint32_t mask = 0;
+	const char *p = list;
+
+	if (strcmp(list, "all") == 0) {
+		*result_mask = all_mask;
+		return 0;
+	}
+
+	while (*p != '\0') {
+		const size_t len = strcspn(p, ",");
+		unsigned int id;
+
+		for (id = 0; id < count; id++) {
+			if (strlen(names[id]) == len && strncmp(names[id], p, len) == 0)
+				break;
+		}
+		if (id == count)
+			return -1;
+
+		mask |= 1u << id;
+		p += len;
+		if (*p == ',')
+			p++;
+	}
+
+	if (mask == 0)
+		return -1;
+	*result_mask = mask;
+	return 0;
+}
+
+static const char *const anomaly_intercept_names[ANOMALY_INTERCEPT_COUNT] = {
+#define X(id, name, insn, fault_len, desc) [ANOMALY_INTERCEPT_##id] = #name,
+	ANOMALY_INTERCEPTS(X)
+#undef X
+};
+
+/**
+ * Parse a comma separated list of intercept names (or "all") into a mask.
+ */
+static inline int anomaly_parse_intercepts(const char *list, uint32_t *result_mask)
+{
+	return anomaly_parse_name_list(list, anomaly_intercept_names, ANOMALY_INTERCEPT_COUNT,
+				       ANOMALY_INTERCEPT_ALL, result_mask);
+}
+
+#endif /* ANOMALY_INTERCEPTS_H */
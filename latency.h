@@ -0,0 +1,130 @@
+/*
+ * Log-bucketed latency histograms.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef ANOMALY_LATENCY_H
+#define ANOMALY_LATENCY_H 1
+#include <stdint.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+/**
+ * HDR-style histogram: every power of two is split into 2^LATENCY_SUB_BITS
+ * linear sub-buckets, giving a constant ~6% relative precision over the full
+ * 64-bit range with a fixed 1024-entry table and a branch-light insert.
+ */
+#define LATENCY_SUB_BITS        4
+#define LATENCY_SUB_COUNT       (1u << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS         (64u * LATENCY_SUB_COUNT)
+
+struct latency_hist {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t bucket[LATENCY_BUCKETS];
+};
+
+static inline unsigned int latency_bucket(uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < LATENCY_SUB_COUNT)
+		return (unsigned int)value;
+	shift = (63u - (unsigned int)__builtin_clzll(value)) - LATENCY_SUB_BITS;
+	return ((shift + 1) << LATENCY_SUB_BITS) | (unsigned int)((value >> shift) & (LATENCY_SUB_COUNT - 1));
+}
+
+/* Highest value which maps to the given bucket. */
+static inline uint64_t latency_bucket_high(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < LATENCY_SUB_COUNT)
+		return bucket;
+	shift = (bucket >> LATENCY_SUB_BITS) - 1;
+	return (((uint64_t)(LATENCY_SUB_COUNT | (bucket & (LATENCY_SUB_COUNT - 1))) + 1) << shift) - 1;
+}
+
+static inline void latency_add(struct latency_hist *hist, uint64_t value)
+{
+	if (hist->count == 0 || value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+	hist->count++;
+	hist->bucket[latency_bucket(value)]++;
+}
+
+static inline void latency_merge(struct latency_hist *dst, const struct latency_hist *src)
+{
+	if (src->count == 0)
+		return;
+	if (dst->count == 0 || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	for (unsigned int i = 0; i < LATENCY_BUCKETS; i++)
+		dst->bucket[i] += src->bucket[i];
+}
+
+/**
+ * Value at the given percentile (0-100), reported as the upper bound of the
+ * bucket it falls in and clamped to the recorded maximum.
+ */
+static inline uint64_t latency_percentile(const struct latency_hist *hist, double percentile)
+{
+	uint64_t rank, seen = 0;
+
+	if (hist->count == 0)
+		return 0;
+
+	rank = (uint64_t)(percentile / 100.0 * (double)hist->count + 0.5);
+	if (rank == 0)
+		rank = 1;
+
+	for (unsigned int i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += hist->bucket[i];
+		if (seen >= rank) {
+			const uint64_t high = latency_bucket_high(i);
+			return high < hist->max ? high : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+static inline void latency_print_header(void)
+{
+	printf("  %-22s %10s %10s %10s %10s %10s %12s\n", "latency (TSC cycles)",
+	       "p50", "p90", "p99", "p99.9", "max", "samples");
+}
+
+static inline void latency_print(const char *name, const struct latency_hist *hist)
+{
+	if (hist->count == 0)
+		return;
+	printf("  %-22s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %12" PRIu64 "\n",
+	       name, latency_percentile(hist, 50.0), latency_percentile(hist, 90.0),
+	       latency_percentile(hist, 99.0), latency_percentile(hist, 99.9), hist->max, hist->count);
+}
+
+#endif /* ANOMALY_LATENCY_H */
@@ -28,38 +28,571 @@
 #include <unistd.h>
 #endif
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
 #include <errno.h>
 #include "drx.h"
+#include "anomaly.h"
+#include "tsc.h"
+#include "latency.h"
+#include "trial_log.h"
+#include "corpus.h"
+#include "dr6_model.h"
+#include "simd_state.h"
+#include "daemon_stats.h"
 
 /* Include platform-specific anomaly implementations */
 #include "pending_dbg_causes.inl"
+#include "runner.inl"
+#if !defined(_WIN32)
+#include "dr_fuzz.inl"
+#include "single_step.inl"
+#include "daemon.inl"
+#else
+#define anomaly_dr_fuzz NULL
+#define anomaly_single_step NULL
+
+static int anomaly_dr_replay(const struct anomaly_options *opts, const char *path)
+{
+	(void)opts;
+	fprintf(stderr, "%s: replay is not supported on this platform\n", path);
+	return EINVAL;
+}
+
+static int anomaly_daemon(const struct anomaly_options *opts)
+{
+	(void)opts;
+	fprintf(stderr, "--daemon: not supported on this platform\n");
+	return EINVAL;
+}
+#endif
+
+/*
+ * Registry of every anomaly reproducer. Tests are selected by name or glob
+ * pattern on the command line, or all at once with run-all.
+ */
+static const struct anomaly_test anomaly_tests[] = {
+	{
+		.name = "pending-dbg-causes",
+		.description = "Test if pending debug exceptions cause anomalies",
+		.platforms = ANOMALY_PLATFORM_ALL,
+		.run = anomaly_pending_dbg_causes,
+	},
+	{
+		.name = "dr-fuzz",
+		.description = "Random DR0-DR3/DR7 configurations checked against a DR6 model",
+		.platforms = ANOMALY_PLATFORM_LINUX,
+		.run = anomaly_dr_fuzz,
+	},
+	{
+		.name = "single-step",
+		.description = "Single-step #DB delivery rate and lost/duplicate steps across intercepts",
+		.platforms = ANOMALY_PLATFORM_LINUX,
+		.run = anomaly_single_step,
+	},
+};
+
+#define ANOMALY_TEST_COUNT (sizeof(anomaly_tests) / sizeof(anomaly_tests[0]))
 
 void print_help(const char *progname)
 {
-	printf("Usage: %s [test...]\n", progname);
+	printf("Usage: %s [options] [test|pattern...]\n", progname);
+	printf("       %s [options] run-all [pattern...]\n", progname);
+	printf("       %s --list [pattern...]\n", progname);
+	printf("       %s --dump FILE [--csv]\n", progname);
+	printf("       %s --replay FILE [--minimize] [--corpus FILE] [--iterations N]\n", progname);
 	printf("Available tests:\n");
-	printf("  pending-dbg-causes    Test if pending debug exceptions cause anomalies\n");
+	for (size_t t = 0; t < ANOMALY_TEST_COUNT; t++)
+		printf("  %-21s %s\n", anomaly_tests[t].name, anomaly_tests[t].description);
+	printf("Commands:\n");
+	printf("  run-all               Run the selected tests (default all) concurrently in child processes\n");
+	printf("Exit status: 0 if every test passed, 2 if an anomaly was detected, 1 on failure.\n");
+	printf("Options:\n");
+	printf("  --list                List the registered tests matching the patterns\n");
+	printf("  --jobs N              Number of tests run-all executes at once (default: online CPUs)\n");
+	printf("  --iterations N        Run N trials in a single tracee and report DR6 outcomes\n");
+	printf("                        (dr-fuzz: N random configurations, default 10000;\n");
+	printf("                        single-step: N passes over the stream, default 20)\n");
+	printf("  --backend NAME        Trial backend: ptrace (default) or perf (Linux only)\n");
+	printf("  --all-cpus            Run one pinned worker per online CPU (Linux only)\n");
+	printf("  --threads N           Run N trial threads in one traced process, each with its own\n");
+	printf("                        DR0/DR7, serviced by a single tracer (ptrace, Linux only)\n");
+	printf("  --tracees N           Run N traced processes at once (per CPU with --all-cpus), all\n");
+	printf("                        driven by one event-loop tracer (ptrace, Linux only)\n");
+	printf("  --zygote N            Keep N pre-forked, traced and stopped tracees ready so runs\n");
+	printf("                        skip process setup (ptrace, Linux only)\n");
+	printf("  --timeout MS          Kill a tracee making no progress for MS milliseconds and record\n");
+	printf("                        the trial as a hang (default %d)\n", ANOMALY_DEFAULT_TIMEOUT_MS);
+	printf("  --intercept=LIST      Intercepting instructions to sweep, comma separated or \"all\"\n");
+	for (unsigned int id = 0; id < ANOMALY_INTERCEPT_COUNT; id++)
+		printf("      %-8s          %s\n", anomaly_intercepts[id].name, anomaly_intercepts[id].description);
+	printf("  --adaptive            Stop once a sequential probability ratio test decides clean or\n");
+	printf("                        affected; --iterations caps the trials (default %d)\n", SPRT_DEFAULT_MAX_TRIALS);
+	printf("  --sprt=P0,P1[,A[,B]]  Clean/affected anomaly rates and error rates for --adaptive\n");
+	printf("                        (default 0.001,0.01,0.01,0.01, implies --adaptive)\n");
+	printf("  --latency             Report latency percentiles and a no-TF baseline (Linux only)\n");
+	printf("  --profile             Count task-clock, context switches, page faults, cycles and\n");
+	printf("                        instructions of each harness phase (Linux only)\n");
+	printf("  --simd                Fill the widest vector registers (xmm, ymm or zmm) with patterns\n");
+	printf("                        before each trial and report corrupted registers and lanes\n");
+	printf("                        after its #DB (pending-dbg-causes, Linux only)\n");
+	printf("  --noise=LIST          Run each comma separated noise profile as a pass with background\n");
+	printf("                        load on every CPU and compare anomaly rates; a profile is \"none\",\n");
+	printf("                        \"all\" or generators joined with '+' (pending-dbg-causes, Linux only)\n");
+	for (unsigned int id = 0; id < ANOMALY_NOISE_COUNT; id++)
+		printf("      %-8s          %s\n", anomaly_noise_names[id], anomaly_noise_descriptions[id]);
+	printf("  --placement=LIST      Run a pass per probe placement, comma separated or \"all\", and\n");
+	printf("                        compare DR6 outcomes and trial windows (pending-dbg-causes, Linux only)\n");
+	for (unsigned int id = 0; id < ANOMALY_PLACEMENT_COUNT; id++)
+		printf("      %-10s        %s\n", anomaly_placement_names[id], anomaly_placement_descriptions[id]);
+	printf("  --seed N              Seed for randomized tests such as dr-fuzz (default: from TSC)\n");
+	printf("  --log FILE            Write every trial as a binary record to FILE (Linux only)\n");
+	printf("  --dump FILE           Render a binary trial log as text, or CSV with --csv\n");
+	printf("  --snapshot DIR        Write registers, XSAVE state, DR0-DR7, memory map and host identity\n");
+	printf("                        of trials whose DR6 misses B0 or BS to DIR, at most %d per\n", ANOMALY_SNAPSHOT_MAX);
+	printf("                        intercept (ptrace, Linux only)\n");
+	printf("  --corpus FILE         Add the configuration of every distinct failure to the corpus FILE\n");
+	printf("                        (dr-fuzz, pending-dbg-causes and --minimize, Linux only)\n");
+	printf("  --replay FILE         Re-run every configuration of a corpus N times (--iterations,\n");
+	printf("                        default %d) across all CPUs; exits 2 if any reproduce (Linux only)\n",
+	       ANOMALY_DEFAULT_REPLAY_REPEAT);
+	printf("  --minimize            Replay: shrink every reproducing configuration to the smallest\n");
+	printf("                        one still failing and add those to --corpus\n");
+	printf("  --trace FILE          Write a Chrome trace (Perfetto, chrome://tracing) of forks, ptrace\n");
+	printf("                        requests, waits, trial windows and #DB handling to FILE\n");
+	printf("                        (pending-dbg-causes, Linux only)\n");
+	printf("  --daemon              Run pending-dbg-causes continuously in-process under SCHED_IDLE\n");
+	printf("                        until SIGINT/SIGTERM, rotating through --intercept (Linux only)\n");
+	printf("  --rate N              Daemon: trials per second (default %d)\n", ANOMALY_DEFAULT_DAEMON_RATE);
+	printf("  --cpu-budget PCT      Daemon: most of one CPU to use, token-bucket enforced (default %.2f)\n",
+	       ANOMALY_DEFAULT_CPU_BUDGET_PPM / 1e4);
+	printf("  --shm FILE            Daemon: shared-memory counters (default %s)\n", ANOMALY_DEFAULT_SHM_PATH);
+	printf("  --socket PATH         Daemon: Unix socket answering status queries (default %s)\n",
+	       ANOMALY_DEFAULT_SOCKET_PATH);
+}
+
+static int dump_trial_log(const char *path, int csv)
+{
+#if defined(_WIN32)
+	(void)csv;
+	fprintf(stderr, "%s: trial logs are not supported on this platform\n", path);
+	return EINVAL;
+#else
+	struct corpus_header header;
+	struct corpus_entry *entries;
+	struct trial_log log;
+	size_t count;
+
+	/* --dump renders corpora too */
+	if (corpus_load(path, &header, &entries, &count) == 0) {
+		printf("# %zu configurations (version %u, created on %.48s)\n", count, header.version,
+		       header.kernel);
+		for (size_t i = 0; i < count; i++)
+			corpus_entry_print(stdout, &entries[i]);
+		free(entries);
+		return 0;
+	}
+	if (trial_log_open(&log, path) != 0) {
+		perror(path);
+		return 1;
+	}
+	trial_log_dump(&log, stdout, csv);
+	trial_log_close(&log);
+	return 0;
+#endif
+}
+
+/*
+ * Shell-style pattern match supporting '*' and '?'.
+ */
+static int glob_match(const char *pattern, const char *str)
+{
+	for (; *pattern != '\0'; pattern++, str++) {
+		if (*pattern == '*') {
+			for (;; str++) {
+				if (glob_match(pattern + 1, str))
+					return 1;
+				if (*str == '\0')
+					return 0;
+			}
+		}
+		if (*str == '\0' || (*pattern != '?' && *pattern != *str))
+			return 0;
+	}
+	return *str == '\0';
+}
+
+static const char *platform_names(unsigned int platforms)
+{
+	switch (platforms & ANOMALY_PLATFORM_ALL) {
+	case ANOMALY_PLATFORM_ALL:      return "linux,windows";
+	case ANOMALY_PLATFORM_LINUX:    return "linux";
+	case ANOMALY_PLATFORM_WINDOWS:  return "windows";
+	default:                        return "-";
+	}
+}
+
+/*
+ * Collect the registered tests matching any of the patterns (all of them when
+ * there are none). Returns the number selected, or -1 if a pattern matched
+ * nothing.
+ */
+static int select_tests(char **patterns, size_t npatterns, const struct anomaly_test **selected)
+{
+	size_t count = 0;
+
+	for (size_t p = 0; p < npatterns; p++) {
+		int matched = 0;
+
+		for (size_t t = 0; t < ANOMALY_TEST_COUNT; t++) {
+			if (glob_match(patterns[p], anomaly_tests[t].name))
+				matched = 1;
+		}
+		if (!matched) {
+			fprintf(stderr, "Unknown test: %s\n", patterns[p]);
+			return -1;
+		}
+	}
+
+	for (size_t t = 0; t < ANOMALY_TEST_COUNT; t++) {
+		int matched = npatterns == 0;
+
+		for (size_t p = 0; p < npatterns && !matched; p++)
+			matched = glob_match(patterns[p], anomaly_tests[t].name);
+		if (matched)
+			selected[count++] = &anomaly_tests[t];
+	}
+	return (int)count;
+}
+
+static void print_summary(const struct anomaly_test *const *tests, size_t count,
+			  const struct anomaly_test_result *results)
+{
+	printf("\n%-24s %-8s %8s %10s\n", "TEST", "RESULT", "STATUS", "TIME");
+	for (size_t i = 0; i < count; i++) {
+		printf("%-24s %-8s %8d %9.3fs\n", tests[i]->name,
+		       anomaly_result_name(results[i].result), results[i].status,
+		       (double)results[i].elapsed_ns / 1e9);
+	}
+}
+
+/* Any failure wins over a detected anomaly, which wins over a pass. */
+static int summary_exit_code(const struct anomaly_test_result *results, size_t count)
+{
+	int rc = ANOMALY_RESULT_PASS;
+
+	for (size_t i = 0; i < count; i++) {
+		if (results[i].result == ANOMALY_RESULT_FAIL)
+			return ANOMALY_RESULT_FAIL;
+		if (results[i].result == ANOMALY_RESULT_DETECTED)
+			rc = ANOMALY_RESULT_DETECTED;
+	}
+	return rc;
+}
+
+static int parse_u64(const char *str, uint64_t *result)
+{
+	char *end;
+
+	errno = 0;
+	*result = strtoull(str, &end, 0);
+	if (errno != 0 || end == str || *end != '\0')
+		return -1;
+	return 0;
 }
 
 int main(int argc, char *argv[])
 {
-	for (int i = 1; i < argc; i++) {
+	struct anomaly_options opts = ANOMALY_OPTIONS_INIT;
+	const struct anomaly_test *selected[ANOMALY_TEST_COUNT];
+	struct anomaly_test_result results[ANOMALY_TEST_COUNT];
+	char *patterns[ANOMALY_TEST_COUNT + 64];
+	size_t npatterns = 0;
+	const char *dump_path = NULL;
+	const char *replay_path = NULL;
+	unsigned int jobs = anomaly_default_jobs();
+	uint64_t value;
+	int run_all = 0, list = 0;
+	int csv = 0;
+	int count;
+	int i;
+
+	/* Options may appear anywhere on the command line, parse them first */
+	for (i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "help") == 0 || strcmp(argv[i], "-help") == 0 ||
 		    strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
 			print_help(argv[0]);
 			return 1;
 		}
 
-		if (strcmp(argv[i], "pending-dbg-causes") == 0) {
-			return anomaly_pending_dbg_causes();
-		} else {
-			fprintf(stderr, "Unknown test: %s\n", argv[i]);
+		if (strcmp(argv[i], "--iterations") == 0) {
+			if (i + 1 >= argc || parse_u64(argv[i + 1], &opts.iterations) != 0 ||
+			    opts.iterations == 0) {
+				fprintf(stderr, "--iterations requires a positive count\n");
+				return EINVAL;
+			}
+			opts.iterations_set = 1;
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--backend") == 0) {
+			if (i + 1 < argc && strcmp(argv[i + 1], "ptrace") == 0) {
+				opts.backend = ANOMALY_BACKEND_PTRACE;
+			} else if (i + 1 < argc && strcmp(argv[i + 1], "perf") == 0) {
+				opts.backend = ANOMALY_BACKEND_PERF;
+			} else {
+				fprintf(stderr, "--backend must be one of: ptrace, perf\n");
+				return EINVAL;
+			}
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--threads") == 0) {
+			if (i + 1 >= argc || parse_u64(argv[i + 1], &value) != 0 ||
+			    value == 0 || value > 1024) {
+				fprintf(stderr, "--threads requires a count between 1 and 1024\n");
+				return EINVAL;
+			}
+			opts.threads = (unsigned int)value;
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--tracees") == 0) {
+			if (i + 1 >= argc || parse_u64(argv[i + 1], &value) != 0 ||
+			    value == 0 || value > 4096) {
+				fprintf(stderr, "--tracees requires a count between 1 and 4096\n");
+				return EINVAL;
+			}
+			opts.tracees = (unsigned int)value;
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--zygote") == 0) {
+			if (i + 1 >= argc || parse_u64(argv[i + 1], &value) != 0 ||
+			    value == 0 || value > 4096) {
+				fprintf(stderr, "--zygote requires a pool size between 1 and 4096\n");
+				return EINVAL;
+			}
+			opts.zygote = (unsigned int)value;
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--timeout") == 0) {
+			if (i + 1 >= argc || parse_u64(argv[i + 1], &value) != 0 ||
+			    value == 0 || value > 3600000) {
+				fprintf(stderr, "--timeout requires milliseconds between 1 and 3600000\n");
+				return EINVAL;
+			}
+			opts.timeout_ms = (unsigned int)value;
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--all-cpus") == 0) {
+			opts.all_cpus = 1;
+			argv[i] = NULL;
+		} else if (strncmp(argv[i], "--intercept=", 12) == 0) {
+			if (anomaly_parse_intercepts(argv[i] + 12, &opts.intercepts) != 0) {
+				fprintf(stderr, "invalid --intercept list: %s\n", argv[i] + 12);
+				return EINVAL;
+			}
+			argv[i] = NULL;
+		} else if (strcmp(argv[i], "--log") == 0 || strcmp(argv[i], "--dump") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "%s requires a file name\n", argv[i]);
+				return EINVAL;
+			}
+			if (argv[i][2] == 'l')
+				opts.log_path = argv[i + 1];
+			else
+				dump_path = argv[i + 1];
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--corpus") == 0 || strcmp(argv[i], "--replay") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "%s requires a file name\n", argv[i]);
+				return EINVAL;
+			}
+			if (argv[i][2] == 'c')
+				opts.corpus_path = argv[i + 1];
+			else
+				replay_path = argv[i + 1];
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--minimize") == 0) {
+			opts.minimize = 1;
+			argv[i] = NULL;
+		} else if (strcmp(argv[i], "--snapshot") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "--snapshot requires a directory\n");
+				return EINVAL;
+			}
+			opts.snapshot_dir = argv[i + 1];
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--trace") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "--trace requires a file name\n");
+				return EINVAL;
+			}
+			opts.trace_path = argv[i + 1];
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--seed") == 0) {
+			if (i + 1 >= argc || parse_u64(argv[i + 1], &opts.seed) != 0 || opts.seed == 0) {
+				fprintf(stderr, "--seed requires a non-zero value\n");
+				return EINVAL;
+			}
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--adaptive") == 0) {
+			opts.adaptive = 1;
+			argv[i] = NULL;
+		} else if (strncmp(argv[i], "--sprt=", 7) == 0) {
+			if (sprt_parse_params(argv[i] + 7, &opts.sprt) != 0) {
+				fprintf(stderr, "--sprt requires 0 < P0 < P1 < 1 and error rates below 0.5\n");
+				return EINVAL;
+			}
+			opts.adaptive = 1;
+			argv[i] = NULL;
+		} else if (strcmp(argv[i], "--latency") == 0) {
+			opts.latency = 1;
+			argv[i] = NULL;
+		} else if (strncmp(argv[i], "--noise=", 8) == 0) {
+			const int n = anomaly_parse_noise(argv[i] + 8, opts.noise, ANOMALY_NOISE_PROFILES_MAX);
+
+			if (n < 0) {
+				fprintf(stderr, "--noise requires up to %d comma separated profiles, each \"none\", "
+					"\"all\" or generators joined with '+'\n", ANOMALY_NOISE_PROFILES_MAX);
+				return EINVAL;
+			}
+			opts.noise_profiles = (unsigned int)n;
+			argv[i] = NULL;
+		} else if (strncmp(argv[i], "--placement=", 12) == 0) {
+			if (anomaly_parse_placements(argv[i] + 12, &opts.placements) != 0) {
+				fprintf(stderr, "invalid --placement list: %s\n", argv[i] + 12);
+				return EINVAL;
+			}
+			argv[i] = NULL;
+		} else if (strcmp(argv[i], "--simd") == 0) {
+			opts.simd = 1;
+			argv[i] = NULL;
+		} else if (strcmp(argv[i], "--profile") == 0) {
+			opts.profile = 1;
+			argv[i] = NULL;
+		} else if (strcmp(argv[i], "--daemon") == 0) {
+			opts.daemon = 1;
+			argv[i] = NULL;
+		} else if (strcmp(argv[i], "--rate") == 0) {
+			if (i + 1 >= argc || parse_u64(argv[i + 1], &value) != 0 ||
+			    value == 0 || value > 1000000) {
+				fprintf(stderr, "--rate requires trials per second between 1 and 1000000\n");
+				return EINVAL;
+			}
+			opts.rate = (unsigned int)value;
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--cpu-budget") == 0) {
+			char *end = NULL;
+			double pct = i + 1 < argc ? strtod(argv[i + 1], &end) : 0.0;
+
+			if (end == NULL || end == argv[i + 1] || *end != '\0' || !(pct > 0.0 && pct <= 100.0)) {
+				fprintf(stderr, "--cpu-budget requires a percentage of one CPU in (0, 100]\n");
+				return EINVAL;
+			}
+			opts.cpu_budget_ppm = (uint32_t)(pct * 1e4 + 0.5);
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--shm") == 0 || strcmp(argv[i], "--socket") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "%s requires a path\n", argv[i]);
+				return EINVAL;
+			}
+			if (argv[i][3] == 'h')
+				opts.shm_path = argv[i + 1];
+			else
+				opts.socket_path = argv[i + 1];
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "--csv") == 0) {
+			csv = 1;
+			argv[i] = NULL;
+		} else if (strcmp(argv[i], "--list") == 0) {
+			list = 1;
+			argv[i] = NULL;
+		} else if (strcmp(argv[i], "--jobs") == 0) {
+			if (i + 1 >= argc || parse_u64(argv[i + 1], &value) != 0 ||
+			    value == 0 || value > 4096) {
+				fprintf(stderr, "--jobs requires a count between 1 and 4096\n");
+				return EINVAL;
+			}
+			jobs = (unsigned int)value;
+			argv[i] = argv[i + 1] = NULL;
+			i++;
+		} else if (strcmp(argv[i], "run-all") == 0) {
+			run_all = 1;
+			argv[i] = NULL;
+		}
+	}
+
+	if (dump_path != NULL)
+		return dump_trial_log(dump_path, csv);
+	if (replay_path != NULL)
+		return anomaly_dr_replay(&opts, replay_path);
+	if (opts.minimize) {
+		fprintf(stderr, "--minimize requires --replay\n");
+		return EINVAL;
+	}
+
+	/* Whatever is left names tests or glob patterns over them */
+	for (i = 1; i < argc; i++) {
+		if (argv[i] == NULL)
+			continue;
+		if (argv[i][0] == '-' || npatterns == sizeof(patterns) / sizeof(patterns[0])) {
+			fprintf(stderr, "Unknown option: %s\n", argv[i]);
 			return EINVAL;
 		}
+		patterns[npatterns++] = argv[i];
 	}
 
-	return 0;
-}
\ No newline at end of file
+	/* The daemon always runs pending-dbg-causes */
+	if (opts.daemon)
+		return anomaly_daemon(&opts);
+
+	if (npatterns == 0 && !run_all && !list)
+		return 0;
+
+	count = select_tests(patterns, npatterns, selected);
+	if (count < 0)
+		return EINVAL;
+
+	if (list) {
+		for (i = 0; i < count; i++)
+			printf("%-24s %-14s %s\n", selected[i]->name,
+			       platform_names(selected[i]->platforms), selected[i]->description);
+		return 0;
+	}
+
+	/* Drop tests which cannot run on this platform */
+	for (i = 0; i < count; i++) {
+		if ((selected[i]->platforms & ANOMALY_PLATFORM_CURRENT) != 0)
+			continue;
+		if (!run_all) {
+			fprintf(stderr, "%s: not supported on this platform\n", selected[i]->name);
+			return EINVAL;
+		}
+		memmove(&selected[i], &selected[i + 1], (count - i - 1) * sizeof(selected[0]));
+		count--;
+		i--;
+	}
+
+	if (run_all) {
+		memset(results, 0, sizeof(results));
+		if (anomaly_run_isolated(selected, (size_t)count, jobs, &opts, results) != 0)
+			return ANOMALY_RESULT_FAIL;
+		print_summary(selected, (size_t)count, results);
+		return summary_exit_code(results, (size_t)count);
+	}
+
+	/* Tests named directly run one after another in this process */
+	for (i = 0; i < count; i++) {
+		results[i].status = selected[i]->run(&opts);
+		results[i].result = anomaly_classify(results[i].status);
+	}
+	return count == 1 ? results[0].status : summary_exit_code(results, (size_t)count);
+}
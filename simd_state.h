@@ -0,0 +1,270 @@
+/*
+ * Vector register fingerprinting across an intercepted trial.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef ANOMALY_SIMD_STATE_H
+#define ANOMALY_SIMD_STATE_H 1
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "intercepts.h"
+
+/**
+ * Widest vector registers the CPU and OS support. Every register of the
+ * kind is checked, lanes are 32 bits wide.
+ */
+enum simd_width {
+	SIMD_NONE = 0,
+	SIMD_XMM,                       /* SSE2: xmm0-xmm15 */
+	SIMD_YMM,                       /* AVX2: ymm0-ymm15 */
+	SIMD_ZMM,                       /* AVX-512F: zmm0-zmm31 */
+	SIMD_WIDTHS
+};
+
+#define SIMD_MAX_REGS           32
+#define SIMD_MAX_LANES          16
+
+static const struct {
+	const char *name;
+	unsigned int regs;
+	unsigned int lanes;
+} simd_widths[SIMD_WIDTHS] = {
+	[SIMD_NONE] = { "none", 0, 0 },
+	[SIMD_XMM]  = { "xmm", 16, 4 },
+	[SIMD_YMM]  = { "ymm", 16, 8 },
+	[SIMD_ZMM]  = { "zmm", 32, 16 },
+};
+
+/*
+ * Values loaded before a trial, one 64-byte row per register of which the
+ * narrower kinds use a prefix. Trials alternate between the two sets, so a
+ * register restored from a stale save of the previous trial shows up too.
+ */
+struct simd_pattern {
+	uint32_t lane[2][SIMD_MAX_REGS][SIMD_MAX_LANES];
+} __attribute__((aligned(64)));
+
+static struct simd_pattern simd_pattern;
+
+static inline void simd_pattern_init(void)
+{
+	for (uint32_t set = 0; set < 2; set++) {
+		for (uint32_t reg = 0; reg < SIMD_MAX_REGS; reg++) {
+			for (uint32_t lane = 0; lane < SIMD_MAX_LANES; lane++)
+				simd_pattern.lane[set][reg][lane] =
+					0x9e3779b9u * (set * 1024 + reg * 32 + lane + 1);
+		}
+	}
+}
+
+/* __builtin_cpu_supports() also checks that the OS enabled the state in XCR0 */
+static inline enum simd_width simd_detect(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return SIMD_ZMM;
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_YMM;
+	return SIMD_XMM;
+}
+
+#define SIMD_REGS_16    "0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15"
+#define SIMD_REGS_32    SIMD_REGS_16 ",16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31"
+
+#define SIMD_CLOBBER_16 "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", \
+			"xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"
+#define SIMD_CLOBBER_32 SIMD_CLOBBER_16, "xmm16", "xmm17", "xmm18", "xmm19", "xmm20", "xmm21", \
+			"xmm22", "xmm23", "xmm24", "xmm25", "xmm26", "xmm27", "xmm28", "xmm29", \
+			"xmm30", "xmm31", "k1"
+
+/* The trial of intercepts.h, between filling the registers and comparing them */
+#define SIMD_TRIAL(insn) \
+	"pushq %%rbx\n" \
+	"pushfq\n" \
+	"orl $0x100, (%%rsp)\n" \
+	"popfq\n" \
+	"movw (%[probe]), %%ss\n" \
+	insn "\n" \
+	"popq %%rbx\n"
+
+/*
+ * Trial kernels with the vector registers live across MOV SS + intercept and
+ * the #DB. All of it is one asm statement so the compiler never gets to use a
+ * vector register in between. Afterwards every register is compared with its
+ * pattern in place, and the mask of its matching lanes stored to equal[reg].
+ */
+#define X(id, name, insn, fault_len, desc) \
+static void simd_trial_xmm_##name(uint16_t *probe, const void *pattern, uint16_t *equal) \
+{ \
+	uint32_t eax = 0, ecx = 0; \
+	__asm__ __volatile__( \
+		".irp i," SIMD_REGS_16 "\n" \
+		"movdqa \\i*64(%[pattern]), %%xmm\\i\n" \
+		".endr\n" \
+		SIMD_TRIAL(insn) \
+		".irp i," SIMD_REGS_16 "\n" \
+		"pcmpeqd \\i*64(%[pattern]), %%xmm\\i\n" \
+		"movmskps %%xmm\\i, %%eax\n" \
+		"movw %%ax, \\i*2(%[equal])\n" \
+		".endr\n" \
+		: "+a"(eax), "+c"(ecx) \
+		: [probe] "r"(probe), [pattern] "r"(pattern), [equal] "r"(equal) \
+		: "rdx", "memory", SIMD_CLOBBER_16 \
+	); \
+} \
+__attribute__((target("avx2"))) \
+static void simd_trial_ymm_##name(uint16_t *probe, const void *pattern, uint16_t *equal) \
+{ \
+	uint32_t eax = 0, ecx = 0; \
+	__asm__ __volatile__( \
+		".irp i," SIMD_REGS_16 "\n" \
+		"vmovdqa \\i*64(%[pattern]), %%ymm\\i\n" \
+		".endr\n" \
+		SIMD_TRIAL(insn) \
+		".irp i," SIMD_REGS_16 "\n" \
+		"vpcmpeqd \\i*64(%[pattern]), %%ymm\\i, %%ymm\\i\n" \
+		"vmovmskps %%ymm\\i, %%eax\n" \
+		"movw %%ax, \\i*2(%[equal])\n" \
+		".endr\n" \
+		"vzeroupper\n" \
+		: "+a"(eax), "+c"(ecx) \
+		: [probe] "r"(probe), [pattern] "r"(pattern), [equal] "r"(equal) \
+		: "rdx", "memory", SIMD_CLOBBER_16 \
+	); \
+} \
+__attribute__((target("avx512f"))) \
+static void simd_trial_zmm_##name(uint16_t *probe, const void *pattern, uint16_t *equal) \
+{ \
+	uint32_t eax = 0, ecx = 0; \
+	__asm__ __volatile__( \
+		".irp i," SIMD_REGS_32 "\n" \
+		"vmovdqa32 \\i*64(%[pattern]), %%zmm\\i\n" \
+		".endr\n" \
+		SIMD_TRIAL(insn) \
+		".irp i," SIMD_REGS_32 "\n" \
+		"vpcmpeqd \\i*64(%[pattern]), %%zmm\\i, %%k1\n" \
+		"kmovw %%k1, \\i*2(%[equal])\n" \
+		".endr\n" \
+		"vzeroupper\n" \
+		: "+a"(eax), "+c"(ecx) \
+		: [probe] "r"(probe), [pattern] "r"(pattern), [equal] "r"(equal) \
+		: "rdx", "memory", SIMD_CLOBBER_32 \
+	); \
+}
+ANOMALY_INTERCEPTS(X)
+#undef X
+
+typedef void (*simd_trial_fn)(uint16_t *probe, const void *pattern, uint16_t *equal);
+
+static const simd_trial_fn simd_trials[ANOMALY_INTERCEPT_COUNT][SIMD_WIDTHS] = {
+#define X(id, name, insn, fault_len, desc) \
+	[ANOMALY_INTERCEPT_##id] = { \
+		[SIMD_XMM] = simd_trial_xmm_##name, \
+		[SIMD_YMM] = simd_trial_ymm_##name, \
+		[SIMD_ZMM] = simd_trial_zmm_##name, \
+	},
+	ANOMALY_INTERCEPTS(X)
+#undef X
+};
+
+/* Run trial seq of an intercept with the registers of the given width live */
+static inline void simd_trial(unsigned int intercept, enum simd_width width, uint64_t seq,
+			      uint16_t *probe, uint16_t *equal)
+{
+	simd_trials[intercept][width](probe, simd_pattern.lane[seq & 1], equal);
+}
+
+/*
+ * Whether any lane came back different. Masks of untouched registers are all
+ * ones up to the width's lane count.
+ */
+static inline int simd_corrupt(enum simd_width width, const uint16_t *equal)
+{
+	const uint16_t full = (uint16_t)((1u << simd_widths[width].lanes) - 1);
+	uint16_t diff = 0;
+
+	for (unsigned int reg = 0; reg < simd_widths[width].regs; reg++)
+		diff |= equal[reg] ^ full;
+	return diff != 0;
+}
+
+/**
+ * Corruption seen over a run: trials affected, and for every register how
+ * many trials it was corrupted in and which lanes ever were.
+ */
+struct simd_damage {
+	uint64_t trials;                        /* Trials checked */
+	uint64_t corrupt;                       /* Trials with any lane corrupted */
+	uint64_t reg_trials[SIMD_MAX_REGS];
+	uint16_t lanes[SIMD_MAX_REGS];          /* Corrupted lanes, bit n for lane n */
+};
+
+/* Account one trial's compare masks, returns whether it was corrupted */
+static inline int simd_damage_add(struct simd_damage *d, enum simd_width width, const uint16_t *equal)
+{
+	const uint16_t full = (uint16_t)((1u << simd_widths[width].lanes) - 1);
+
+	d->trials++;
+	if (!simd_corrupt(width, equal))
+		return 0;
+	d->corrupt++;
+	for (unsigned int reg = 0; reg < simd_widths[width].regs; reg++) {
+		const uint16_t bad = equal[reg] ^ full;
+
+		if (bad != 0) {
+			d->reg_trials[reg]++;
+			d->lanes[reg] |= bad;
+		}
+	}
+	return 1;
+}
+
+static inline void simd_damage_merge(struct simd_damage *dst, const struct simd_damage *src)
+{
+	dst->trials += src->trials;
+	dst->corrupt += src->corrupt;
+	for (unsigned int reg = 0; reg < SIMD_MAX_REGS; reg++) {
+		dst->reg_trials[reg] += src->reg_trials[reg];
+		dst->lanes[reg] |= src->lanes[reg];
+	}
+}
+
+static inline void simd_damage_print(const struct simd_damage *d, enum simd_width width)
+{
+	if (width == SIMD_NONE || d->trials == 0)
+		return;
+
+	printf("  %12" PRIu64 " trials with corrupted %s state (%u registers checked)\n", d->corrupt,
+	       simd_widths[width].name, simd_widths[width].regs);
+	for (unsigned int reg = 0; reg < simd_widths[width].regs; reg++) {
+		if (d->reg_trials[reg] == 0)
+			continue;
+		printf("  %12" PRIu64 "   %s%-2u lanes", d->reg_trials[reg], simd_widths[width].name, reg);
+		for (unsigned int lane = 0; lane < simd_widths[width].lanes; lane++) {
+			if (d->lanes[reg] & (1u << lane))
+				printf(" %u", lane);
+		}
+		printf("\n");
+	}
+}
+
+#endif /* ANOMALY_SIMD_STATE_H */
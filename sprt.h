@@ -0,0 +1,183 @@
+/*
+ * Sequential probability ratio test for adaptive trial counts.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef ANOMALY_SPRT_H
+#define ANOMALY_SPRT_H 1
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+/**
+ * Wald's SPRT over Bernoulli trials, each one either anomalous or clean.
+ *
+ * H0 (clean):    anomaly rate <= p0
+ * H1 (affected): anomaly rate >= p1
+ *
+ * alpha is the probability of calling a clean host affected and beta the
+ * probability of calling an affected host clean. Every trial adds its log
+ * likelihood ratio to a running sum which is compared against two fixed
+ * thresholds, so the test costs two additions and a compare per trial.
+ */
+struct sprt_params {
+	double p0;
+	double p1;
+	double alpha;
+	double beta;
+};
+
+#define SPRT_PARAMS_DEFAULT { .p0 = 0.001, .p1 = 0.01, .alpha = 0.01, .beta = 0.01 }
+
+/* Budget used by adaptive runs when no --iterations cap is given */
+#define SPRT_DEFAULT_MAX_TRIALS 1000000
+
+enum sprt_decision {
+	SPRT_CONTINUE = 0,
+	SPRT_CLEAN,
+	SPRT_AFFECTED,
+};
+
+struct sprt {
+	double llr;
+	double step_hit;                /* log(p1 / p0) */
+	double step_miss;               /* log((1 - p1) / (1 - p0)) */
+	double upper;                   /* Accept H1 at or above */
+	double lower;                   /* Accept H0 at or below */
+	uint64_t trials;
+	uint64_t hits;
+	enum sprt_decision decision;
+};
+
+static inline int sprt_params_valid(const struct sprt_params *p)
+{
+	return p->p0 > 0 && p->p0 < p->p1 && p->p1 < 1 &&
+	       p->alpha > 0 && p->alpha < 0.5 && p->beta > 0 && p->beta < 0.5;
+}
+
+static inline void sprt_init(struct sprt *s, const struct sprt_params *p)
+{
+	s->llr = 0;
+	s->step_hit = log(p->p1 / p->p0);
+	s->step_miss = log((1 - p->p1) / (1 - p->p0));
+	s->upper = log((1 - p->beta) / p->alpha);
+	s->lower = log(p->beta / (1 - p->alpha));
+	s->trials = 0;
+	s->hits = 0;
+	s->decision = SPRT_CONTINUE;
+}
+
+/**
+ * Account one trial. Once a decision is reached it sticks, later trials are
+ * still counted towards the rate estimate.
+ */
+static inline enum sprt_decision sprt_update(struct sprt *s, int anomalous)
+{
+	s->trials++;
+	if (anomalous) {
+		s->hits++;
+		s->llr += s->step_hit;
+	} else {
+		s->llr += s->step_miss;
+	}
+
+	if (s->decision == SPRT_CONTINUE) {
+		if (s->llr >= s->upper)
+			s->decision = SPRT_AFFECTED;
+		else if (s->llr <= s->lower)
+			s->decision = SPRT_CLEAN;
+	}
+	return s->decision;
+}
+
+/**
+ * Parse "P0,P1[,ALPHA[,BETA]]", leaving omitted fields untouched.
+ */
+static inline int sprt_parse_params(const char *str, struct sprt_params *p)
+{
+	struct sprt_params parsed = *p;
+	double *const out[4] = { &parsed.p0, &parsed.p1, &parsed.alpha, &parsed.beta };
+	unsigned int n = 0;
+	char *end;
+
+	for (;;) {
+		if (n == 4)
+			return -1;
+		*out[n++] = strtod(str, &end);
+		if (end == str)
+			return -1;
+		if (*end == '\0')
+			break;
+		if (*end != ',')
+			return -1;
+		str = end + 1;
+	}
+	if (n < 2 || !sprt_params_valid(&parsed))
+		return -1;
+	*p = parsed;
+	return 0;
+}
+
+/**
+ * Wilson score interval for a binomial proportion at normal quantile z.
+ */
+static inline void sprt_wilson_interval(uint64_t hits, uint64_t trials, double z,
+					double *low, double *high)
+{
+	const double n = (double)trials;
+	double p, denom, center, half;
+
+	if (trials == 0) {
+		*low = 0;
+		*high = 1;
+		return;
+	}
+
+	p = (double)hits / n;
+	denom = 1 + z * z / n;
+	center = (p + z * z / (2 * n)) / denom;
+	half = z * sqrt(p * (1 - p) / n + z * z / (4 * n * n)) / denom;
+	*low = center - half < 0 ? 0 : center - half;
+	*high = center + half > 1 ? 1 : center + half;
+}
+
+static inline const char *sprt_decision_name(enum sprt_decision decision)
+{
+	switch (decision) {
+	case SPRT_CLEAN:        return "clean";
+	case SPRT_AFFECTED:     return "affected";
+	default:                return "undecided";
+	}
+}
+
+static inline void sprt_print(const struct sprt *s, uint64_t budget)
+{
+	double low, high;
+
+	sprt_wilson_interval(s->hits, s->trials, 1.96, &low, &high);
+	printf("  SPRT: %s after %" PRIu64 " of %" PRIu64 " trials, anomaly rate %.4f%% (95%% CI %.4f%%-%.4f%%)\n",
+	       sprt_decision_name(s->decision), s->trials, budget,
+	       100.0 * (double)s->hits / (double)(s->trials ? s->trials : 1), 100.0 * low, 100.0 * high);
+}
+
+#endif /* ANOMALY_SPRT_H */
@@ -0,0 +1,348 @@
+/*
+ * Compact binary trial log backed by a memory-mapped file.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef ANOMALY_TRIAL_LOG_H
+#define ANOMALY_TRIAL_LOG_H 1
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#endif
+#include <cpuid.h>
+#include "drx.h"
+#include "intercepts.h"
+
+/**
+ * On-disk layout: a trial_log_header, a trial_log_meta block describing the
+ * machine the log was written on (version 2 and later), then a preallocated
+ * array of fixed-size trial_record entries starting at header_size. All
+ * fields are little-endian. Version 1 logs have no meta block and a zero
+ * header_size, their records start right after the 64-byte header.
+ */
+#define TRIAL_LOG_MAGIC         "KVMATLOG"
+#define TRIAL_LOG_VERSION       2
+
+struct trial_log_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t capacity;              /* Records preallocated after the header */
+	uint64_t count;                 /* Records written, may exceed capacity */
+	uint32_t header_size;           /* Offset of the first record, 0 in version 1 */
+	uint8_t reserved[28];
+};
+
+#define TRIAL_LOG_META_STR      64
+
+struct trial_log_meta {
+	char host[TRIAL_LOG_META_STR];          /* uname nodename */
+	char kernel[TRIAL_LOG_META_STR];        /* uname release */
+	char cpu_model[TRIAL_LOG_META_STR];     /* CPUID brand string */
+};
+
+#define TRIAL_LOG_HEADER_SIZE   (sizeof(struct trial_log_header) + sizeof(struct trial_log_meta))
+
+#define TRIAL_F_TRAP            0x1     /* A #DB was observed, dr6/rip are valid */
+#define TRIAL_F_FAULT           0x2     /* The intercepting instruction faulted and was skipped */
+#define TRIAL_F_MISMATCH        0x4     /* DR6 differed from the software model */
+#define TRIAL_F_HANG            0x8     /* The tracee made no progress and was killed */
+#define TRIAL_F_DISTURBED       0x10    /* The vCPU migrated or stalled between MOV SS and #DB */
+#define TRIAL_F_SIMD            0x20    /* Vector registers differed from their pattern after the #DB */
+
+struct trial_record {
+	uint64_t trial;                 /* Trial index within its worker */
+	uint64_t tsc;                   /* TSC at trial start */
+	uint64_t dr7;                   /* DR7 configuration armed for the trial */
+	uint64_t dr6;                   /* DR6 observed at the #DB */
+	uint64_t rip;                   /* RIP at the #DB */
+	uint64_t latency;               /* TSC cycles from trial start to #DB observed */
+	uint32_t cpu;                   /* CPU the trial started on */
+	uint16_t test;                  /* ANOMALY_TEST_* id */
+	uint8_t intercept;              /* ANOMALY_INTERCEPT_* id */
+	uint8_t flags;                  /* TRIAL_F_* */
+	uint64_t reserved;
+};
+
+_Static_assert(sizeof(struct trial_log_header) == 64, "trial log header must be 64 bytes");
+_Static_assert(sizeof(struct trial_record) == 64, "trial record must be 64 bytes");
+_Static_assert(TRIAL_LOG_HEADER_SIZE % 64 == 0, "trial records must stay 64-byte aligned");
+
+struct trial_log {
+	struct trial_log_header *header;
+	struct trial_log_meta *meta;            /* NULL for version 1 logs */
+	struct trial_record *records;
+	size_t size;
+	int fd;
+};
+
+/**
+ * Processor brand string from CPUID leaves 0x80000002-0x80000004, with the
+ * leading padding some vendors add stripped.
+ */
+static inline void trial_log_cpu_model(char *buf, size_t size)
+{
+	uint32_t brand[13] = { 0 };
+	unsigned int eax, ebx, ecx, edx;
+	const char *p = (const char *)brand;
+
+	if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000004) {
+		snprintf(buf, size, "unknown");
+		return;
+	}
+	for (unsigned int leaf = 0; leaf < 3; leaf++)
+		__get_cpuid(0x80000002 + leaf, &brand[leaf * 4], &brand[leaf * 4 + 1],
+			    &brand[leaf * 4 + 2], &brand[leaf * 4 + 3]);
+	while (*p == ' ')
+		p++;
+	snprintf(buf, size, "%s", p);
+}
+
+/**
+ * Hypervisor vendor from CPUID leaf 0x40000000, "none" when CPUID.1:ECX[31]
+ * says no hypervisor is present.
+ */
+static inline void trial_log_hypervisor(char *buf, size_t size)
+{
+	unsigned int eax, ebx, ecx, edx;
+	uint32_t vendor[4] = { 0 };
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0 || !(ecx & (1u << 31))) {
+		snprintf(buf, size, "none");
+		return;
+	}
+	__cpuid(0x40000000, eax, vendor[0], vendor[1], vendor[2]);
+	snprintf(buf, size, "%.12s", (const char *)vendor);
+}
+
+#if !defined(_WIN32)
+
+static inline void trial_log_fill_meta(struct trial_log_meta *meta)
+{
+	struct utsname uts;
+
+	memset(meta, 0, sizeof(*meta));
+	if (uname(&uts) == 0) {
+		snprintf(meta->host, sizeof(meta->host), "%s", uts.nodename);
+		snprintf(meta->kernel, sizeof(meta->kernel), "%s", uts.release);
+	}
+	trial_log_cpu_model(meta->cpu_model, sizeof(meta->cpu_model));
+}
+
+/**
+ * Create (or truncate) a log file with room for capacity records and map it.
+ */
+static inline int trial_log_create(struct trial_log *log, const char *path, uint64_t capacity)
+{
+	log->size = TRIAL_LOG_HEADER_SIZE + capacity * sizeof(struct trial_record);
+	log->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (log->fd < 0)
+		return -1;
+
+	if (ftruncate(log->fd, (off_t)log->size) != 0 ||
+	    (log->header = mmap(NULL, log->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+				log->fd, 0)) == MAP_FAILED) {
+		close(log->fd);
+		return -1;
+	}
+	log->meta = (struct trial_log_meta *)(log->header + 1);
+	log->records = (struct trial_record *)((char *)log->header + TRIAL_LOG_HEADER_SIZE);
+
+	memcpy(log->header->magic, TRIAL_LOG_MAGIC, sizeof(log->header->magic));
+	log->header->version = TRIAL_LOG_VERSION;
+	log->header->record_size = sizeof(struct trial_record);
+	log->header->capacity = capacity;
+	log->header->count = 0;
+	log->header->header_size = TRIAL_LOG_HEADER_SIZE;
+	trial_log_fill_meta(log->meta);
+	return 0;
+}
+
+/**
+ * Validate the header of a mapped log of the given size and locate its meta
+ * block and records. Accepts every version up to TRIAL_LOG_VERSION.
+ */
+static inline int trial_log_attach(struct trial_log *log, void *base, size_t size)
+{
+	const struct trial_log_header *const header = base;
+	size_t header_size;
+
+	if (size < sizeof(struct trial_log_header) ||
+	    memcmp(header->magic, TRIAL_LOG_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->version == 0 || header->version > TRIAL_LOG_VERSION ||
+	    header->record_size != sizeof(struct trial_record))
+		return -1;
+
+	header_size = header->version == 1 ? sizeof(struct trial_log_header) : header->header_size;
+	if (header_size < sizeof(struct trial_log_header) || header_size > size ||
+	    header->capacity > (size - header_size) / sizeof(struct trial_record))
+		return -1;
+
+	log->header = base;
+	log->size = size;
+	log->meta = header_size >= TRIAL_LOG_HEADER_SIZE ? (struct trial_log_meta *)(log->header + 1) : NULL;
+	log->records = (struct trial_record *)((char *)base + header_size);
+	return 0;
+}
+
+/**
+ * Map an existing log read-only and validate its header.
+ */
+static inline int trial_log_open(struct trial_log *log, const char *path)
+{
+	struct stat st;
+	void *base;
+
+	log->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (log->fd < 0)
+		return -1;
+
+	if (fstat(log->fd, &st) != 0 || (size_t)st.st_size < sizeof(struct trial_log_header) ||
+	    (base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+			 log->fd, 0)) == MAP_FAILED) {
+		close(log->fd);
+		errno = errno ? errno : EINVAL;
+		return -1;
+	}
+
+	if (trial_log_attach(log, base, (size_t)st.st_size) != 0) {
+		munmap(base, (size_t)st.st_size);
+		close(log->fd);
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Shrink the file to the records actually written and unmap it.
+ */
+static inline void trial_log_close(struct trial_log *log)
+{
+	const uint64_t count = log->header->count < log->header->capacity ?
+			       log->header->count : log->header->capacity;
+	const int writable = (fcntl(log->fd, F_GETFL) & O_ACCMODE) != O_RDONLY;
+	const size_t header_size = (size_t)((char *)log->records - (char *)log->header);
+
+	if (writable) {
+		log->header->capacity = count;
+		msync(log->header, log->size, MS_ASYNC);
+	}
+	munmap(log->header, log->size);
+	if (writable)
+		(void)ftruncate(log->fd, (off_t)(header_size + count * sizeof(struct trial_record)));
+	close(log->fd);
+}
+
+#endif /* !_WIN32 */
+
+/**
+ * Append a record. Safe to call from several threads and from processes
+ * sharing the mapping; records past the preallocated capacity are dropped but
+ * still counted.
+ */
+/* Returns the record's index, for trial_log_tag() once more is known about it */
+static inline uint64_t trial_log_append(struct trial_log *log, const struct trial_record *rec)
+{
+	const uint64_t idx = __atomic_fetch_add(&log->header->count, 1, __ATOMIC_RELAXED);
+	if (idx < log->header->capacity)
+		log->records[idx] = *rec;
+	return idx;
+}
+
+/* Add TRIAL_F_* flags to a record appended earlier */
+static inline void trial_log_tag(struct trial_log *log, uint64_t idx, uint8_t flags)
+{
+	if (idx < log->header->capacity)
+		log->records[idx].flags |= flags;
+}
+
+static inline uint64_t trial_log_count(const struct trial_log *log)
+{
+	return log->header->count < log->header->capacity ? log->header->count : log->header->capacity;
+}
+
+static inline const char *trial_log_intercept_name(unsigned int id)
+{
+	return id < ANOMALY_INTERCEPT_COUNT ? anomaly_intercepts[id].name : "?";
+}
+
+/**
+ * Render every record of a log as an aligned text table or as CSV.
+ */
+static inline void trial_log_dump(const struct trial_log *log, FILE *out, int csv)
+{
+	const uint64_t count = trial_log_count(log);
+	char bits[DR6_BITS_STR_MAX];
+
+	if (csv) {
+		fprintf(out, "trial,cpu,tsc,test,intercept,dr7,dr6,rip,latency,flags\n");
+	} else {
+		fprintf(out, "# %" PRIu64 " records (version %u)\n", count, log->header->version);
+		if (log->meta != NULL)
+			fprintf(out, "# host: %.64s\n# kernel: %.64s\n# cpu: %.64s\n", log->meta->host,
+				log->meta->kernel, log->meta->cpu_model);
+		fprintf(out, "%10s %4s %20s %4s %-8s %10s %10s %-12s %18s %10s\n", "trial", "cpu",
+			"tsc", "test", "insn", "dr7", "dr6", "bits", "rip", "latency");
+	}
+
+	for (uint64_t i = 0; i < count; i++) {
+		const struct trial_record *const rec = &log->records[i];
+
+		if (csv) {
+			fprintf(out, "%" PRIu64 ",%u,%" PRIu64 ",%u,%s,0x%" PRIx64 ",0x%" PRIx64
+				",0x%" PRIx64 ",%" PRIu64 ",%u\n",
+				rec->trial, rec->cpu, rec->tsc, rec->test,
+				trial_log_intercept_name(rec->intercept), rec->dr7, rec->dr6,
+				rec->rip, rec->latency, rec->flags);
+			continue;
+		}
+
+		if (rec->flags & TRIAL_F_TRAP)
+			format_dr6_bits(rec->dr6, bits, sizeof(bits));
+		else if (rec->flags & TRIAL_F_HANG)
+			snprintf(bits, sizeof(bits), "hang");
+		else
+			snprintf(bits, sizeof(bits), "no #DB");
+		fprintf(out, "%10" PRIu64 " %4u %20" PRIu64 " %4u %-8s 0x%08" PRIx64 " 0x%08" PRIx64
+			" %-12s 0x%016" PRIx64 " %10" PRIu64 "%s%s%s%s\n",
+			rec->trial, rec->cpu, rec->tsc, rec->test,
+			trial_log_intercept_name(rec->intercept), rec->dr7, rec->dr6, bits,
+			rec->rip, rec->latency, (rec->flags & TRIAL_F_FAULT) ? " fault" : "",
+			(rec->flags & TRIAL_F_MISMATCH) ? " mismatch" : "",
+			(rec->flags & TRIAL_F_DISTURBED) ? " disturbed" : "",
+			(rec->flags & TRIAL_F_SIMD) ? " simd" : "");
+	}
+
+	if (log->header->count > log->header->capacity)
+		fprintf(out, "# %" PRIu64 " records dropped (log full)\n",
+			log->header->count - log->header->capacity);
+}
+
+#endif /* ANOMALY_TRIAL_LOG_H */
@@ -0,0 +1,63 @@
+/*
+ * Time stamp counter helpers.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef ANOMALY_TSC_H
+#define ANOMALY_TSC_H 1
+#include <stdint.h>
+
+static inline uint64_t rdtsc(void)
+{
+	uint32_t lo, hi;
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * RDTSCP also returns IA32_TSC_AUX, which Linux loads with (node << 12) | cpu
+ * and Windows with the processor number.
+ */
+static inline uint64_t rdtscp(uint32_t *aux)
+{
+	uint32_t lo, hi, c;
+	__asm__ __volatile__("rdtscp" : "=a"(lo), "=d"(hi), "=c"(c));
+	*aux = c;
+	return ((uint64_t)hi << 32) | lo;
+}
+
+#define TSC_AUX_CPU(aux)        ((aux) & 0xFFF)
+
+/**
+ * Serialized timestamp for interval measurement. RDTSCP waits for all prior
+ * instructions to retire and the trailing LFENCE keeps later instructions from
+ * starting before the counter is read, so the same read can open and close a
+ * measured window.
+ */
+static inline uint64_t rdtscp_serialized(uint32_t *aux)
+{
+	uint32_t lo, hi, c;
+	__asm__ __volatile__("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi), "=c"(c) : : "memory");
+	*aux = c;
+	return ((uint64_t)hi << 32) | lo;
+}
+
+#endif /* ANOMALY_TSC_H */
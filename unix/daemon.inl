@@ -0,0 +1,463 @@
+/*
+ * Always-on canary: pending-dbg-causes trials at a low, budgeted rate.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+
+/* Trials are scheduled in batches ten times per second */
+#define DAEMON_TICK_NS          100000000ull
+
+/* Unused CPU budget is saved up for at most a second's worth */
+#define DAEMON_BURST_NS         1000000000ull
+
+/* Anomalies are logged at most once a minute per intercept */
+#define DAEMON_REPORT_NS        60000000000ull
+
+/* CPU cost assumed for a trial until the first batch has been measured */
+#define DAEMON_TRIAL_NS_GUESS   20000ull
+
+enum {
+	DAEMON_EV_TICK,
+	DAEMON_EV_SIGNAL,
+	DAEMON_EV_STATUS,
+};
+
+/**
+ * Token bucket of CPU time in nanoseconds. It fills at budget_ppm of the wall
+ * clock, up to DAEMON_BURST_NS of it, and is drained by the CPU time the whole
+ * process actually used, so syscalls, signal delivery and status queries are
+ * paid for as well as the trials themselves.
+ */
+struct daemon_bucket {
+	uint64_t budget_ppm;
+	int64_t tokens;                         /* Negative while overdrawn */
+	uint64_t wall_ns;                       /* When it was last refilled */
+	uint64_t cpu_ns;                        /* Process CPU time when last charged */
+	uint64_t trial_ns;                      /* Moving average CPU cost of a trial */
+};
+
+struct daemon {
+	struct anomaly_options opts;            /* Copy with adaptive runs and logging off */
+	struct daemon_bucket bucket;
+	struct daemon_stats *stats;
+	uint64_t pending;                       /* Trials owed times 1e9, carried across ticks */
+	unsigned int intercept;                 /* Intercept of the last batch */
+	uint64_t reported_ns[ANOMALY_INTERCEPT_COUNT];
+	struct pending_dbg_causes_worker worker;
+};
+
+static uint64_t daemon_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t daemon_realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Refill for the wall time passed, charge the CPU time used since last time */
+static void daemon_bucket_update(struct daemon_bucket *b)
+{
+	const int64_t burst = (int64_t)(DAEMON_BURST_NS * b->budget_ppm / 1000000);
+	const uint64_t now = anomaly_now_ns();
+	const uint64_t cpu = daemon_cpu_ns();
+
+	b->tokens += (int64_t)((now - b->wall_ns) * b->budget_ppm / 1000000);
+	if (b->tokens > burst)
+		b->tokens = burst;
+	b->tokens -= (int64_t)(cpu - b->cpu_ns);
+	b->wall_ns = now;
+	b->cpu_ns = cpu;
+}
+
+/* How many trials the bucket can pay for right now */
+static uint64_t daemon_bucket_allow(const struct daemon_bucket *b)
+{
+	if (b->tokens <= 0)
+		return 0;
+	return (uint64_t)b->tokens / b->trial_ns;
+}
+
+static struct daemon_stats *daemon_stats_create(const char *path, const struct anomaly_options *opts)
+{
+	struct daemon_stats *s;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0644);
+	if (fd < 0)
+		return NULL;
+	if (ftruncate(fd, sizeof(*s)) != 0) {
+		close(fd);
+		return NULL;
+	}
+	s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s == MAP_FAILED)
+		return NULL;
+
+	s->version = DAEMON_STATS_VERSION;
+	s->size = sizeof(*s);
+	s->pid = (uint32_t)getpid();
+	s->intercepts = opts->intercepts;
+	s->rate = opts->rate;
+	s->budget_ppm = opts->cpu_budget_ppm;
+	s->start_ns = daemon_realtime_ns();
+	s->update_ns = s->start_ns;
+
+	/* Readers go by the magic, publish it last */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(s->magic, DAEMON_STATS_MAGIC, sizeof(s->magic));
+	return s;
+}
+
+static int daemon_listen(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memcpy(addr.sun_path, path, strlen(path) + 1);
+
+	/* A previous instance which did not exit cleanly leaves its socket behind */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Answer every pending connection with a snapshot of the counters as
+ * "key value" lines and hang up. Nothing needs to be sent to ask.
+ */
+static void daemon_status(int lfd, const struct daemon_stats *stats)
+{
+	struct daemon_stats s;
+	char buf[2048];
+	int cfd;
+
+	while ((cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		const uint64_t now = daemon_realtime_ns();
+		int len;
+
+		daemon_stats_read(stats, &s);
+		len = snprintf(buf, sizeof(buf),
+			       "pid %u\n"
+			       "uptime_s %.3f\n"
+			       "rate %" PRIu64 "\n"
+			       "cpu_budget_pct %.4f\n"
+			       "cpu_used_pct %.4f\n"
+			       "trials %" PRIu64 "\n"
+			       "traps %" PRIu64 "\n"
+			       "anomalies %" PRIu64 "\n"
+			       "faults %" PRIu64 "\n"
+			       "throttled %" PRIu64 "\n"
+			       "last_dr6 0x%08" PRIx64 "\n",
+			       s.pid, (double)(now - s.start_ns) / 1e9, s.rate,
+			       (double)s.budget_ppm / 1e4,
+			       now > s.start_ns ? (double)s.cpu_ns * 100.0 / (double)(now - s.start_ns) : 0.0,
+			       s.trials, s.traps, s.anomalies, s.faults, s.throttled, s.last_dr6);
+		if (s.last_anomaly_ns != 0 && len < (int)sizeof(buf))
+			len += snprintf(buf + len, sizeof(buf) - (size_t)len, "last_anomaly_s_ago %.3f\n",
+					(double)(now - s.last_anomaly_ns) / 1e9);
+		for (unsigned int id = 0; id < ANOMALY_INTERCEPT_COUNT && len < (int)sizeof(buf); id++) {
+			if ((s.intercepts & ANOMALY_INTERCEPT_MASK(id)) == 0)
+				continue;
+			len += snprintf(buf + len, sizeof(buf) - (size_t)len,
+					"trials_%s %" PRIu64 "\nanomalies_%s %" PRIu64 "\n",
+					anomaly_intercepts[id].name, s.intercept_trials[id],
+					anomaly_intercepts[id].name, s.intercept_anomalies[id]);
+		}
+		if (len > (int)sizeof(buf))
+			len = (int)sizeof(buf);
+		send(cfd, buf, (size_t)len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		close(cfd);
+	}
+}
+
+/* Next intercept in the mask after the last one, wrapping around */
+static unsigned int daemon_next_intercept(const struct daemon *d)
+{
+	unsigned int id = d->intercept;
+
+	do {
+		id = (id + 1) % ANOMALY_INTERCEPT_COUNT;
+	} while ((d->opts.intercepts & ANOMALY_INTERCEPT_MASK(id)) == 0);
+	return id;
+}
+
+/*
+ * Run a batch of trials on the in-process perf backend, the same trial loop
+ * a --backend perf run uses, and fold its outcome into the shared counters.
+ */
+static int daemon_batch(struct daemon *d, uint64_t wanted)
+{
+	struct pending_dbg_causes_worker *const w = &d->worker;
+	struct daemon_stats *const s = d->stats;
+	uint64_t allowed, cpu_ns;
+	int err;
+
+	daemon_bucket_update(&d->bucket);
+	allowed = daemon_bucket_allow(&d->bucket);
+	if (allowed < wanted) {
+		daemon_stats_begin(s);
+		s->throttled += wanted - allowed;
+		daemon_stats_end(s);
+		wanted = allowed;
+	}
+	if (wanted == 0)
+		return 0;
+
+	d->intercept = daemon_next_intercept(d);
+	memset(w, 0, sizeof(*w));
+	w->cpu = -1;
+	w->intercept = d->intercept;
+	w->opts = &d->opts;
+	pending_dbg_causes_init(w);
+	w->budget = wanted;
+
+	cpu_ns = daemon_cpu_ns();
+	err = pending_dbg_causes_perf(w);
+	pending_dbg_causes_finish(w);
+	cpu_ns = daemon_cpu_ns() - cpu_ns;
+
+	/* Track the cost per trial so batches stay within what is left */
+	if (w->trials != 0)
+		d->bucket.trial_ns = (d->bucket.trial_ns * 7 + cpu_ns / w->trials + 7) / 8;
+	if (d->bucket.trial_ns == 0)
+		d->bucket.trial_ns = 1;
+
+	daemon_stats_begin(s);
+	s->trials += w->trials;
+	s->traps += w->traps;
+	s->anomalies += w->anomalies;
+	s->faults += w->faults;
+	s->intercept_trials[w->intercept] += w->trials;
+	s->intercept_anomalies[w->intercept] += w->anomalies;
+	if (w->traps != 0)
+		s->last_dr6 = w->dr6;
+	if (w->anomalies != 0)
+		s->last_anomaly_ns = daemon_realtime_ns();
+	daemon_stats_end(s);
+
+	if (w->anomalies != 0 && (d->reported_ns[w->intercept] == 0 ||
+				  s->last_anomaly_ns - d->reported_ns[w->intercept] >= DAEMON_REPORT_NS)) {
+		printf("%s: %" PRIu64 " of %" PRIu64 " trials anomalous so far, last DR6 0x%08" PRIx64 "\n",
+		       anomaly_intercepts[w->intercept].name, s->intercept_anomalies[w->intercept],
+		       s->intercept_trials[w->intercept], w->dr6);
+		fflush(stdout);
+		d->reported_ns[w->intercept] = s->last_anomaly_ns;
+	}
+	return err;
+}
+
+static void daemon_tick(struct daemon *d)
+{
+	struct daemon_stats *const s = d->stats;
+
+	daemon_bucket_update(&d->bucket);
+	daemon_stats_begin(s);
+	s->update_ns = daemon_realtime_ns();
+	s->cpu_ns = d->bucket.cpu_ns;
+	daemon_stats_end(s);
+}
+
+/**
+ * Daemon mode: run pending-dbg-causes trials continuously at --rate per
+ * second, in-process and under SCHED_IDLE so any other runnable task on the
+ * CPU goes first, and never spending more than --cpu-budget of one CPU.
+ * Counters are published in a shared-memory file (struct daemon_stats) and
+ * as text over a Unix socket. Runs in the foreground until SIGINT or SIGTERM.
+ */
+int anomaly_daemon(const struct anomaly_options *opts)
+{
+	static struct daemon d;
+	struct sched_param param = { 0 };
+	struct sigaction old_signals[3];
+	struct epoll_event ev;
+	struct itimerspec tick = { 0 };
+	sigset_t mask, old_mask;
+	int tfd = -1, sfd = -1, lfd = -1, epfd = -1;
+	int running = 1;
+	int err = 1;
+
+	if (opts->all_cpus || opts->threads != 0 || opts->tracees != 0 || opts->snapshot_dir != NULL ||
+	    opts->simd || opts->trace_path != NULL || opts->noise_profiles != 0 || opts->placements != 0) {
+		fprintf(stderr, "--daemon runs a single in-process trial loop and excludes --all-cpus, "
+			"--threads, --tracees, --snapshot, --simd, --trace, --noise and --placement\n");
+		return EINVAL;
+	}
+
+	memset(&d, 0, sizeof(d));
+	d.opts = *opts;
+	d.opts.backend = ANOMALY_BACKEND_PERF;
+	d.opts.adaptive = 0;
+	d.opts.log_path = NULL;
+	d.intercept = ANOMALY_INTERCEPT_COUNT - 1;
+	d.bucket.budget_ppm = opts->cpu_budget_ppm;
+	d.bucket.trial_ns = DAEMON_TRIAL_NS_GUESS;
+	d.bucket.wall_ns = anomaly_now_ns();
+	d.bucket.cpu_ns = daemon_cpu_ns();
+
+	/* Yield to anything else that wants the CPU */
+	if (sched_setscheduler(0, SCHED_IDLE, &param) != 0)
+		perror("sched_setscheduler(SCHED_IDLE)");
+
+	d.stats = daemon_stats_create(opts->shm_path, opts);
+	if (d.stats == NULL) {
+		perror(opts->shm_path);
+		return 1;
+	}
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, &old_mask);
+
+	if (pending_dbg_causes_perf_signals(old_signals) != 0)
+		goto out_mask;
+
+	lfd = daemon_listen(opts->socket_path);
+	if (lfd < 0) {
+		perror(opts->socket_path);
+		goto out;
+	}
+	sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (sfd < 0 || tfd < 0 || epfd < 0) {
+		perror("signalfd/timerfd/epoll");
+		goto out;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.u64 = DAEMON_EV_TICK;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+	ev.data.u64 = DAEMON_EV_SIGNAL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev);
+	ev.data.u64 = DAEMON_EV_STATUS;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+	tick.it_interval.tv_nsec = (long)DAEMON_TICK_NS;
+	tick.it_value = tick.it_interval;
+	if (timerfd_settime(tfd, 0, &tick, NULL) != 0) {
+		perror("timerfd_settime");
+		goto out;
+	}
+
+	printf("daemon: pid %d, %u trials/sec, %.2f%% CPU budget, stats in %s, status on %s\n",
+	       (int)getpid(), opts->rate, (double)opts->cpu_budget_ppm / 1e4,
+	       opts->shm_path, opts->socket_path);
+	fflush(stdout);
+
+	err = 0;
+	while (running && !err) {
+		struct epoll_event events[4];
+		int nr;
+
+		nr = epoll_wait(epfd, events, 4, -1);
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			err = 1;
+			break;
+		}
+
+		for (int e = 0; e < nr; e++) {
+			struct signalfd_siginfo si;
+			uint64_t ticks;
+
+			switch (events[e].data.u64) {
+			case DAEMON_EV_TICK:
+				/* Missed ticks are not made up for, that would only burst */
+				if (read(tfd, &ticks, sizeof(ticks)) != sizeof(ticks))
+					break;
+				d.pending += (uint64_t)opts->rate * DAEMON_TICK_NS;
+				err = daemon_batch(&d, d.pending / 1000000000ull);
+				d.pending %= 1000000000ull;
+				daemon_tick(&d);
+				break;
+			case DAEMON_EV_SIGNAL:
+				while (read(sfd, &si, sizeof(si)) == sizeof(si))
+					running = 0;
+				break;
+			case DAEMON_EV_STATUS:
+				daemon_status(lfd, d.stats);
+				break;
+			}
+		}
+	}
+
+	printf("daemon: %" PRIu64 " trials, %" PRIu64 " anomalies, %" PRIu64 " throttled\n",
+	       d.stats->trials, d.stats->anomalies, d.stats->throttled);
+
+out:
+	if (epfd >= 0)
+		close(epfd);
+	if (tfd >= 0)
+		close(tfd);
+	if (sfd >= 0)
+		close(sfd);
+	if (lfd >= 0) {
+		close(lfd);
+		unlink(opts->socket_path);
+	}
+	pending_dbg_causes_perf_restore(old_signals);
+out_mask:
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+	unlink(opts->shm_path);
+	if (err) {
+		munmap(d.stats, sizeof(*d.stats));
+		return ANOMALY_RESULT_FAIL;
+	}
+	err = d.stats->anomalies != 0 ? ANOMALY_RESULT_DETECTED : ANOMALY_RESULT_PASS;
+	munmap(d.stats, sizeof(*d.stats));
+	return err;
+}
@@ -0,0 +1,863 @@
+/*
+ * Randomized debug register configuration fuzzer.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#include "ptrace.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/* Configurations tried unless --iterations says otherwise */
+#define DR_FUZZ_DEFAULT_CONFIGS 10000
+
+/* Breakpoints and the probe are placed within this many bytes of buf */
+#define DR_FUZZ_SPAN            32
+
+/* Mismatches printed in full, the rest are only counted */
+#define DR_FUZZ_MAX_REPORT      10
+
+/* Distinct expected/observed DR6 pairs tracked in the summary */
+#define DR_FUZZ_MAX_PAIRS       32
+
+/* Distinct failing configurations kept for --corpus */
+#define DR_FUZZ_MAX_CORPUS      1024
+
+_Static_assert(2 * DR_FUZZ_SPAN <= CORPUS_SPAN, "dr-fuzz configurations must fit a corpus entry");
+
+/*
+ * Shared between the tracer and the persistent tracee. The tracer writes the
+ * next trial's probe offset and intercept while the tracee is stopped in the
+ * previous trial's #DB, and the tracee counts every trial it starts so a lost
+ * #DB is noticed instead of being blamed on the next configuration. Only buf
+ * is ever covered by a breakpoint, it sits on its own cache line away from
+ * the control fields the tracee reads between trials.
+ */
+struct dr_fuzz_shared {
+	volatile uint64_t started;              /* Trials started by the tracee */
+	volatile uint64_t tsc;                  /* TSC at the latest trial start */
+	volatile uint32_t cpu;                  /* CPU at the latest trial start */
+	volatile uint32_t probe_off;            /* Offset of the SS selector in buf */
+	volatile uint32_t intercept;            /* ANOMALY_INTERCEPT_* id */
+	volatile int stop;
+	uint8_t buf[2 * DR_FUZZ_SPAN] __attribute__((aligned(ANOMALY_CACHE_LINE)));
+};
+
+struct dr_fuzz_pair {
+	uint64_t expected;
+	uint64_t observed;
+	uint64_t count;
+};
+
+struct dr_fuzz_state {
+	const struct anomaly_options *opts;
+	struct dr_fuzz_shared *sh;
+	struct trial_log *log;
+	uint64_t rng;
+	uint32_t intercepts;                    /* Non-faulting intercepts to pick from */
+	uint64_t configs;
+	uint64_t trials;
+	uint64_t mismatches;
+	uint64_t lost;                          /* Trials which never raised a #DB */
+	uint64_t elapsed_ns;
+	unsigned int npairs;
+	struct dr_fuzz_pair pairs[DR_FUZZ_MAX_PAIRS];
+	/* --corpus: distinct failing configurations found */
+	struct corpus_entry *found;
+	unsigned int nfound;
+	/* --replay: entries run in order instead of random configurations, repeat trials each */
+	const struct corpus_entry *replay;
+	uint64_t repeat;
+	uint64_t entry;                         /* Entry armed for the current trial */
+	uint64_t *hits;                         /* Mismatching trials per entry */
+	uint64_t last_expected;                 /* DR6 pair of the latest mismatch, masked */
+	uint64_t last_observed;
+};
+
+static int dr_fuzz_tracee(struct dr_fuzz_shared *sh)
+{
+	if (ptrace_trace())
+		return 3;
+	raise(SIGSTOP);
+
+	while (!sh->stop) {
+		uint32_t aux;
+
+		sh->tsc = rdtscp_serialized(&aux);
+		sh->cpu = TSC_AUX_CPU(aux);
+		sh->started++;
+		anomaly_intercepts[sh->intercept].trial((uint16_t *)&sh->buf[sh->probe_off]);
+	}
+	return 0;
+}
+
+static unsigned int dr_fuzz_pick_intercept(struct dr_fuzz_state *st)
+{
+	const unsigned int n = (unsigned int)__builtin_popcount(st->intercepts);
+	unsigned int pick = (unsigned int)(anomaly_rand(&st->rng) % n);
+	uint32_t mask = st->intercepts;
+
+	while (pick-- != 0)
+		mask &= mask - 1;
+	return (unsigned int)__builtin_ctz(mask);
+}
+
+/*
+ * Draw one configuration. Every breakpoint is independently enabled through
+ * L, G or both and conditioned on execution, writes or reads/writes; I/O
+ * breakpoints need CR4.DE and are rejected by ptrace, so they are not drawn.
+ * Half of the addresses land near the probe to make overlaps common, and the
+ * probe itself may straddle a breakpoint boundary.
+ */
+static void dr_fuzz_generate(struct dr_fuzz_state *st, struct dr_config *cfg, unsigned int *probe_off)
+{
+	static const unsigned int rws[3] = { DR7_RW_EX, DR7_RW_DATA_W, DR7_RW_DATA_RW };
+	static const unsigned int lens[4] = {
+		DR7_LEN_1_BYTE, DR7_LEN_2_BYTE, DR7_LEN_4_BYTE, DR7_LEN_8_BYTE
+	};
+	const uintptr_t buf = (uintptr_t)st->sh->buf;
+
+	*probe_off = (unsigned int)(anomaly_rand(&st->rng) % (DR_FUZZ_SPAN - 1));
+	cfg->dr7 = 0;
+
+	for (unsigned int n = 0; n < 4; n++) {
+		const uint64_t r = anomaly_rand(&st->rng);
+		const unsigned int rw = rws[(r >> 8) % 3];
+		const unsigned int len = rw == DR7_RW_EX ? DR7_LEN_1_BYTE : lens[(r >> 16) & 3];
+		unsigned int off;
+
+		if (r & (1u << 24))
+			off = (unsigned int)((*probe_off + ((r >> 32) % 5)) - 2) % DR_FUZZ_SPAN;
+		else
+			off = (unsigned int)((r >> 32) % DR_FUZZ_SPAN);
+
+		cfg->dr7 |= (uint64_t)rw << DR7_RW_SHIFT(n) | (uint64_t)len << DR7_LEN_SHIFT(n);
+		cfg->addr[n] = (buf + off) & ~((uint64_t)dr7_len_bytes(cfg->dr7, n) - 1);
+		if (r & 1)
+			cfg->dr7 |= (uint64_t)(1 + ((r >> 1) & 0x7F) % 3) << DR7_EN_SHIFT(n);
+	}
+
+	if (anomaly_rand(&st->rng) & 1)
+		cfg->dr7 |= DR7_LE_BIT;
+	if (anomaly_rand(&st->rng) & 1)
+		cfg->dr7 |= DR7_GE_BIT;
+}
+
+/*
+ * Program DR0-DR3/DR7 for the next trial. DR7 is cleared first so moving an
+ * enabled breakpoint to an address its old length does not allow is accepted.
+ */
+static int dr_fuzz_program(pid_t child, const struct dr_config *cfg)
+{
+	if (ptrace_write_debugreg(child, 7, 0) != 0)
+		return -1;
+	for (int n = 0; n < 4; n++) {
+		if (ptrace_write_debugreg(child, n, cfg->addr[n]) != 0)
+			return -1;
+	}
+	if (ptrace_write_debugreg(child, 6, 0) != 0 ||
+	    ptrace_write_debugreg(child, 7, cfg->dr7) != 0)
+		return -1;
+	return 0;
+}
+
+static void dr_fuzz_format(uint64_t dr6, char *buf, size_t size)
+{
+	if (dr6 == 0)
+		snprintf(buf, size, "no #DB");
+	else
+		format_dr6_bits(dr6, buf, size);
+}
+
+static void dr_fuzz_print_config(const struct dr_fuzz_state *st, uint64_t trial,
+				 const struct dr_config *cfg, unsigned int probe_off,
+				 unsigned int intercept, uint64_t expected, uint64_t observed)
+{
+	const uintptr_t buf = (uintptr_t)st->sh->buf;
+	char exp_bits[DR6_BITS_STR_MAX], obs_bits[DR6_BITS_STR_MAX];
+
+	dr_fuzz_format(expected, exp_bits, sizeof(exp_bits));
+	dr_fuzz_format(observed, obs_bits, sizeof(obs_bits));
+	printf("  #%-8" PRIu64 " %-8s probe=+%-2u DR7=0x%08" PRIx64, trial,
+	       anomaly_intercepts[intercept].name, probe_off, cfg->dr7);
+	for (unsigned int n = 0; n < 4; n++) {
+		if (dr7_enabled(cfg->dr7, n))
+			printf(" DR%u=+%" PRIu64 "/%c%u", n, (uint64_t)(cfg->addr[n] - buf),
+			       "xwir"[dr7_rw(cfg->dr7, n)], dr7_len_bytes(cfg->dr7, n));
+	}
+	printf("\n             expected %s, observed %s\n", exp_bits, obs_bits);
+}
+
+static void dr_fuzz_count_pair(struct dr_fuzz_state *st, uint64_t expected, uint64_t observed)
+{
+	unsigned int i;
+
+	for (i = 0; i < st->npairs; i++) {
+		if (st->pairs[i].expected == expected && st->pairs[i].observed == observed)
+			break;
+	}
+	if (i == st->npairs) {
+		if (st->npairs == DR_FUZZ_MAX_PAIRS)
+			return;
+		st->npairs++;
+		st->pairs[i].expected = expected;
+		st->pairs[i].observed = observed;
+	}
+	st->pairs[i].count++;
+}
+
+/* Remember a failing configuration for --corpus unless it is known already */
+static void dr_fuzz_keep(struct dr_fuzz_state *st, const struct trial_record *rec,
+			 const struct dr_config *cfg, unsigned int probe_off)
+{
+	const uintptr_t buf = (uintptr_t)st->sh->buf;
+	struct corpus_entry e = {
+		.dr7 = cfg->dr7,
+		.expected = st->last_expected,
+		.observed = st->last_observed,
+		.probe = (uint8_t)probe_off,
+		.intercept = rec->intercept,
+		.test = ANOMALY_TEST_DR_FUZZ,
+		.cpu = (int32_t)rec->cpu,
+	};
+
+	for (unsigned int n = 0; n < 4; n++)
+		e.addr[n] = (uint8_t)(cfg->addr[n] - buf);
+	for (unsigned int i = 0; i < st->nfound; i++) {
+		if (corpus_entry_same(&st->found[i], &e))
+			return;
+	}
+	if (st->nfound < DR_FUZZ_MAX_CORPUS)
+		st->found[st->nfound++] = e;
+}
+
+/*
+ * Check one trial against the model. Bits the model has no opinion on, Bn of
+ * disabled breakpoints, are masked out of both sides before comparing. A
+ * trial without a #DB is reported with an observed DR6 of zero.
+ */
+static void dr_fuzz_check(struct dr_fuzz_state *st, struct trial_record *rec,
+			  const struct dr_config *cfg, unsigned int probe_off)
+{
+	const uint64_t mask = dr6_model_mask(cfg) | ~(uint64_t)DR6_VOLATILE;
+	const uint64_t expected = dr6_model_read(cfg, (uintptr_t)&st->sh->buf[probe_off], 2, 1);
+	const uint64_t observed = (rec->flags & TRIAL_F_TRAP) ? rec->dr6 : 0;
+
+	if (observed == 0 || !dr6_model_matches(cfg, expected, observed)) {
+		rec->flags |= TRIAL_F_MISMATCH;
+		st->last_expected = expected & mask;
+		st->last_observed = observed & mask;
+		if (st->replay != NULL)
+			st->hits[st->entry]++;
+		else if (st->mismatches < DR_FUZZ_MAX_REPORT)
+			dr_fuzz_print_config(st, rec->trial, cfg, probe_off, rec->intercept,
+					     expected, observed);
+		st->mismatches++;
+		dr_fuzz_count_pair(st, expected & mask, observed & mask);
+		if (st->found != NULL)
+			dr_fuzz_keep(st, rec, cfg, probe_off);
+	}
+	if (st->log != NULL)
+		trial_log_append(st->log, rec);
+}
+
+/*
+ * Draw the next configuration, or take the next one of a replay, and publish
+ * it to the tracee, which must be stopped. The SS selector is copied to wherever the probe now lives.
+ */
+static int dr_fuzz_arm(struct dr_fuzz_state *st, pid_t child, struct dr_config *cfg,
+		       unsigned int *probe_off, unsigned int *intercept)
+{
+	uint16_t ss;
+
+	if (st->replay != NULL) {
+		const struct corpus_entry *const e = &st->replay[st->entry = st->trials / st->repeat];
+
+		corpus_entry_config(e, (uintptr_t)st->sh->buf, cfg);
+		*probe_off = e->probe;
+		*intercept = e->intercept;
+	} else {
+		dr_fuzz_generate(st, cfg, probe_off);
+		*intercept = dr_fuzz_pick_intercept(st);
+	}
+
+	__asm__ __volatile__("movw %%ss, %0" : "=r"(ss));
+	memcpy(&st->sh->buf[*probe_off], &ss, sizeof(ss));
+	st->sh->probe_off = *probe_off;
+	st->sh->intercept = *intercept;
+	return dr_fuzz_program(child, cfg);
+}
+
+/*
+ * Persistent tracee: every configuration is armed while the tracee sits in
+ * the previous trial's #DB stop, so each trial costs one SIGTRAP round trip
+ * plus the DRx pokes instead of a fork.
+ */
+static int dr_fuzz_ptrace(struct dr_fuzz_state *st)
+{
+	struct dr_config cfg;
+	unsigned int probe_off, intercept;
+	uint64_t start_ns = 0;
+	int status = 0;
+	pid_t child = -1;
+	int err = 1;
+
+	st->sh = mmap(NULL, sizeof(*st->sh), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (st->sh == MAP_FAILED) {
+		perror("mmap(dr-fuzz)");
+		return 1;
+	}
+
+	fflush(stdout);
+	child = fork();
+	if (child < 0) {
+		perror("fork");
+		goto out;
+	}
+	if (child == 0)
+		_exit(dr_fuzz_tracee(st->sh));
+
+	if (waitpid(child, &status, 0) < 0 || !WIFSTOPPED(status)) {
+		fprintf(stderr, "dr-fuzz: tracee did not stop as expected\n");
+		goto out;
+	}
+	if (dr_fuzz_arm(st, child, &cfg, &probe_off, &intercept) != 0) {
+		perror("ptrace write DRx");
+		goto out;
+	}
+
+	start_ns = anomaly_now_ns();
+	if (ptrace_continue(child, 0) != 0) {
+		perror("ptrace continue");
+		goto out;
+	}
+
+	for (;;) {
+		if (waitpid(child, &status, 0) < 0) {
+			perror("waitpid(dr-fuzz)");
+			goto out;
+		}
+		if (WIFEXITED(status) || WIFSIGNALED(status))
+			break;
+		else if (!WIFSTOPPED(status))
+			continue;
+
+		if (WSTOPSIG(status) == SIGTRAP && st->trials < st->configs) {
+			const uint64_t tsc = rdtsc();
+			struct user_regs_struct regs;
+			struct trial_record rec = {
+				.tsc = st->sh->tsc,
+				.cpu = st->sh->cpu,
+				.latency = tsc - st->sh->tsc,
+				.dr7 = cfg.dr7,
+				.test = ANOMALY_TEST_DR_FUZZ,
+				.intercept = (uint8_t)intercept,
+				.flags = TRIAL_F_TRAP,
+			};
+
+			if (ptrace_read_debugreg(child, 6, &rec.dr6) != 0 ||
+			    ptrace_read_regs(child, &regs) != 0) {
+				perror("ptrace read DR6");
+				goto out;
+			}
+			rec.rip = regs.rip;
+
+			/*
+			 * More than one trial started since the last stop means
+			 * the earlier ones never trapped, charge them to this
+			 * configuration as lost and resync.
+			 */
+			while (st->sh->started > st->trials + 1 && st->trials + 1 < st->configs) {
+				struct trial_record lost = rec;
+
+				lost.trial = st->trials++;
+				lost.flags = 0;
+				st->lost++;
+				dr_fuzz_check(st, &lost, &cfg, probe_off);
+			}
+			rec.trial = st->trials++;
+			dr_fuzz_check(st, &rec, &cfg, probe_off);
+
+			/* Arm the next configuration, or disarm after the last one */
+			if (st->trials < st->configs) {
+				if (dr_fuzz_arm(st, child, &cfg, &probe_off, &intercept) != 0) {
+					perror("ptrace write DRx");
+					goto out;
+				}
+			} else {
+				st->sh->stop = 1;
+				if (ptrace_write_debugreg(child, 7, 0) != 0) {
+					perror("ptrace clear DR7");
+					goto out;
+				}
+			}
+
+			regs.eflags &= ~0x100; /* TF */
+			if (ptrace_write_regs(child, &regs) != 0 ||
+			    ptrace_continue(child, 0) != 0) {
+				perror("ptrace continue (after trap)");
+				goto out;
+			}
+			continue;
+		}
+
+		/* Any other stop just continue and pass the signal through */
+		if (ptrace_continue(child, WSTOPSIG(status)) != 0) {
+			perror("ptrace continue (pass signal)");
+			goto out;
+		}
+	}
+	st->elapsed_ns = anomaly_now_ns() - start_ns;
+
+	if (st->trials == st->configs) {
+		err = 0;
+	} else {
+		fprintf(stderr, "dr-fuzz: tracee exited after %" PRIu64 " of %" PRIu64 " configurations\n",
+			st->trials, st->configs);
+	}
+	child = -1;
+
+out:
+	if (child > 0) {
+		kill(child, SIGKILL);
+		waitpid(child, NULL, 0);
+	}
+	munmap(st->sh, sizeof(*st->sh));
+	st->sh = NULL;
+	return err;
+}
+
+static void dr_fuzz_report(const struct dr_fuzz_state *st, uint64_t seed)
+{
+	char exp_bits[DR6_BITS_STR_MAX], obs_bits[DR6_BITS_STR_MAX];
+
+	anomaly_print_rate("dr-fuzz", st->trials, st->elapsed_ns);
+	printf("  seed 0x%" PRIx64 ", %" PRIu64 " mismatches", seed, st->mismatches);
+	if (st->lost != 0)
+		printf(" (%" PRIu64 " without a #DB)", st->lost);
+	printf("\n");
+
+	for (unsigned int i = 0; i < st->npairs; i++) {
+		dr_fuzz_format(st->pairs[i].expected, exp_bits, sizeof(exp_bits));
+		dr_fuzz_format(st->pairs[i].observed, obs_bits, sizeof(obs_bits));
+		printf("  %12" PRIu64 "  expected %-12s observed %s\n", st->pairs[i].count,
+		       exp_bits, obs_bits);
+	}
+}
+
+/*
+ * Drive random DR0-DR3/DR7 configurations through the MOV SS + intercept
+ * sequence in one persistent tracee and compare each #DB's DR6 against
+ * dr6_model_read().
+ */
+int anomaly_dr_fuzz(const struct anomaly_options *opts)
+{
+	const uint64_t seed = opts->seed != 0 ? opts->seed : rdtsc() | 1;
+	struct dr_fuzz_state *st;
+	struct trial_log log;
+	int err;
+
+	st = calloc(1, sizeof(*st));
+	if (st == NULL) {
+		perror("alloc dr-fuzz");
+		return ANOMALY_RESULT_FAIL;
+	}
+	st->opts = opts;
+	st->rng = seed;
+	st->configs = opts->iterations_set ? opts->iterations : DR_FUZZ_DEFAULT_CONFIGS;
+
+	/* A faulting intercept discards the pending #DB, leaving nothing to model */
+	for (unsigned int id = 0; id < ANOMALY_INTERCEPT_COUNT; id++) {
+		if (anomaly_intercepts[id].fault_len == 0)
+			st->intercepts |= opts->intercepts & ANOMALY_INTERCEPT_MASK(id);
+	}
+	if (st->intercepts == 0) {
+		fprintf(stderr, "dr-fuzz: no non-faulting intercept selected\n");
+		free(st);
+		return EINVAL;
+	}
+
+	if (opts->all_cpus || opts->backend != ANOMALY_BACKEND_PTRACE)
+		printf("dr-fuzz: only the ptrace backend on one CPU is supported, ignoring --all-cpus/--backend\n");
+
+	if (opts->log_path != NULL) {
+		if (trial_log_create(&log, opts->log_path, st->configs) != 0) {
+			perror(opts->log_path);
+			free(st);
+			return ANOMALY_RESULT_FAIL;
+		}
+		st->log = &log;
+	}
+	if (opts->corpus_path != NULL && (st->found = calloc(DR_FUZZ_MAX_CORPUS, sizeof(*st->found))) == NULL) {
+		perror("alloc corpus");
+		if (st->log != NULL)
+			trial_log_close(st->log);
+		free(st);
+		return ANOMALY_RESULT_FAIL;
+	}
+
+	err = dr_fuzz_ptrace(st);
+	if (!err)
+		dr_fuzz_report(st, seed);
+	if (!err && st->nfound != 0) {
+		size_t added = st->nfound;
+
+		if (corpus_append_new(opts->corpus_path, st->found, &added) != 0) {
+			perror(opts->corpus_path);
+			err = 1;
+		} else {
+			printf("  %zu new failing configurations added to %s\n", added, opts->corpus_path);
+		}
+	}
+
+	if (st->log != NULL)
+		trial_log_close(st->log);
+	err = err ? ANOMALY_RESULT_FAIL :
+	      st->mismatches != 0 ? ANOMALY_RESULT_DETECTED : ANOMALY_RESULT_PASS;
+	free(st->found);
+	free(st);
+	return err;
+}
+
+/*
+ * One thread of a replay, pinned to a CPU with the entries assigned to it.
+ * index maps its entries back to their place in the corpus.
+ */
+struct dr_replay_worker {
+	struct dr_fuzz_state st;
+	pthread_t thread;
+	int cpu;
+	int err;
+	size_t count;
+	struct corpus_entry *entries;
+	size_t *index;
+};
+
+/* The tracee forked next inherits the affinity */
+static void dr_replay_pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		perror("sched_setaffinity");
+}
+
+static void *dr_replay_thread(void *arg)
+{
+	struct dr_replay_worker *const w = arg;
+
+	dr_replay_pin(w->cpu);
+	w->err = dr_fuzz_ptrace(&w->st);
+	return NULL;
+}
+
+/*
+ * Run every entry repeat times, returns the mismatching trials of each in
+ * hits. The caller's affinity is back as it was when it returns.
+ */
+static int dr_replay_run(const struct anomaly_options *opts, const struct corpus_entry *entries,
+			 size_t count, uint64_t repeat, int cpu, uint64_t *hits, struct dr_fuzz_state *st)
+{
+	cpu_set_t old;
+	int err;
+
+	memset(st, 0, sizeof(*st));
+	st->opts = opts;
+	st->replay = entries;
+	st->repeat = repeat;
+	st->configs = count * repeat;
+	st->hits = hits;
+	memset(hits, 0, count * sizeof(*hits));
+	if (cpu >= 0 && sched_getaffinity(0, sizeof(old), &old) != 0) {
+		perror("sched_getaffinity");
+		cpu = -1;
+	}
+	if (cpu >= 0)
+		dr_replay_pin(cpu);
+	err = dr_fuzz_ptrace(st);
+	if (cpu >= 0)
+		sched_setaffinity(0, sizeof(old), &old);
+	return err;
+}
+
+/*
+ * Simplifications of a failing entry tried by the minimizer, from the most to
+ * the least reducing: clearing what disabled breakpoints still hold, dropping
+ * a breakpoint, dropping L or G of one enabled through both, widening one to
+ * 8 bytes, then LE/GE. Writes candidate k to out and returns 0, or returns -1
+ * once k is past the last applicable one.
+ */
+static int dr_replay_candidate(const struct corpus_entry *e, unsigned int k, struct corpus_entry *out)
+{
+	uint64_t unused = 0;
+
+	*out = *e;
+	for (unsigned int n = 0; n < 4; n++) {
+		if (!dr7_enabled(e->dr7, n) && ((e->dr7 & (15ull << DR7_RW_SHIFT(n))) != 0 || e->addr[n] != 0)) {
+			unused |= 15ull << DR7_RW_SHIFT(n);
+			out->addr[n] = 0;
+		}
+	}
+	if (unused != 0 && k-- == 0) {
+		out->dr7 &= ~unused;
+		return 0;
+	}
+	*out = *e;
+	for (unsigned int n = 0; n < 4; n++) {
+		if (dr7_enabled(e->dr7, n) && k-- == 0) {
+			out->dr7 &= ~((3ull << DR7_EN_SHIFT(n)) | (15ull << DR7_RW_SHIFT(n)));
+			out->addr[n] = 0;
+			return 0;
+		}
+	}
+	for (unsigned int n = 0; n < 4; n++) {
+		if (((e->dr7 >> DR7_EN_SHIFT(n)) & 3) == 3 && k-- == 0) {
+			out->dr7 &= ~(2ull << DR7_EN_SHIFT(n));
+			return 0;
+		}
+	}
+	for (unsigned int n = 0; n < 4; n++) {
+		if (dr7_enabled(e->dr7, n) && dr7_rw(e->dr7, n) != DR7_RW_EX &&
+		    dr7_len_bytes(e->dr7, n) != 8 && k-- == 0) {
+			out->dr7 = (out->dr7 & ~(3ull << DR7_LEN_SHIFT(n))) |
+				   (uint64_t)DR7_LEN_8_BYTE << DR7_LEN_SHIFT(n);
+			out->addr[n] &= ~7u;
+			return 0;
+		}
+	}
+	if ((e->dr7 & (DR7_LE_BIT | DR7_GE_BIT)) != 0 && k-- == 0) {
+		out->dr7 &= ~(uint64_t)(DR7_LE_BIT | DR7_GE_BIT);
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Greedily apply the first simplification that still reproduces, until none
+ * does. The result is the smallest configuration that still fails on this
+ * host, not necessarily with the same DR6.
+ */
+static int dr_replay_minimize(const struct anomaly_options *opts, struct corpus_entry *e,
+			      uint64_t repeat, unsigned int *runs)
+{
+	struct dr_fuzz_state *const st = malloc(sizeof(*st));
+	struct corpus_entry candidate;
+	uint64_t hits;
+	unsigned int k = 0;
+
+	if (st == NULL)
+		return -1;
+	while (dr_replay_candidate(e, k, &candidate) == 0) {
+		(*runs)++;
+		if (dr_replay_run(opts, &candidate, 1, repeat, e->cpu, &hits, st) != 0) {
+			free(st);
+			return -1;
+		}
+		if (hits == 0) {
+			k++;
+			continue;
+		}
+		candidate.expected = st->last_expected;
+		candidate.observed = st->last_observed;
+		*e = candidate;
+		k = 0;
+	}
+	free(st);
+	return 0;
+}
+
+/*
+ * --replay: re-run every configuration of a corpus, --iterations times each,
+ * spread over the CPUs in our affinity mask. An entry found on a CPU we may
+ * run on stays on it, the rest are dealt out round robin. With --minimize,
+ * every entry which still reproduces is shrunk afterwards, and the result
+ * added to --corpus when given.
+ */
+int anomaly_dr_replay(const struct anomaly_options *opts, const char *path)
+{
+	const uint64_t repeat = opts->iterations_set ? opts->iterations : ANOMALY_DEFAULT_REPLAY_REPEAT;
+	struct dr_replay_worker *workers = NULL;
+	struct corpus_header header;
+	struct corpus_entry *entries = NULL;
+	uint64_t *hits = NULL, trials = 0, elapsed_ns = 0;
+	size_t count, reproduced = 0;
+	unsigned int nr_cpus, next = 0;
+	cpu_set_t online;
+	int cpus[CPU_SETSIZE];
+	int err = 0;
+
+	if (corpus_load(path, &header, &entries, &count) != 0) {
+		perror(path);
+		return ANOMALY_RESULT_FAIL;
+	}
+	if (sched_getaffinity(0, sizeof(online), &online) != 0) {
+		perror("sched_getaffinity");
+		free(entries);
+		return ANOMALY_RESULT_FAIL;
+	}
+	nr_cpus = 0;
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &online))
+			cpus[nr_cpus++] = cpu;
+	}
+
+	printf("replay: %zu configurations from %s (created on %.48s), %" PRIu64 " trials each\n",
+	       count, path, header.kernel[0] != '\0' ? header.kernel : "unknown kernel", repeat);
+	workers = calloc(nr_cpus, sizeof(*workers));
+	hits = calloc(count + 1, sizeof(*hits));
+	if (workers == NULL || hits == NULL) {
+		perror("alloc replay");
+		err = 1;
+		goto out;
+	}
+
+	/* Deal the entries out, then run every CPU's share in a tracee of its own */
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		workers[i].cpu = cpus[i];
+		workers[i].entries = malloc((count + 1) * sizeof(*workers[i].entries));
+		workers[i].index = malloc((count + 1) * sizeof(*workers[i].index));
+		if (workers[i].entries == NULL || workers[i].index == NULL) {
+			perror("alloc replay");
+			err = 1;
+			goto out;
+		}
+	}
+	for (size_t e = 0; e < count; e++) {
+		struct dr_replay_worker *w = NULL;
+
+		/* A faulting intercept discards the pending #DB, and kills the tracee */
+		if (anomaly_intercepts[entries[e].intercept].fault_len != 0) {
+			printf("  skipped, faulting intercept: ");
+			corpus_entry_print(stdout, &entries[e]);
+			continue;
+		}
+
+		for (unsigned int i = 0; i < nr_cpus && entries[e].cpu >= 0; i++) {
+			if (workers[i].cpu == entries[e].cpu)
+				w = &workers[i];
+		}
+		if (w == NULL)
+			w = &workers[next++ % nr_cpus];
+		w->index[w->count] = e;
+		w->entries[w->count++] = entries[e];
+	}
+
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		struct dr_replay_worker *const w = &workers[i];
+
+		if (w->count == 0)
+			continue;
+		w->st.opts = opts;
+		w->st.replay = w->entries;
+		w->st.repeat = repeat;
+		w->st.configs = w->count * repeat;
+		w->st.hits = calloc(w->count, sizeof(*w->st.hits));
+		if (w->st.hits == NULL || pthread_create(&w->thread, NULL, dr_replay_thread, w) != 0) {
+			perror("replay worker");
+			w->count = 0;
+			err = 1;
+		}
+	}
+	for (unsigned int i = 0; i < nr_cpus; i++) {
+		struct dr_replay_worker *const w = &workers[i];
+
+		if (w->count == 0)
+			continue;
+		pthread_join(w->thread, NULL);
+		err |= w->err;
+		trials += w->st.trials;
+		if (w->st.elapsed_ns > elapsed_ns)
+			elapsed_ns = w->st.elapsed_ns;
+		for (size_t j = 0; j < w->count; j++)
+			hits[w->index[j]] = w->st.hits[j];
+	}
+	if (err)
+		goto out;
+
+	anomaly_print_rate("replay", trials, elapsed_ns);
+	for (size_t e = 0; e < count; e++) {
+		if (hits[e] == 0)
+			continue;
+		reproduced++;
+		printf("  %8" PRIu64 "/%-8" PRIu64 " ", hits[e], repeat);
+		corpus_entry_print(stdout, &entries[e]);
+	}
+	printf("  %zu of %zu configurations reproduce\n", reproduced, count);
+
+	if (opts->minimize && reproduced != 0) {
+		struct corpus_entry *const minimized = malloc(reproduced * sizeof(*minimized));
+		const uint64_t start_ns = anomaly_now_ns();
+		unsigned int runs = 0;
+		size_t nmin = 0;
+
+		if (minimized == NULL) {
+			perror("alloc minimize");
+			err = 1;
+			goto out;
+		}
+		printf("minimize:\n");
+		for (size_t e = 0; e < count; e++) {
+			struct corpus_entry m = entries[e];
+			size_t i;
+
+			if (hits[e] == 0)
+				continue;
+			if (dr_replay_minimize(opts, &m, repeat, &runs) != 0) {
+				err = 1;
+				break;
+			}
+			for (i = 0; i < nmin && !corpus_entry_same(&minimized[i], &m); i++)
+				;
+			if (i != nmin)
+				continue;
+			minimized[nmin++] = m;
+			printf("  ");
+			corpus_entry_print(stdout, &m);
+		}
+		printf("  %zu distinct minimal configurations, %u candidate runs in %.3f s\n", nmin, runs,
+		       (double)(anomaly_now_ns() - start_ns) / 1e9);
+		if (!err && opts->corpus_path != NULL && nmin != 0) {
+			if (corpus_append_new(opts->corpus_path, minimized, &nmin) != 0) {
+				perror(opts->corpus_path);
+				err = 1;
+			} else {
+				printf("  %zu new ones added to %s\n", nmin, opts->corpus_path);
+			}
+		}
+		free(minimized);
+	}
+
+out:
+	for (unsigned int i = 0; workers != NULL && i < nr_cpus; i++) {
+		free(workers[i].st.hits);
+		free(workers[i].entries);
+		free(workers[i].index);
+	}
+	free(workers);
+	free(hits);
+	free(entries);
+	if (err)
+		return ANOMALY_RESULT_FAIL;
+	return reproduced != 0 ? ANOMALY_RESULT_DETECTED : ANOMALY_RESULT_PASS;
+}
@@ -0,0 +1,253 @@
+/*
+ * Background noise generators stressing exit-handling races.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef NOISE_H
+#define NOISE_H 1
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/membarrier.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/**
+ * Whether a trial's #DB survives depends on what else reaches its vCPU
+ * between the intercept's exit and the #DB injection. Each generator runs
+ * one thread pinned to every CPU in our affinity mask:
+ * - timer: a POSIX timer signalling its thread every NOISE_TIMER_NS, so the
+ *          CPU takes a timer interrupt and a wakeup at that rate
+ * - ipi:   MEMBARRIER_CMD_GLOBAL_EXPEDITED back to back, which IPIs every
+ *          CPU running a registered process: us and every tracee we fork
+ * - yield: sched_yield() back to back, always runnable next to the trials
+ * - fault: mapping, touching and unmapping NOISE_FAULT_PAGES pages, page
+ *          faults here and TLB shootdowns to our other CPUs
+ */
+#define NOISE_TIMER_NS          20000
+#define NOISE_FAULT_PAGES       16
+
+struct noise_thread {
+	pthread_t thread;
+	int cpu;
+	unsigned int kind;                      /* enum anomaly_noise */
+	uint64_t events;                        /* Signals, IPI rounds, yields or pages faulted */
+	const volatile int *stop;
+} __attribute__((aligned(ANOMALY_CACHE_LINE)));
+
+struct noise {
+	volatile int stop;
+	unsigned int nr;
+	unsigned int cpus;                      /* CPUs each generator runs on */
+	struct noise_thread *threads;
+	uint64_t start_ns;
+	uint64_t elapsed_ns;
+	uint64_t events[ANOMALY_NOISE_COUNT];
+};
+
+static inline long noise_membarrier(int cmd)
+{
+	return syscall(SYS_membarrier, cmd, 0, 0);
+}
+
+/*
+ * Opt in to the ipi generator's IPIs. The registration is inherited by
+ * fork(), so it has to happen before any tracee is forked.
+ */
+static inline int noise_register(void)
+{
+	return noise_membarrier(MEMBARRIER_CMD_REGISTER_GLOBAL_EXPEDITED) == 0 ? 0 : -1;
+}
+
+static void noise_timer(struct noise_thread *t)
+{
+	const struct itimerspec its = {
+		.it_interval = { .tv_nsec = NOISE_TIMER_NS },
+		.it_value = { .tv_nsec = NOISE_TIMER_NS },
+	};
+	struct sigevent sev = { 0 };
+	sigset_t set;
+	timer_t timer;
+
+	/* Directed at this thread alone, which already blocks every signal */
+	sigemptyset(&set);
+	sigaddset(&set, SIGRTMIN);
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGRTMIN;
+	sev._sigev_un._tid = (pid_t)syscall(SYS_gettid);
+	if (timer_create(CLOCK_MONOTONIC, &sev, &timer) != 0) {
+		perror("timer_create(noise)");
+		return;
+	}
+	timer_settime(timer, 0, &its, NULL);
+	while (!*t->stop) {
+		if (sigwaitinfo(&set, NULL) > 0)
+			t->events++;
+	}
+	timer_delete(timer);
+}
+
+static void noise_fault(struct noise_thread *t)
+{
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	while (!*t->stop) {
+		volatile char *const p = mmap(NULL, NOISE_FAULT_PAGES * page, PROT_READ | PROT_WRITE,
+					      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (p == MAP_FAILED) {
+			perror("mmap(noise)");
+			return;
+		}
+		for (size_t i = 0; i < NOISE_FAULT_PAGES; i++)
+			p[i * page] = 1;
+		munmap((void *)p, NOISE_FAULT_PAGES * page);
+		t->events += NOISE_FAULT_PAGES;
+	}
+}
+
+static void *noise_thread(void *arg)
+{
+	struct noise_thread *const t = arg;
+
+	switch (t->kind) {
+	case ANOMALY_NOISE_TIMER:
+		noise_timer(t);
+		break;
+	case ANOMALY_NOISE_IPI:
+		while (!*t->stop && noise_membarrier(MEMBARRIER_CMD_GLOBAL_EXPEDITED) == 0)
+			t->events++;
+		break;
+	case ANOMALY_NOISE_YIELD:
+		while (!*t->stop) {
+			sched_yield();
+			t->events++;
+		}
+		break;
+	case ANOMALY_NOISE_FAULT:
+		noise_fault(t);
+		break;
+	}
+	return NULL;
+}
+
+static inline void noise_stop(struct noise *n)
+{
+	n->stop = 1;
+	for (unsigned int i = 0; i < n->nr; i++) {
+		pthread_join(n->threads[i].thread, NULL);
+		n->events[n->threads[i].kind] += n->threads[i].events;
+	}
+	if (n->threads != NULL)
+		n->elapsed_ns = anomaly_now_ns() - n->start_ns;
+	free(n->threads);
+	n->threads = NULL;
+	n->nr = 0;
+}
+
+/*
+ * Start the generators in mask on every CPU in our affinity mask. Their
+ * threads block every signal, a process-directed one such as the tracer's
+ * SIGCHLD must never be taken by one of them.
+ */
+static inline int noise_start(struct noise *n, uint32_t mask)
+{
+	const unsigned int kinds = (unsigned int)__builtin_popcount(mask);
+	sigset_t all, old;
+	cpu_set_t online;
+	int err = 0;
+
+	memset(n, 0, sizeof(*n));
+	if (mask == 0)
+		return 0;
+	if (sched_getaffinity(0, sizeof(online), &online) != 0) {
+		perror("sched_getaffinity");
+		return -1;
+	}
+	n->cpus = (unsigned int)CPU_COUNT(&online);
+	n->threads = aligned_alloc(ANOMALY_CACHE_LINE, (size_t)n->cpus * kinds * sizeof(*n->threads));
+	if (n->threads == NULL) {
+		perror("alloc noise");
+		return -1;
+	}
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	n->start_ns = anomaly_now_ns();
+	for (int cpu = 0; cpu < CPU_SETSIZE && err == 0; cpu++) {
+		cpu_set_t set;
+
+		if (!CPU_ISSET(cpu, &online))
+			continue;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		for (unsigned int kind = 0; kind < ANOMALY_NOISE_COUNT && err == 0; kind++) {
+			struct noise_thread *const t = &n->threads[n->nr];
+			pthread_attr_t attr;
+
+			if ((mask & ANOMALY_NOISE_MASK(kind)) == 0)
+				continue;
+			memset(t, 0, sizeof(*t));
+			t->cpu = cpu;
+			t->kind = kind;
+			t->stop = &n->stop;
+			pthread_attr_init(&attr);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+			err = pthread_create(&t->thread, &attr, noise_thread, t);
+			pthread_attr_destroy(&attr);
+			if (err != 0) {
+				errno = err;
+				perror("pthread_create(noise)");
+			} else {
+				n->nr++;
+			}
+		}
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err != 0) {
+		noise_stop(n);
+		return -1;
+	}
+	return 0;
+}
+
+/* Rate of every generator that ran, per CPU */
+static inline void noise_print(const struct noise *n, uint32_t mask)
+{
+	if (mask == 0 || n->elapsed_ns == 0)
+		return;
+	printf("noise:");
+	for (unsigned int kind = 0; kind < ANOMALY_NOISE_COUNT; kind++) {
+		if ((mask & ANOMALY_NOISE_MASK(kind)) != 0)
+			printf(" %s %.0f/s", anomaly_noise_names[kind],
+			       (double)n->events[kind] * 1e9 / (double)n->elapsed_ns / (double)n->cpus);
+	}
+	printf(" per CPU\n");
+}
+
+#endif /* NOISE_H */
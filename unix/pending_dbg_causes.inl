@@ -24,175 +24,2116 @@
 
 
 #include "ptrace.h"
+#include "noise.h"
+#include "perf_event.h"
+#include "placement.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "trace.h"
+#include "tracee_pool.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
 #include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <ucontext.h>
 
-static uint16_t ss_probe = 0;
+/* DR7 = L0|G0|RW=read/write|LEN=2 bytes */
+#define PENDING_DBG_CAUSES_DR7  (DR7_L0_BIT | DR7_G0_BIT | DR7_RW0_DATA_RW | DR7_LEN0_2_BYTE)
 
-static int trigger_pending_dbg_causes_bug(int pipefd)
+/* What the tracee knows about one of its trials */
+struct pending_dbg_causes_trial {
+	uint64_t seq;                           /* Trial index */
+	uint64_t tsc;                           /* TSC at trial start */
+	uint64_t end_tsc;                       /* TSC once resumed after the trial's #DB */
+	uint32_t cpu;                           /* CPU at trial start */
+	uint32_t end_cpu;                       /* CPU at trial end */
+	uint16_t simd[SIMD_MAX_REGS];           /* With --simd, lanes of each register still intact */
+};
+
+#define PDC_RING_SLOTS          256     /* Power of two */
+
+/*
+ * Single-producer, single-consumer ring carrying trial results from the
+ * tracee to the tracer without any syscalls, in a mapping shared before the
+ * tracee runs. The tracee fills the slot at tail while its trial runs and
+ * publishes it by advancing tail once the trial is over, so a tracer looking
+ * at a stopped tracee finds the trial in flight at tail. The tracer consumes
+ * from head and posts back how many trials the tracee may start in limit.
+ * Each side only writes its own cache line. The tracee never waits for the
+ * tracer: with the ring full a trial goes unpublished and is only counted.
+ */
+struct pending_dbg_causes_ring {
+	/* Tracee (producer) */
+	uint64_t tail __attribute__((aligned(ANOMALY_CACHE_LINE)));
+	uint64_t started;                       /* Trials started so far */
+	uint64_t dropped;                       /* Trials not published, the ring was full */
+	/* Tracer (consumer) */
+	uint64_t head __attribute__((aligned(ANOMALY_CACHE_LINE)));
+	uint64_t limit;                         /* Trials the tracee may start, lowered to stop */
+	struct pending_dbg_causes_trial slots[PDC_RING_SLOTS] __attribute__((aligned(ANOMALY_CACHE_LINE)));
+};
+
+/*
+ * Latencies collected per trial, all in TSC cycles:
+ * - window:     trial start to the tracee resuming after the #DB
+ * - delivery:   trial start to the #DB reaching the handler or tracer
+ * - round trip: one complete trial as seen by the driving side
+ * - baseline:   MOV SS + intercept without TF or a watchpoint armed
+ */
+enum {
+	PDC_LAT_WINDOW,
+	PDC_LAT_DELIVERY,
+	PDC_LAT_ROUND_TRIP,
+	PDC_LAT_BASELINE,
+	PDC_LAT_COUNT
+};
+
+static const char *const pdc_lat_names[PDC_LAT_COUNT] = {
+	"mov ss + intercept", "#DB delivery", "round trip", "baseline (no TF/bp)",
+};
+
+/*
+ * Phases of the harness counted by --profile, on the tracer (ptrace) or the
+ * trial thread (perf):
+ * - setup:            tracee fork/handout and event loop creation
+ * - DR programming:   writing DR0/DR7 through ptrace or perf
+ * - run to trap:      from resuming the trial until its #DB is back with us
+ * - register cleanup: reading DR6/RIP, clearing TF and DR6, bookkeeping
+ * - teardown:         reaping tracees and releasing their resources
+ */
+enum {
+	PDC_PHASE_SETUP,
+	PDC_PHASE_DR,
+	PDC_PHASE_RUN,
+	PDC_PHASE_CLEANUP,
+	PDC_PHASE_TEARDOWN,
+	PDC_PHASE_COUNT
+};
+
+static const char *const pdc_phase_names[PDC_PHASE_COUNT] = {
+	"setup", "DR programming", "run to trap", "register cleanup", "teardown",
+};
+
+/* Counters of the single thread driving trials, NULL without --profile */
+static struct profile *pdc_profile;
+
+/*
+ * With --snapshot, a trial whose DR6 misses B0 or BS gets the tracee's full
+ * state written out while it is still stopped at the #DB. Capped at
+ * ANOMALY_SNAPSHOT_MAX per intercept, an affected platform would otherwise
+ * fill the disk.
+ */
+#define PDC_EXPECTED_DR6        (DR6_RESERVED | DR6_BS_BIT | DR6_B0_BIT)
+
+/* Directory snapshots are written to, NULL without --snapshot */
+static const char *pdc_snapshot_dir;
+
+/* Snapshots written for the intercept being run */
+static unsigned int pdc_snapshots;
+
+/*
+ * Vector registers checked across every trial with --simd, SIMD_NONE
+ * without. Set before any tracee is forked, which inherit it.
+ */
+static enum simd_width pdc_simd;
+
+/*
+ * Probe layout of the --placement pass being run, NULL for the worker's own
+ * probe. Tracees forked earlier by a --zygote pool get it through their job.
+ */
+static const struct placement *pdc_placement;
+
+/*
+ * A trial is disturbed when its vCPU was moved or held up between the MOV SS
+ * and the #DB, where the pending debug state is most at risk: the CPU it
+ * started on is not the one it reached the #DB path on, or it took more than
+ * PDC_DISTURB_FACTOR times the quickest trial of its worker so far.
+ */
+#define PDC_DISTURB_FACTOR      8
+
+struct pending_dbg_causes_disturb {
+	uint64_t trials;                        /* Trials classified */
+	uint64_t anomalies;                     /* Of which anomalous */
+	uint64_t disturbed;
+	uint64_t disturbed_anomalies;
+	uint64_t migrated;                      /* Disturbed by a CPU change */
+	uint64_t min_cycles;                    /* Quickest trial so far, 0 before the first */
+};
+
+/* Trials run and anomalies counted against the platform by an intercept's pass */
+struct pending_dbg_causes_tally {
+	uint64_t trials;
+	uint64_t anomalies;
+	uint64_t dr6;                           /* Latest anomalous DR6 of any worker, 0 if none trapped */
+	struct dr6_hist hist;
+	struct latency_hist window;             /* PDC_LAT_WINDOW of every worker */
+};
+
+/*
+ * ptrace: what the tracer made of a trial at its #DB, kept until the tracee
+ * publishes the trial's end and it can be classified.
+ */
+struct pending_dbg_causes_outcome {
+	uint64_t seq;                           /* Trial index plus one, 0 for an empty entry */
+	uint64_t log_idx;                       /* Its trial log record */
+	int anomalous;
+};
+
+/*
+ * Per-worker trial state. Every worker owns its probe and result counters,
+ * aligned to their own cache lines so parallel workers never contend.
+ */
+struct pending_dbg_causes_worker {
+	uint16_t probe;                         /* Watched by DR0, holds the SS selector */
+	int cpu;                                /* CPU the worker is pinned to, -1 if unpinned */
+	unsigned int index;                     /* Tracee number on its CPU in --tracees mode */
+	pid_t pid;                              /* ptrace: process running the trials, for --trace */
+	pid_t tid;                              /* Traced thread in --threads mode, 0 otherwise */
+	int err;
+	unsigned int intercept;                 /* Intercepting instruction used by the trial */
+	uint64_t dr6;                           /* Last observed DR6 */
+	uint64_t anomaly_dr6;                   /* Last DR6 that missed B0 or BS, 0 if none did */
+	uint64_t traps;
+	uint64_t faults;                        /* Intercepting instruction faulted and was skipped */
+	uint64_t anomalies;                     /* Trials whose DR6 missed B0 or BS, or never trapped */
+	uint64_t budget;                        /* Maximum number of trials */
+	uint64_t trials;                        /* Trials actually run */
+	int stop;                               /* Adaptive run reached a decision */
+	int armed;                              /* ptrace: DR0/DR7 still programmed */
+	int faulted;                            /* ptrace: the current trial's intercept faulted */
+	uint64_t resume_tsc;                    /* ptrace: TSC when the tracee was last resumed */
+	uint64_t hangs;                         /* ptrace: trials the watchdog killed */
+	int exited;                             /* --threads: the trial thread is gone */
+	uint64_t progress;                      /* ptrace: trials started plus stops, as last seen */
+	uint64_t progress_ns;                   /* ptrace: when the watchdog last saw progress */
+	uint64_t start_ns;
+	uint64_t elapsed_ns;
+	const struct anomaly_options *opts;
+	struct tracee_pool *pool;               /* ptrace: where tracees come from */
+	struct tracee tracee;                   /* ptrace: the worker's tracee until it is reaped */
+	struct pending_dbg_causes_ring *ring;   /* Shared with the tracee, NULL for perf */
+	struct trial_log *log;                  /* Optional binary trial log */
+	struct dr6_hist hist;
+	struct latency_hist lat[PDC_LAT_COUNT];
+	struct sprt sprt;
+	struct pending_dbg_causes_disturb disturb;
+	struct simd_damage simd;
+	uint64_t log_idx;                       /* Last record appended to the trial log */
+	struct pending_dbg_causes_outcome outcomes[PDC_RING_SLOTS];
+} __attribute__((aligned(ANOMALY_CACHE_LINE)));
+
+/*
+ * Trial loop run inside the tracee. DR0/DR7 stay armed for the whole batch,
+ * the tracer only collects DR6 and clears TF after each trial's #DB, and ends
+ * an adaptive batch early by lowering the ring's limit.
+ */
+static void pending_dbg_causes_tracee_loop(struct pending_dbg_causes_ring *ring, unsigned int intercept,
+					   uint16_t *probe, void (*trial)(uint16_t *probe))
+{
+	for (uint64_t i = 0; i < __atomic_load_n(&ring->limit, __ATOMIC_RELAXED); i++) {
+		const uint64_t tail = ring->tail;
+		struct pending_dbg_causes_trial *const t = &ring->slots[tail % PDC_RING_SLOTS];
+		uint32_t aux;
+
+		t->seq = i;
+		t->tsc = rdtscp_serialized(&aux);
+		t->cpu = TSC_AUX_CPU(aux);
+		__atomic_store_n(&ring->started, i + 1, __ATOMIC_RELAXED);
+		if (pdc_simd != SIMD_NONE)
+			simd_trial(intercept, pdc_simd, i, probe, t->simd);
+		else
+			trial(probe);
+		t->end_tsc = rdtscp_serialized(&aux);
+		t->end_cpu = TSC_AUX_CPU(aux);
+
+		/* Keep a slot free, the next trial fills it before publishing */
+		if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) < PDC_RING_SLOTS - 1)
+			__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+		else
+			ring->dropped++;
+	}
+}
+
+/* The trial in flight, only stable while the tracee is stopped */
+static inline const struct pending_dbg_causes_trial *
+pending_dbg_causes_current(const struct pending_dbg_causes_ring *ring)
+{
+	return &ring->slots[__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) % PDC_RING_SLOTS];
+}
+
+static inline void pending_dbg_causes_stop(struct pending_dbg_causes_ring *ring)
+{
+	__atomic_store_n(&ring->limit, 0, __ATOMIC_RELAXED);
+}
+
+/*
+ * Judge a trial from the CPU and TSC read right before its MOV SS and again on
+ * its #DB path. Returns 0 when undisturbed, 1 when it stalled and 2 when it
+ * migrated.
+ */
+static int pending_dbg_causes_disturbed(struct pending_dbg_causes_disturb *d, uint32_t cpu, uint64_t tsc,
+					uint32_t db_cpu, uint64_t db_tsc)
+{
+	const uint64_t cycles = db_tsc - tsc;
+	const int stalled = d->min_cycles != 0 && cycles > d->min_cycles * PDC_DISTURB_FACTOR;
+
+	if (d->min_cycles == 0 || cycles < d->min_cycles)
+		d->min_cycles = cycles != 0 ? cycles : 1;
+	return cpu != db_cpu ? 2 : stalled;
+}
+
+static void pending_dbg_causes_classify(struct pending_dbg_causes_disturb *d, int disturbed, int anomalous)
+{
+	d->trials++;
+	d->anomalies += anomalous != 0;
+	if (disturbed) {
+		d->disturbed++;
+		d->disturbed_anomalies += anomalous != 0;
+		d->migrated += disturbed == 2;
+	}
+}
+
+static void pending_dbg_causes_disturb_merge(struct pending_dbg_causes_disturb *dst,
+					     const struct pending_dbg_causes_disturb *src)
+{
+	dst->trials += src->trials;
+	dst->anomalies += src->anomalies;
+	dst->disturbed += src->disturbed;
+	dst->disturbed_anomalies += src->disturbed_anomalies;
+	dst->migrated += src->migrated;
+}
+
+static void pending_dbg_causes_disturb_print(const struct pending_dbg_causes_disturb *d)
+{
+	const uint64_t clean = d->trials - d->disturbed;
+
+	if (d->trials == 0)
+		return;
+	printf("  %12" PRIu64 " trials disturbed (%" PRIu64 " migrated), anomaly rate %.4f%% disturbed"
+	       " vs %.4f%% clean\n", d->disturbed, d->migrated,
+	       d->disturbed != 0 ? 100.0 * (double)d->disturbed_anomalies / (double)d->disturbed : 0.0,
+	       clean != 0 ? 100.0 * (double)(d->anomalies - d->disturbed_anomalies) / (double)clean : 0.0);
+}
+
+/*
+ * Consume every trial the tracee published since the last call. Its end is
+ * the tracee's first look at the CPU and TSC after the #DB, which completes
+ * the trial's classification and tags its log record.
+ */
+static void pending_dbg_causes_drain(struct pending_dbg_causes_worker *w)
+{
+	struct pending_dbg_causes_ring *const ring = w->ring;
+	const uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	uint64_t head = ring->head;
+
+	for (; head != tail; head++) {
+		const struct pending_dbg_causes_trial *const t = &ring->slots[head % PDC_RING_SLOTS];
+		struct pending_dbg_causes_outcome *const o = &w->outcomes[t->seq % PDC_RING_SLOTS];
+		const int trapped = o->seq == t->seq + 1;
+		const int disturbed = pending_dbg_causes_disturbed(&w->disturb, t->cpu, t->tsc,
+								   t->end_cpu, t->end_tsc);
+
+		latency_add(&w->lat[PDC_LAT_WINDOW], t->end_tsc - t->tsc);
+		if (trace_enabled)
+			trace_record(TRACE_TRIAL, t->tsc, t->end_tsc, w->pid, w->tid != 0 ? w->tid : w->pid, t->seq);
+
+		/* A trial which never reached the tracer had no #DB, that is anomalous */
+		pending_dbg_causes_classify(&w->disturb, disturbed, trapped ? o->anomalous : 1);
+		if (disturbed && trapped && w->log != NULL)
+			trial_log_tag(w->log, o->log_idx, TRIAL_F_DISTURBED);
+		if (pdc_simd != SIMD_NONE && simd_damage_add(&w->simd, pdc_simd, t->simd) &&
+		    trapped && w->log != NULL)
+			trial_log_tag(w->log, o->log_idx, TRIAL_F_SIMD);
+		o->seq = 0;
+	}
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * Shared with a tracee from the pool: what its trial loop needs and the probe
+ * DR0 watches, at the same address in both processes.
+ */
+struct pending_dbg_causes_job {
+	struct pending_dbg_causes_ring ring;
+	unsigned int intercept;
+	const struct placement *placement;      /* --placement layout, NULL for probe below */
+	uint16_t probe __attribute__((aligned(ANOMALY_CACHE_LINE)));
+};
+
+/* The job of a tracee running its trial loop on a placement's stack */
+static struct pending_dbg_causes_job *pdc_stack_job;
+
+static void pending_dbg_causes_stack_loop(void)
+{
+	struct pending_dbg_causes_job *const job = pdc_stack_job;
+
+	pending_dbg_causes_tracee_loop(&job->ring, job->intercept, job->placement->probe,
+				       job->placement->trials[job->intercept]);
+}
+
+static int trigger_pending_dbg_causes_bug(void *arg)
+{
+	struct pending_dbg_causes_job *const job = arg;
+	const struct placement *const p = job->placement;
+	ucontext_t caller, loop;
+
+	if (p == NULL) {
+		pending_dbg_causes_tracee_loop(&job->ring, job->intercept, &job->probe,
+					       anomaly_intercepts[job->intercept].trial);
+		return 0;
+	}
+	if (p->stack == NULL) {
+		pending_dbg_causes_tracee_loop(&job->ring, job->intercept, p->probe, p->trials[job->intercept]);
+		return 0;
+	}
+
+	/* Run the loop right under the probe at the top of the placement's stack */
+	pdc_stack_job = job;
+	getcontext(&loop);
+	loop.uc_stack.ss_sp = p->stack;
+	loop.uc_stack.ss_size = p->stack_size;
+	loop.uc_link = &caller;
+	makecontext(&loop, pending_dbg_causes_stack_loop, 0);
+	swapcontext(&caller, &loop);
+	return 0;
+}
+
+/*
+ * Feed one trial into an adaptive run's SPRT and flag the worker to stop once
+ * it has decided.
+ */
+static void pending_dbg_causes_observe(struct pending_dbg_causes_worker *w, int anomalous)
+{
+	if (sprt_update(&w->sprt, anomalous) != SPRT_CONTINUE)
+		w->stop = 1;
+}
+
+static int pending_dbg_causes_record(struct pending_dbg_causes_worker *w,
+				     const struct trial_record *rec)
+{
+	int anomalous = !(rec->flags & TRIAL_F_TRAP);
+
+	if (w->opts->adaptive) {
+		/* Trials skipped since the last record never raised a #DB */
+		while (w->sprt.trials < rec->trial && !w->stop)
+			pending_dbg_causes_observe(w, 1);
+	}
+
+	if (rec->flags & TRIAL_F_TRAP) {
+		w->dr6 = rec->dr6;
+		w->traps++;
+		dr6_hist_add(&w->hist, rec->dr6);
+		latency_add(&w->lat[PDC_LAT_DELIVERY], rec->latency);
+
+		/* A faulting intercept discards the pending #DB, nothing to expect */
+		if (!(rec->flags & TRIAL_F_FAULT) &&
+		    (rec->dr6 & (DR6_B0_BIT | DR6_BS_BIT)) != (DR6_B0_BIT | DR6_BS_BIT)) {
+			w->anomalies++;
+			w->anomaly_dr6 = rec->dr6;
+			anomalous = 1;
+		}
+	}
+	if (rec->flags & TRIAL_F_FAULT)
+		w->faults++;
+	if (w->log != NULL)
+		w->log_idx = trial_log_append(w->log, rec);
+	if (w->opts->adaptive && !w->stop)
+		pending_dbg_causes_observe(w, anomalous);
+	return anomalous;
+}
+
+/*
+ * Anomalies that count against the platform. An adaptive run which decided
+ * the worker is clean tolerates a rate below p0.
+ */
+static uint64_t pending_dbg_causes_verdict(const struct pending_dbg_causes_worker *w)
+{
+	if (w->opts->adaptive && w->sprt.decision == SPRT_CLEAN)
+		return w->simd.corrupt;
+	return w->anomalies + w->simd.corrupt;
+}
+
+static void pending_dbg_causes_tally(struct pending_dbg_causes_tally *tally,
+				     const struct pending_dbg_causes_worker *w)
+{
+	tally->trials += w->trials;
+	tally->anomalies += pending_dbg_causes_verdict(w);
+	dr6_hist_merge(&tally->hist, &w->hist);
+	latency_merge(&tally->window, &w->lat[PDC_LAT_WINDOW]);
+	if (w->anomaly_dr6 != 0 && pending_dbg_causes_verdict(w) != 0)
+		tally->dr6 = w->anomaly_dr6;
+}
+
+static void pending_dbg_causes_print_latency(const struct latency_hist *lat)
+{
+	latency_print_header();
+	for (unsigned int i = 0; i < PDC_LAT_COUNT; i++)
+		latency_print(pdc_lat_names[i], &lat[i]);
+}
+
+static void pending_dbg_causes_report(struct pending_dbg_causes_worker *w)
+{
+	const int single = w->cpu < 0 && w->tid == 0 && w->opts->tracees <= 1;
+	char name[32];
+
+	if (w->hangs != 0 && w->budget == 1 && single) {
+		printf("    Trial hung, tracee killed after %u ms\n", w->opts->timeout_ms);
+		return;
+	}
+
+	if (w->traps == 0 && single) {
+		printf("    No SIGTRAP/#DB observed (unexpected)\n");
+		return;
+	}
+
+	if (w->budget == 1 && single) {
+		print_dr6(w->dr6);
+		return;
+	}
+
+	if (w->tid != 0)
+		snprintf(name, sizeof(name), "thread %d", (int)w->tid);
+	else if (w->opts->tracees > 1 && w->cpu < 0)
+		snprintf(name, sizeof(name), "tracee %u", w->index);
+	else if (w->opts->tracees > 1)
+		snprintf(name, sizeof(name), "CPU %d tracee %u", w->cpu, w->index);
+	else if (w->cpu < 0)
+		snprintf(name, sizeof(name), "pending-dbg-causes");
+	else
+		snprintf(name, sizeof(name), "CPU %d", w->cpu);
+	anomaly_print_rate(name, w->trials, w->elapsed_ns);
+	dr6_hist_print(&w->hist);
+	if (w->faults != 0)
+		printf("  %12" PRIu64 " faults on %s skipped\n", w->faults,
+		       anomaly_intercepts[w->intercept].name);
+	if (w->anomalies != 0)
+		printf("  %12" PRIu64 " anomalous trials (DR6 missing B0 or BS)\n", w->anomalies);
+	if (w->hangs != 0)
+		printf("  %12" PRIu64 " trials hung, tracee killed after %u ms\n", w->hangs, w->opts->timeout_ms);
+	pending_dbg_causes_disturb_print(&w->disturb);
+	simd_damage_print(&w->simd, pdc_simd);
+	if (w->opts->adaptive)
+		sprt_print(&w->sprt, w->budget);
+	if (w->opts->latency)
+		pending_dbg_causes_print_latency(w->lat);
+}
+
+/*
+ * Program the watchpoint on a stopped traced thread.
+ * DR0 = probe addr, rounded down to the alignment LEN=2 requires
+ * DR7 = L0|G0|RW=read/write|LEN=2 bytes
+ */
+static int pending_dbg_causes_ptrace_arm(pid_t tid, uintptr_t addr)
+{
+	if (ptrace_write_debugreg(tid, 0, (uint64_t)addr & ~1ull) != 0 ||
+	    ptrace_write_debugreg(tid, 6, 0) != 0 ||
+	    ptrace_write_debugreg(tid, 7, PENDING_DBG_CAUSES_DR7) != 0) {
+		perror("ptrace write DRx");
+		return -1;
+	}
+	return 0;
+}
+
+static void pending_dbg_causes_snapshot(pid_t tid, const struct trial_record *rec,
+				       const struct user_regs_struct *regs)
+{
+	char path[PATH_MAX];
+
+	if (__atomic_fetch_add(&pdc_snapshots, 1, __ATOMIC_RELAXED) >= ANOMALY_SNAPSHOT_MAX)
+		return;
+	if (snapshot_write(pdc_snapshot_dir, "pending-dbg-causes", tid, rec, PDC_EXPECTED_DR6, regs,
+			   path, sizeof(path)) != 0)
+		perror(path);
+	else
+		fprintf(stderr, "Anomalous trial %" PRIu64 " snapshot written to %s\n", rec->trial, path);
+}
+
+/*
+ * Service one trial's SIGTRAP stop of a traced thread: collect DR6 and RIP,
+ * clear TF, and disarm the watchpoint once the worker's last trial has
+ * trapped. DR6 is left alone, the kernel rebuilds it on the next #DB. The
+ * thread is left stopped for the caller to resume.
+ */
+static int pending_dbg_causes_ptrace_trap(struct pending_dbg_causes_worker *w, pid_t tid)
+{
+	const uint64_t tsc = rdtsc();
+	const uint64_t trace_start = trace_begin();
+	const struct pending_dbg_causes_trial *const trial = pending_dbg_causes_current(w->ring);
+	struct user_regs_struct regs;
+	int anomalous;
+	struct trial_record rec = {
+		.trial = trial->seq,
+		.tsc = trial->tsc,
+		.cpu = trial->cpu,
+		.latency = tsc - trial->tsc,
+		.dr7 = PENDING_DBG_CAUSES_DR7,
+		.test = ANOMALY_TEST_PENDING_DBG_CAUSES,
+		.intercept = (uint8_t)w->intercept,
+		.flags = TRIAL_F_TRAP | (w->faulted ? TRIAL_F_FAULT : 0),
+	};
+
+	pending_dbg_causes_drain(w);
+
+	/* Read DR6 from ptrace */
+	if (ptrace_read_debugreg(tid, 6, &rec.dr6) != 0) {
+		perror("ptrace read DR6");
+		return -1;
+	}
+
+	if (ptrace_read_regs(tid, &regs) != 0) {
+		perror("PTRACE_GETREGS");
+		return -1;
+	}
+	rec.rip = regs.rip;
+
+	/* Classified once the tracee publishes where and when it resumed */
+	anomalous = pending_dbg_causes_record(w, &rec);
+	w->outcomes[rec.trial % PDC_RING_SLOTS] = (struct pending_dbg_causes_outcome){
+		.seq = rec.trial + 1,
+		.anomalous = anomalous,
+		.log_idx = w->log_idx,
+	};
+	w->faulted = 0;
+
+	/* Only now, with the stop known to be worth it, is the rest of the state read */
+	if (anomalous && pdc_snapshot_dir != NULL)
+		pending_dbg_causes_snapshot(tid, &rec, &regs);
+
+	/*
+	 * Clear TF in RFLAGS, DR0/DR7 stay armed for the next trial. DR6 as
+	 * ptrace sees it is rebuilt by the kernel on every #DB from user mode,
+	 * so it needs no reset of our own.
+	 */
+	regs.eflags &= ~0x100; /* TF */
+	if (ptrace_write_regs(tid, &regs) != 0) {
+		perror("ptrace clear TF");
+		return -1;
+	}
+
+	/* Previous resume to this trial's trap serviced */
+	rec.latency = rdtsc();
+	latency_add(&w->lat[PDC_LAT_ROUND_TRIP], rec.latency - w->resume_tsc);
+	w->resume_tsc = rec.latency;
+
+	/* Disarm the watchpoint once the last trial has trapped */
+	if (w->traps == w->budget || w->stop) {
+		pending_dbg_causes_stop(w->ring);
+		w->armed = 0;
+		profile_enter(pdc_profile, PDC_PHASE_DR);
+		if (ptrace_write_debugreg(tid, 0, 0) != 0 ||
+		    ptrace_write_debugreg(tid, 7, 0) != 0) {
+			perror("ptrace clear DRx");
+			return -1;
+		}
+		profile_enter(pdc_profile, PDC_PHASE_CLEANUP);
+	}
+	trace_end(TRACE_DB, trace_start, rec.trial);
+	return 0;
+}
+
+/* Step over an intercepting instruction which faults at CPL3. */
+static int pending_dbg_causes_ptrace_fault(struct pending_dbg_causes_worker *w, pid_t tid)
+{
+	struct user_regs_struct regs;
+
+	if (ptrace_read_regs(tid, &regs) != 0) {
+		perror("PTRACE_GETREGS");
+		return -1;
+	}
+	regs.rip += anomaly_intercepts[w->intercept].fault_len;
+	if (ptrace_write_regs(tid, &regs) != 0) {
+		perror("ptrace skip fault");
+		return -1;
+	}
+	w->faulted = 1;
+	return 0;
+}
+
+/* epoll user data of the tracer's event sources, tracees follow from here */
+enum {
+	PDC_EV_SIGCHLD,
+	PDC_EV_WATCHDOG,
+	PDC_EV_TRACEE,
+};
+
+#define PDC_MAX_EVENTS 64
+
+static int pending_dbg_causes_epoll_add(int epfd, int fd, uint64_t data)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.u64 = data };
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		perror("epoll_ctl");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The event sources a tracer loop waits on: SIGCHLD through a signalfd, a
+ * timerfd ticking four times per --timeout for the watchdog, and whatever
+ * the caller adds to the epoll set. SIGCHLD stays blocked while they are
+ * open.
+ */
+struct pending_dbg_causes_events {
+	int sfd;
+	int tfd;
+	int epfd;
+	sigset_t old_mask;
+};
+
+static int pending_dbg_causes_events_open(struct pending_dbg_causes_events *ev, unsigned int timeout_ms)
+{
+	struct itimerspec tick = { 0 };
+	sigset_t chld;
+
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld, &ev->old_mask);
+
+	ev->sfd = signalfd(-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+	ev->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	ev->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (ev->sfd < 0 || ev->tfd < 0 || ev->epfd < 0) {
+		perror("signalfd/timerfd/epoll");
+		return -1;
+	}
+	if (pending_dbg_causes_epoll_add(ev->epfd, ev->sfd, PDC_EV_SIGCHLD) != 0 ||
+	    pending_dbg_causes_epoll_add(ev->epfd, ev->tfd, PDC_EV_WATCHDOG) != 0)
+		return -1;
+
+	tick.it_interval.tv_sec = timeout_ms / 4000;
+	tick.it_interval.tv_nsec = (long)(timeout_ms % 4000) * 250000;
+	tick.it_value = tick.it_interval;
+	if (timerfd_settime(ev->tfd, 0, &tick, NULL) != 0) {
+		perror("timerfd_settime");
+		return -1;
+	}
+	return 0;
+}
+
+static void pending_dbg_causes_events_close(struct pending_dbg_causes_events *ev)
+{
+	if (ev->epfd >= 0)
+		close(ev->epfd);
+	if (ev->tfd >= 0)
+		close(ev->tfd);
+	if (ev->sfd >= 0)
+		close(ev->sfd);
+	sigprocmask(SIG_SETMASK, &ev->old_mask, NULL);
+}
+
+/*
+ * Sleep until a child changed state or the watchdog ticked, and consume the
+ * notifications. Stops are then reaped with waitpid(WNOHANG) by the caller.
+ * Sets watchdog when the tick fired, returns -1 on error.
+ */
+static int pending_dbg_causes_events_wait(struct pending_dbg_causes_events *ev, int *watchdog)
+{
+	struct epoll_event events[PDC_MAX_EVENTS];
+	struct signalfd_siginfo si;
+	uint64_t trace_start = trace_begin();
+	uint64_t ticks;
+	int nr;
+
+	*watchdog = 0;
+	nr = epoll_wait(ev->epfd, events, PDC_MAX_EVENTS, -1);
+	trace_end(TRACE_EPOLL, trace_start, (uint64_t)(nr > 0 ? nr : 0));
+	if (nr < 0) {
+		if (errno == EINTR)
+			return 0;
+		perror("epoll_wait");
+		return -1;
+	}
+	for (int e = 0; e < nr; e++) {
+		if (events[e].data.u64 == PDC_EV_WATCHDOG)
+			*watchdog = read(ev->tfd, &ticks, sizeof(ticks)) == sizeof(ticks);
+	}
+
+	/* SIGCHLDs coalesce, drain the signalfd, the caller reaps every pending stop */
+	while (read(ev->sfd, &si, sizeof(si)) == sizeof(si))
+		;
+	return 0;
+}
+
+/* Kill a tracee which never got to run its trials */
+static void pending_dbg_causes_discard(struct pending_dbg_causes_worker *w)
+{
+	ptrace_kill(w->tracee.pid, w->tracee.pidfd);
+	waitpid(w->tracee.pid, NULL, __WALL);
+	tracee_release(&w->tracee);
+	w->ring = NULL;
+}
+
+/*
+ * Take a stopped tracee from the pool, hand it the worker's trials, program
+ * the watchpoint and let it run.
+ */
+static int pending_dbg_causes_spawn(struct pending_dbg_causes_worker *w)
+{
+	struct pending_dbg_causes_job *job;
+	uintptr_t probe;
+
+	profile_enter(pdc_profile, PDC_PHASE_SETUP);
+	if (tracee_pool_get(w->pool, &w->tracee) != 0)
+		return -1;
+
+	job = w->tracee.arg;
+	job->ring.limit = w->budget;
+	job->intercept = w->intercept;
+	job->probe = w->probe;
+	job->placement = pdc_placement;
+	w->ring = &job->ring;
+	w->pid = w->tracee.pid;
+	w->tracee.job->fn = trigger_pending_dbg_causes_bug;
+	w->tracee.job->cpu = w->cpu;
+
+	/* Program the hwbp watchpoint */
+	profile_enter(pdc_profile, PDC_PHASE_DR);
+	probe = pdc_placement != NULL ? (uintptr_t)pdc_placement->probe : (uintptr_t)&job->probe;
+	if (pending_dbg_causes_ptrace_arm(w->tracee.pid, probe) != 0) {
+		pending_dbg_causes_discard(w);
+		return -1;
+	}
+	w->armed = 1;
+
+	/* Run until #DB shows up as SIGTRAP */
+	profile_enter(pdc_profile, PDC_PHASE_RUN);
+	w->start_ns = anomaly_now_ns();
+	w->progress_ns = w->start_ns;
+	w->resume_tsc = rdtsc();
+	if (ptrace_continue(w->tracee.pid, 0) != 0) {
+		perror("ptrace continue");
+		pending_dbg_causes_discard(w);
+		return -1;
+	}
+	return 0;
+}
+
+static struct pending_dbg_causes_worker *pending_dbg_causes_find(struct pending_dbg_causes_worker *workers,
+								 unsigned int n, pid_t pid)
+{
+	for (unsigned int i = 0; i < n; i++) {
+		if (workers[i].tracee.pid == pid)
+			return &workers[i];
+	}
+	return NULL;
+}
+
+/* Whether a worker started no trial and had no stop serviced for a whole timeout */
+static int pending_dbg_causes_stalled(struct pending_dbg_causes_worker *w, uint64_t now)
+{
+	const uint64_t progress = __atomic_load_n(&w->ring->started, __ATOMIC_RELAXED) + w->traps + w->faults;
+
+	if (progress != w->progress) {
+		w->progress = progress;
+		w->progress_ns = now;
+		return 0;
+	}
+	return now - w->progress_ns >= w->opts->timeout_ms * 1000000ull;
+}
+
+/*
+ * The watchdog gave up on a worker. Record the trial in flight as a hang, the
+ * caller kills what runs it.
+ */
+static void pending_dbg_causes_hang(struct pending_dbg_causes_worker *w)
+{
+	const struct pending_dbg_causes_trial *const trial = pending_dbg_causes_current(w->ring);
+	const struct trial_record rec = {
+		.trial = trial->seq,
+		.tsc = trial->tsc,
+		.cpu = trial->cpu,
+		.dr7 = PENDING_DBG_CAUSES_DR7,
+		.test = ANOMALY_TEST_PENDING_DBG_CAUSES,
+		.intercept = (uint8_t)w->intercept,
+		.flags = TRIAL_F_HANG,
+	};
+
+	w->hangs++;
+	pending_dbg_causes_record(w, &rec);
+}
+
+static void pending_dbg_causes_watchdog(struct pending_dbg_causes_worker *workers, unsigned int n)
+{
+	const uint64_t now = anomaly_now_ns();
+
+	for (unsigned int i = 0; i < n; i++) {
+		struct pending_dbg_causes_worker *const w = &workers[i];
+
+		/* The exit of a killed tracee is reaped like any other */
+		if (w->tracee.pid != 0 && w->hangs == 0 && pending_dbg_causes_stalled(w, now)) {
+			pending_dbg_causes_hang(w);
+			ptrace_kill(w->tracee.pid, w->tracee.pidfd);
+		}
+	}
+}
+
+/* Service one ptrace stop and resume the tracee */
+static int pending_dbg_causes_ptrace_stop(struct pending_dbg_causes_worker *w, int signal)
+{
+	const pid_t pid = w->tracee.pid;
+
+	profile_enter(pdc_profile, PDC_PHASE_CLEANUP);
+
+	/* Handle SIGTRAP from #DB, one per trial */
+	if (signal == SIGTRAP && w->armed) {
+		if (pending_dbg_causes_ptrace_trap(w, pid) != 0)
+			return -1;
+		signal = 0;
+	}
+
+	/* Step over an intercepting instruction which faults at CPL3 */
+	else if ((signal == SIGILL || signal == SIGSEGV) &&
+		 anomaly_intercepts[w->intercept].fault_len != 0) {
+		if (pending_dbg_causes_ptrace_fault(w, pid) != 0)
+			return -1;
+		signal = 0;
+	}
+
+	/* Any other stop just continue and pass the signal through */
+	if (ptrace_continue(pid, signal) != 0 && w->hangs == 0) {
+		perror("ptrace continue");
+		return -1;
+	}
+	profile_enter(pdc_profile, PDC_PHASE_RUN);
+	return 0;
+}
+
+static void pending_dbg_causes_ptrace_exit(struct pending_dbg_causes_worker *w, int status)
+{
+	if (w->hangs == 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+		fprintf(stderr, "tracee %d did not exit cleanly (status 0x%x)\n", (int)w->tracee.pid, status);
+		w->err = 1;
+	}
+	w->elapsed_ns = anomaly_now_ns() - w->start_ns;
+	profile_enter(pdc_profile, PDC_PHASE_TEARDOWN);
+	w->trials = w->ring->started;
+	pending_dbg_causes_drain(w);
+	tracee_release(&w->tracee);
+	w->ring = NULL;
+	profile_enter(pdc_profile, PDC_PHASE_RUN);
+}
+
+/*
+ * Reap every pending stop and exit of our tracees without blocking. Returns
+ * the number of tracees which exited.
+ */
+static unsigned int pending_dbg_causes_ptrace_wait(struct pending_dbg_causes_worker *workers,
+						   unsigned int n)
+{
+	struct tracee_pool *const pool = workers[0].pool;
+	unsigned int exited = 0;
+	int status;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, WNOHANG | __WALL)) > 0) {
+		struct pending_dbg_causes_worker *w;
+
+		if (trace_enabled) {
+			const uint64_t now = rdtsc();
+
+			trace_record(TRACE_WAITPID, now, now, 0, 0, (uint64_t)pid);
+		}
+
+		/* Spare tracees stopping for the first time */
+		if (tracee_pool_event(pool, pid, status))
+			continue;
+
+		w = pending_dbg_causes_find(workers, n, pid);
+		if (w == NULL)
+			continue;
+
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			pending_dbg_causes_ptrace_exit(w, status);
+			exited++;
+		} else if (WIFSTOPPED(status) && pending_dbg_causes_ptrace_stop(w, WSTOPSIG(status)) != 0) {
+			w->err = 1;
+			ptrace_kill(w->tracee.pid, w->tracee.pidfd);
+		}
+	}
+	return exited;
+}
+
+/*
+ * ptrace backend: every worker's trials run in its own traced child, taken
+ * from the tracee pool, and the parent collects DR6 through PTRACE_PEEKUSER
+ * on every SIGTRAP stop. A single
+ * tracer drives all children from one epoll loop: stops are announced by a
+ * signalfd for SIGCHLD and drained with waitpid(WNOHANG), each child's pidfd
+ * wakes the loop when it exits, and a periodic timerfd runs the watchdog
+ * which kills a child that made no progress for --timeout.
+ */
+static int pending_dbg_causes_ptrace(struct pending_dbg_causes_worker *workers, unsigned int n)
+{
+	struct pending_dbg_causes_events ev = { .sfd = -1, .tfd = -1, .epfd = -1 };
+	unsigned int live = 0;
+	int err = 1;
+
+	profile_enter(pdc_profile, PDC_PHASE_SETUP);
+	if (pending_dbg_causes_events_open(&ev, workers[0].opts->timeout_ms) != 0)
+		goto out;
+
+	for (unsigned int i = 0; i < n; i++) {
+		if (pending_dbg_causes_spawn(&workers[i]) != 0) {
+			workers[i].err = 1;
+			break;
+		}
+		live++;
+		if (workers[i].tracee.pidfd >= 0)
+			pending_dbg_causes_epoll_add(ev.epfd, workers[i].tracee.pidfd, PDC_EV_TRACEE + i);
+	}
+
+	while (live > 0) {
+		int watchdog;
+
+		if (pending_dbg_causes_events_wait(&ev, &watchdog) != 0)
+			goto out;
+		live -= pending_dbg_causes_ptrace_wait(workers, n);
+
+		/* Replace the tracees handed out, off the path of any trial's stop */
+		if (workers[0].pool->nr < workers[0].pool->capacity) {
+			profile_enter(pdc_profile, PDC_PHASE_SETUP);
+			tracee_pool_refill(workers[0].pool);
+			profile_enter(pdc_profile, PDC_PHASE_RUN);
+		}
+
+		if (watchdog)
+			pending_dbg_causes_watchdog(workers, n);
+	}
+	err = 0;
+
+out:
+	profile_enter(pdc_profile, PDC_PHASE_TEARDOWN);
+
+	/* Only left with live tracees on error */
+	for (unsigned int i = 0; i < n; i++) {
+		struct pending_dbg_causes_worker *const w = &workers[i];
+		int status;
+
+		if (w->tracee.pid != 0) {
+			ptrace_kill(w->tracee.pid, w->tracee.pidfd);
+			if (waitpid(w->tracee.pid, &status, __WALL) > 0)
+				pending_dbg_causes_ptrace_exit(w, status);
+			w->err = 1;
+		}
+		err |= w->err;
+	}
+	pending_dbg_causes_events_close(&ev);
+	profile_enter(pdc_profile, -1);
+	return err;
+}
+
+/*
+ * State shared between the in-process trial loop and its SIGTRAP handler.
+ */
+struct pending_dbg_causes_trap {
+	volatile uint64_t traps;
+	volatile uint64_t faults;
+	unsigned int fault_len;                 /* Non-zero while a faulting intercept may run */
+	int si_code;
+	uint64_t rip;
+	uint64_t trapno;
+	uint64_t tsc;                           /* TSC on handler entry */
+	uint32_t cpu;                           /* CPU on handler entry */
+};
+
+static __thread struct pending_dbg_causes_trap pdc_trap;
+
+static void pending_dbg_causes_sigtrap(int sig, siginfo_t *info, void *ucontext)
+{
+	ucontext_t *const uc = ucontext;
+	uint32_t aux;
+	(void)sig;
+
+	pdc_trap.tsc = rdtscp(&aux);
+	pdc_trap.cpu = TSC_AUX_CPU(aux);
+	pdc_trap.si_code = info->si_code;
+	pdc_trap.rip = (uint64_t)uc->uc_mcontext.gregs[REG_RIP];
+	pdc_trap.trapno = (uint64_t)uc->uc_mcontext.gregs[REG_TRAPNO];
+	pdc_trap.traps++;
+
+	/* Clear TF so sigreturn does not single-step the rest of the trial */
+	uc->uc_mcontext.gregs[REG_EFL] &= ~0x100;
+}
+
+static void pending_dbg_causes_sigfault(int sig, siginfo_t *info, void *ucontext)
+{
+	ucontext_t *const uc = ucontext;
+	(void)info;
+
+	/* Not one of ours, let the default action handle it on re-execution */
+	if (pdc_trap.fault_len == 0) {
+		signal(sig, SIG_DFL);
+		return;
+	}
+
+	uc->uc_mcontext.gregs[REG_RIP] += pdc_trap.fault_len;
+	pdc_trap.faults++;
+}
+
+/*
+ * The in-process backend catches every trial's #DB with a SIGTRAP handler,
+ * and steps over intercepting instructions which fault at CPL3. old[] holds
+ * the SIGTRAP, SIGILL and SIGSEGV actions to put back afterwards.
+ */
+static int pending_dbg_causes_perf_signals(struct sigaction old[3])
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = pending_dbg_causes_sigtrap;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGTRAP, &sa, &old[0]) != 0) {
+		perror("sigaction(SIGTRAP)");
+		return -1;
+	}
+	sa.sa_sigaction = pending_dbg_causes_sigfault;
+	sigaction(SIGILL, &sa, &old[1]);
+	sigaction(SIGSEGV, &sa, &old[2]);
+	return 0;
+}
+
+static void pending_dbg_causes_perf_restore(const struct sigaction old[3])
+{
+	sigaction(SIGTRAP, &old[0], NULL);
+	sigaction(SIGILL, &old[1], NULL);
+	sigaction(SIGSEGV, &old[2], NULL);
+}
+
+/*
+ * Linux does not hand DR6 to signal handlers, so rebuild the architectural
+ * value from what the kernel did report. A single-step condition is sent as
+ * TRAP_TRACE (TRAP_HWBKPT for breakpoint-only #DBs) while hits on a perf
+ * breakpoint are consumed by the event and only show up in its count.
+ */
+static inline uint64_t pending_dbg_causes_perf_dr6(int si_code, uint64_t bp_hits)
+{
+	uint64_t dr6 = DR6_INIT;
+
+	if (si_code == TRAP_TRACE)
+		dr6 |= DR6_BS_BIT;
+	if (bp_hits != 0 || si_code == TRAP_HWBKPT)
+		dr6 |= DR6_B0_BIT;
+	return dr6;
+}
+
+/*
+ * Point the perf breakpoint at a probe, opening it on first use and moving it
+ * with PERF_EVENT_IOC_MODIFY_ATTRIBUTES afterwards. The address is rounded
+ * down to the alignment len requires, a breakpoint on a split probe covers
+ * its first byte.
+ */
+static int pending_dbg_causes_perf_arm(int *fd, uintptr_t addr, unsigned int len)
 {
-	uintptr_t addr;
+	addr &= ~(uintptr_t)(len - 1);
+	if (*fd < 0) {
+		*fd = perf_bp_open(addr, len, HW_BREAKPOINT_RW);
+		return *fd < 0 ? -1 : 0;
+	}
+	return perf_bp_modify(*fd, addr, len, HW_BREAKPOINT_RW);
+}
 
-	/* Load current SS selector into ss_probe */
-	__asm__ __volatile__("movw %%ss, %0" : "=r"(ss_probe) : : );
+/*
+ * perf backend: the watchpoint is a perf_event hardware breakpoint on the
+ * current thread and the #DB is caught in-process by a SIGTRAP handler,
+ * avoiding the tracer round trip for every trial.
+ */
+static int pending_dbg_causes_perf(struct pending_dbg_causes_worker *w)
+{
+	const struct anomaly_intercept *const intercept = &anomaly_intercepts[w->intercept];
+	void (*trial)(uint16_t *probe) = intercept->trial;
+	uint16_t *probe = &w->probe;
+	uint16_t stack_probe = w->probe;
+	uint64_t start_ns;
+	uint64_t count, last_count = 0;
+	uint64_t i;
+	int bp_fd = -1;
+	int err = 0;
 
-	/* Send address of ss_probe to parent */
-	addr = (uintptr_t)&ss_probe;
-	if (write(pipefd, &addr, sizeof(addr)) != sizeof(addr))
-		return 2;
-	close(pipefd);
+	/* A placement's probe, on the stack a local of this loop rather than its tracee stack */
+	if (pdc_placement != NULL) {
+		probe = pdc_placement->stack != NULL ? &stack_probe : pdc_placement->probe;
+		trial = pdc_placement->trials[w->intercept];
+	}
 
-	/* Become trace and stop so parent can program DRx */
-	if (ptrace_trace())
-		return 3;
-	raise(SIGSTOP);
+	profile_enter(pdc_profile, PDC_PHASE_DR);
+	if (pending_dbg_causes_perf_arm(&bp_fd, (uintptr_t)probe, HW_BREAKPOINT_LEN_2) != 0) {
+		perror("perf_event_open(PERF_TYPE_BREAKPOINT)");
+		profile_enter(pdc_profile, -1);
+		return 1;
+	}
 
-	/*
-	 * Trigger the pending debug exceptions test.
-	 * - DR7 should be programmed to watch ss_probe
-	 * - Enable single-stepping
-	 * - MOV SS from probe page, to cause delayed B0+BS conditions
-	 * - Execute intercepting instruction (i.e. CPUID)
-	 */
-	__asm__ __volatile__(
-		"pushq %%rbx\n"
-		"pushfq\n"
-		"orl $0x100, (%%rsp)\n" /* set TF in saved RFLAGS on stack */
-		"popfq\n"
-		"movw (%0), %%ss\n"     /* block exceptions on mov ss */
-		"cpuid\n"               /* trigger vm intercept */
-		"popq %%rbx\n"          /* only single #DB should fire here with DR6 B0+BS set */
-		: : "r"(&ss_probe) : "rax", "rcx", "rdx", "memory"
-	);
+	start_ns = anomaly_now_ns();
+	pdc_trap.fault_len = intercept->fault_len;
+	for (i = 0; i < w->budget && !w->stop; i++) {
+		const uint64_t traps = pdc_trap.traps;
+		const uint64_t faults = pdc_trap.faults;
+		struct trial_record rec = {
+			.trial = i,
+			.dr7 = PENDING_DBG_CAUSES_DR7,
+			.test = ANOMALY_TEST_PENDING_DBG_CAUSES,
+			.intercept = (uint8_t)w->intercept,
+		};
+		uint16_t simd[SIMD_MAX_REGS];
+		uint64_t end_tsc;
+		uint32_t aux;
+		int disturbed;
 
-	return 0;
+		profile_enter(pdc_profile, PDC_PHASE_RUN);
+		rec.tsc = rdtscp_serialized(&aux);
+		rec.cpu = TSC_AUX_CPU(aux);
+		if (pdc_simd != SIMD_NONE)
+			simd_trial(w->intercept, pdc_simd, i, probe, simd);
+		else
+			trial(probe);
+		end_tsc = rdtscp_serialized(&aux);
+		if (trace_enabled) {
+			trace_record(TRACE_TRIAL, rec.tsc, end_tsc, 0, 0, i);
+			if (pdc_trap.traps != traps)
+				trace_record(TRACE_DELIVERY, rec.tsc, pdc_trap.tsc, 0, 0, i);
+		}
+		latency_add(&w->lat[PDC_LAT_WINDOW], end_tsc - rec.tsc);
+
+		profile_enter(pdc_profile, PDC_PHASE_CLEANUP);
+		if (perf_read_count(bp_fd, &count) != 0) {
+			perror("read(perf breakpoint)");
+			err = 1;
+			break;
+		}
+
+		if (pdc_trap.traps != traps) {
+			rec.dr6 = pending_dbg_causes_perf_dr6(pdc_trap.si_code, count - last_count);
+			rec.rip = pdc_trap.rip;
+			rec.latency = pdc_trap.tsc - rec.tsc;
+			rec.flags |= TRIAL_F_TRAP;
+		}
+		if (pdc_trap.faults != faults)
+			rec.flags |= TRIAL_F_FAULT;
+		if (pdc_simd != SIMD_NONE && simd_damage_add(&w->simd, pdc_simd, simd))
+			rec.flags |= TRIAL_F_SIMD;
+
+		/* The handler is the #DB path, without a trap the trial's end will do */
+		if (rec.flags & TRIAL_F_TRAP)
+			disturbed = pending_dbg_causes_disturbed(&w->disturb, rec.cpu, rec.tsc,
+								 pdc_trap.cpu, pdc_trap.tsc);
+		else
+			disturbed = pending_dbg_causes_disturbed(&w->disturb, rec.cpu, rec.tsc,
+								 TSC_AUX_CPU(aux), end_tsc);
+		if (disturbed)
+			rec.flags |= TRIAL_F_DISTURBED;
+		pending_dbg_causes_classify(&w->disturb, disturbed, pending_dbg_causes_record(w, &rec));
+		last_count = count;
+		latency_add(&w->lat[PDC_LAT_ROUND_TRIP], rdtsc() - rec.tsc);
+	}
+	w->elapsed_ns = anomaly_now_ns() - start_ns;
+	w->trials = i;
+	pdc_trap.fault_len = 0;
+
+	profile_enter(pdc_profile, PDC_PHASE_TEARDOWN);
+	close(bp_fd);
+	profile_enter(pdc_profile, -1);
+	return err;
 }
 
-int anomaly_pending_dbg_causes(void)
+/*
+ * Time the bare MOV SS + intercept sequence on this worker's CPU before any
+ * watchpoint is armed. Faulting intercepts have no handler at this point and
+ * are skipped.
+ */
+static void pending_dbg_causes_baseline(struct pending_dbg_causes_worker *w)
 {
-	int status = 0;
-	int pipefd[2];
-	pid_t child;
-	uintptr_t addr;
-	int signal;
-	uint64_t dr6 = 0;
-	int got_trap = 0;
+	const struct anomaly_intercept *const intercept = &anomaly_intercepts[w->intercept];
+	uint32_t aux;
 
-	if (pipe(pipefd) != 0) {
-		perror("pipe");
-		return 1;
+	if (intercept->fault_len != 0)
+		return;
+
+	for (uint64_t i = 0; i < w->budget; i++) {
+		const uint64_t start = rdtscp_serialized(&aux);
+		intercept->baseline(&w->probe);
+		latency_add(&w->lat[PDC_LAT_BASELINE], rdtscp_serialized(&aux) - start);
 	}
+}
 
-	child = fork();
-	if (child < 0) {
-		perror("fork");
-		return 1;
+static void pending_dbg_causes_init(struct pending_dbg_causes_worker *w)
+{
+	/* Load current SS selector into the probe */
+	__asm__ __volatile__("movw %%ss, %0" : "=r"(w->probe) : : );
+
+	w->budget = anomaly_trial_budget(w->opts);
+	if (w->opts->adaptive)
+		sprt_init(&w->sprt, &w->opts->sprt);
+}
+
+static void pending_dbg_causes_finish(struct pending_dbg_causes_worker *w)
+{
+	/* Trials which never raised a #DB are anomalous as well */
+	w->hist.no_trap = w->trials - w->traps;
+	w->anomalies += w->hist.no_trap;
+	if (pdc_profile != NULL)
+		pdc_profile->trials += w->trials;
+}
+
+static int pending_dbg_causes_run(struct pending_dbg_causes_worker *w)
+{
+	int err;
+
+	pending_dbg_causes_init(w);
+	if (w->opts->latency)
+		pending_dbg_causes_baseline(w);
+
+	switch (w->opts->backend) {
+	case ANOMALY_BACKEND_PERF:
+		err = pending_dbg_causes_perf(w);
+		break;
+	case ANOMALY_BACKEND_PTRACE:
+	default:
+		err = pending_dbg_causes_ptrace(w, 1);
+		break;
 	}
 
-	/* Child process path */
-	if (child == 0) {
-		close(pipefd[0]); /* close read end */
-		return trigger_pending_dbg_causes_bug(pipefd[1]);
+	pending_dbg_causes_finish(w);
+	return err;
+}
+
+static void *pending_dbg_causes_thread(void *arg)
+{
+	struct pending_dbg_causes_worker *const w = arg;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		perror("sched_setaffinity");
+		w->err = 1;
+		return NULL;
 	}
 
-	/* Read probe address from child */
-	addr = 0;
-	if (read(pipefd[0], &addr, sizeof(addr)) != sizeof(addr)) {
-		fprintf(stderr, "failed to read probe addr from child\n");
+	w->err = pending_dbg_causes_run(w);
+	return NULL;
+}
+
+/*
+ * Print every worker's report followed by the combined histogram and
+ * latencies under the given label.
+ */
+static int pending_dbg_causes_summarize(struct pending_dbg_causes_worker *workers, int n,
+					const char *label, struct pending_dbg_causes_tally *tally)
+{
+	struct dr6_hist total = { 0 };
+	struct pending_dbg_causes_disturb disturb = { 0 };
+	struct simd_damage simd = { 0 };
+	struct latency_hist *lat;
+	uint64_t elapsed_ns = 0;
+	int err = 0;
+
+	lat = calloc(PDC_LAT_COUNT, sizeof(*lat));
+	if (lat == NULL) {
+		perror("alloc latency");
 		return 1;
 	}
-	close(pipefd[0]);
 
-	/* Wait for child to stop on SIGSTOP */
-	if (waitpid(child, &status, 0) < 0) {
-		perror("waitpid(SIGSTOP)");
-		return 1;
-	} else if (!WIFSTOPPED(status)) {
-		fprintf(stderr, "child did not stop as expected\n");
-		return 1;
+	for (int i = 0; i < n; i++) {
+		if (workers[i].err) {
+			if (workers[i].tid != 0)
+				fprintf(stderr, "thread %d: worker failed\n", (int)workers[i].tid);
+			else if (workers[i].opts->tracees > 1)
+				fprintf(stderr, "CPU %d tracee %u: worker failed\n", workers[i].cpu, workers[i].index);
+			else
+				fprintf(stderr, "CPU %d: worker failed\n", workers[i].cpu);
+			err = 1;
+			continue;
+		}
+		pending_dbg_causes_report(&workers[i]);
+		pending_dbg_causes_tally(tally, &workers[i]);
+		dr6_hist_merge(&total, &workers[i].hist);
+		pending_dbg_causes_disturb_merge(&disturb, &workers[i].disturb);
+		simd_damage_merge(&simd, &workers[i].simd);
+		for (unsigned int j = 0; j < PDC_LAT_COUNT; j++)
+			latency_merge(&lat[j], &workers[i].lat[j]);
+		if (workers[i].elapsed_ns > elapsed_ns)
+			elapsed_ns = workers[i].elapsed_ns;
 	}
 
-	/*
-	 * Program the hwbp watchpoint.
-	 * DR0 = probe addr
-	 * DR7 = L0|G0|RW=read/write|LEN=2 bytes
-	 */
-	const uint64_t dr7 = DR7_L0_BIT | DR7_G0_BIT | DR7_RW0_DATA_RW | DR7_LEN0_2_BYTE;
-	if (ptrace_write_debugreg(child, 0, (uint64_t)addr) != 0 ||
-	    ptrace_write_debugreg(child, 6, 0) != 0 ||
-	    ptrace_write_debugreg(child, 7, (uint64_t)dr7) != 0) {
-		perror("ptrace write DRx");
+	anomaly_print_rate(label, dr6_hist_total(&total), elapsed_ns);
+	dr6_hist_print(&total);
+	pending_dbg_causes_disturb_print(&disturb);
+	simd_damage_print(&simd, pdc_simd);
+	if (n > 0 && workers[0].opts->latency)
+		pending_dbg_causes_print_latency(lat);
+
+	free(lat);
+	return err;
+}
+
+/*
+ * perf backend: run one pinned worker thread per CPU in our affinity mask and
+ * print a DR6 outcome histogram for each of them, then the combined one.
+ */
+static int pending_dbg_causes_all_cpus(const struct anomaly_options *opts, unsigned int intercept,
+				       struct trial_log *log, struct pending_dbg_causes_tally *tally)
+{
+	struct pending_dbg_causes_worker *workers;
+	pthread_t *threads;
+	cpu_set_t online;
+	int nr_workers, n = 0;
+	int err = 0;
+
+	if (sched_getaffinity(0, sizeof(online), &online) != 0) {
+		perror("sched_getaffinity");
 		return 1;
 	}
+	nr_workers = CPU_COUNT(&online);
 
-	/* Run until #DB shows up as SIGTRAP */
-	if (ptrace_continue(child, 0) != 0) {
-		perror("ptrace continue");
+	workers = aligned_alloc(ANOMALY_CACHE_LINE, nr_workers * sizeof(*workers));
+	threads = calloc(nr_workers, sizeof(*threads));
+	if (workers == NULL || threads == NULL) {
+		perror("alloc workers");
+		free(workers);
+		free(threads);
 		return 1;
 	}
+	memset(workers, 0, nr_workers * sizeof(*workers));
+
+	for (int cpu = 0; cpu < CPU_SETSIZE && n < nr_workers; cpu++) {
+		if (!CPU_ISSET(cpu, &online))
+			continue;
+		workers[n].cpu = cpu;
+		workers[n].intercept = intercept;
+		workers[n].opts = opts;
+		workers[n].log = log;
+		if (pthread_create(&threads[n], NULL, pending_dbg_causes_thread, &workers[n]) != 0) {
+			perror("pthread_create");
+			err = 1;
+			break;
+		}
+		n++;
+	}
+
+	for (int i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+
+	err |= pending_dbg_causes_summarize(workers, n, "all CPUs", tally);
+
+	free(threads);
+	free(workers);
+	return err;
+}
+
+/*
+ * Time the baseline on the CPU a tracee will be pinned to, then put the
+ * tracer's own affinity back.
+ */
+static void pending_dbg_causes_baseline_on(struct pending_dbg_causes_worker *w)
+{
+	cpu_set_t old, set;
+
+	if (w->cpu < 0 || sched_getaffinity(0, sizeof(old), &old) != 0) {
+		pending_dbg_causes_baseline(w);
+		return;
+	}
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) == 0)
+		pending_dbg_causes_baseline(w);
+	sched_setaffinity(0, sizeof(old), &old);
+}
+
+/*
+ * ptrace with --all-cpus or --tracees: --tracees traced processes (one by
+ * default) on every CPU in our affinity mask, or unpinned without --all-cpus,
+ * all driven by a single event-loop tracer.
+ */
+static int pending_dbg_causes_tracees(const struct anomaly_options *opts, unsigned int intercept,
+				      struct tracee_pool *pool, struct trial_log *log,
+				      struct pending_dbg_causes_tally *tally)
+{
+	const unsigned int per_cpu = opts->tracees != 0 ? opts->tracees : 1;
+	struct pending_dbg_causes_worker *workers;
+	cpu_set_t online;
+	unsigned int nr_cpus = 1, n = 0;
+	int err;
 
-	/* Wait for child to hit watchpoint or exit */
-	for (;;) {
-		if (waitpid(child, &status, 0) < 0) {
-			perror("waitpid(run)");
+	if (opts->all_cpus) {
+		if (sched_getaffinity(0, sizeof(online), &online) != 0) {
+			perror("sched_getaffinity");
 			return 1;
 		}
+		nr_cpus = (unsigned int)CPU_COUNT(&online);
+	}
 
-		/* Check for exit */
-		if (WIFEXITED(status) || WIFSIGNALED(status))
-			break;
-		else if (!WIFSTOPPED(status))
+	workers = aligned_alloc(ANOMALY_CACHE_LINE, nr_cpus * per_cpu * sizeof(*workers));
+	if (workers == NULL) {
+		perror("alloc workers");
+		return 1;
+	}
+	memset(workers, 0, nr_cpus * per_cpu * sizeof(*workers));
+
+	for (int cpu = opts->all_cpus ? 0 : -1; cpu < CPU_SETSIZE && n < nr_cpus * per_cpu; cpu++) {
+		if (cpu >= 0 && !CPU_ISSET(cpu, &online))
 			continue;
+		for (unsigned int i = 0; i < per_cpu; i++, n++) {
+			workers[n].cpu = cpu;
+			workers[n].index = i;
+			workers[n].intercept = intercept;
+			workers[n].opts = opts;
+			workers[n].log = log;
+			workers[n].pool = pool;
+			pending_dbg_causes_init(&workers[n]);
+			if (opts->latency)
+				pending_dbg_causes_baseline_on(&workers[n]);
+		}
+	}
+
+	err = pending_dbg_causes_ptrace(workers, n);
+	for (unsigned int i = 0; i < n; i++)
+		pending_dbg_causes_finish(&workers[i]);
+	err |= pending_dbg_causes_summarize(workers, (int)n,
+					    opts->all_cpus ? "all CPUs" : "all tracees", tally);
+
+	free(workers);
+	return err;
+}
+
+/*
+ * Per-thread state of a --threads tracee, in a mapping shared with the
+ * tracer. The ring must stay first, tracee threads find their slot from
+ * their worker's ring pointer. Each probe sits on its own cache line.
+ */
+struct pending_dbg_causes_slot {
+	struct pending_dbg_causes_ring ring;
+	volatile pid_t tid;                     /* Published before the thread asks to be armed */
+	uint16_t probe __attribute__((aligned(ANOMALY_CACHE_LINE)));
+} __attribute__((aligned(ANOMALY_CACHE_LINE)));
+
+static void *pending_dbg_causes_tracee_thread(void *arg)
+{
+	const struct pending_dbg_causes_worker *const w = arg;
+	struct pending_dbg_causes_slot *const slot = (struct pending_dbg_causes_slot *)w->ring;
+
+	slot->tid = (pid_t)syscall(SYS_gettid);
+	__asm__ __volatile__("movw %%ss, %0" : "=r"(slot->probe) : : );
+
+	/* A thread-directed SIGUSR1 stops only this thread, the tracer arms it */
+	syscall(SYS_tgkill, getpid(), slot->tid, SIGUSR1);
+
+	pending_dbg_causes_tracee_loop(w->ring, w->intercept, &slot->probe,
+				       anomaly_intercepts[w->intercept].trial);
+	return NULL;
+}
+
+static int pending_dbg_causes_tracee_threads(int syncfd, struct pending_dbg_causes_worker *workers,
+					     unsigned int n)
+{
+	pthread_t threads[n];
+	unsigned int started = 0;
+	char c;
+
+	/* Wait until the tracer has seized us */
+	if (read(syncfd, &c, 1) != 1)
+		return 2;
+	close(syncfd);
+
+	for (; started < n; started++) {
+		if (pthread_create(&threads[started], NULL, pending_dbg_causes_tracee_thread,
+				   &workers[started]) != 0)
+			break;
+	}
+	for (unsigned int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	return started == n ? 0 : 4;
+}
+
+/* Kill the --threads tracee and reap its threads, the leader goes last */
+static void pending_dbg_causes_threads_kill(pid_t child)
+{
+	pid_t tid;
+
+	kill(child, SIGKILL);
+	do
+		tid = waitpid(-1, NULL, __WALL);
+	while ((tid > 0 && tid != child) || (tid < 0 && errno == EINTR));
+}
+
+/*
+ * --threads watchdog. A hung trial thread cannot be killed on its own, so
+ * once one hangs the others are stopped after their trial in flight, and the
+ * process is killed when they are gone or another timeout passed. Returns
+ * whether to kill it now.
+ */
+static int pending_dbg_causes_threads_watchdog(struct pending_dbg_causes_worker *workers, unsigned int n,
+					       uint64_t *kill_ns)
+{
+	const uint64_t now = anomaly_now_ns();
+	unsigned int running = 0;
+	int hung = 0;
+
+	for (unsigned int i = 0; i < n; i++) {
+		struct pending_dbg_causes_worker *const w = &workers[i];
+
+		if (!w->exited && w->hangs == 0 && pending_dbg_causes_stalled(w, now))
+			pending_dbg_causes_hang(w);
+		hung |= w->hangs != 0;
+		running += !w->exited && w->hangs == 0;
+	}
+	if (!hung)
+		return 0;
+	if (*kill_ns == 0) {
+		for (unsigned int i = 0; i < n; i++)
+			pending_dbg_causes_stop(workers[i].ring);
+		*kill_ns = now + workers[0].opts->timeout_ms * 1000000ull;
+	}
+	return running == 0 || now >= *kill_ns;
+}
+
+/*
+ * --threads: one traced process runs a trial thread per worker, each with its
+ * own probe and DR0/DR7. A single tracer seizes the process, follows its
+ * clones, and services every thread's stops from the same signalfd and
+ * timerfd driven loop as the ptrace backend, keeping per-thread bookkeeping
+ * in the worker matching the stopped TID. The watchdog records a thread that
+ * made no progress for --timeout as hung and kills the process.
+ */
+static int pending_dbg_causes_threads(const struct anomaly_options *opts, unsigned int intercept,
+				      struct trial_log *log, struct pending_dbg_causes_tally *tally)
+{
+	const unsigned int n = opts->threads;
+	struct pending_dbg_causes_events ev = { .sfd = -1, .tfd = -1, .epfd = -1 };
+	struct pending_dbg_causes_worker *workers;
+	struct pending_dbg_causes_slot *slots;
+	uint64_t start_ns, elapsed_ns, fork_start, kill_ns = 0;
+	int done = 0, killed = 0;
+	int syncfd[2];
+	int status;
+	pid_t child;
+	int err = 1;
+
+	profile_enter(pdc_profile, PDC_PHASE_SETUP);
+	slots = mmap(NULL, n * sizeof(*slots), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	workers = aligned_alloc(ANOMALY_CACHE_LINE, n * sizeof(*workers));
+	if (slots == MAP_FAILED || workers == NULL) {
+		perror("alloc threads");
+		if (slots != MAP_FAILED)
+			munmap(slots, n * sizeof(*slots));
+		free(workers);
+		return 1;
+	}
+	memset(workers, 0, n * sizeof(*workers));
+	if (pending_dbg_causes_events_open(&ev, opts->timeout_ms) != 0)
+		goto out;
+
+	for (unsigned int i = 0; i < n; i++) {
+		workers[i].cpu = -1;
+		workers[i].intercept = intercept;
+		workers[i].opts = opts;
+		workers[i].log = log;
+		workers[i].ring = &slots[i].ring;
+		pending_dbg_causes_init(&workers[i]);
+		slots[i].ring.limit = workers[i].budget;
+	}
+
+	if (pipe(syncfd) != 0) {
+		perror("pipe");
+		goto out;
+	}
+
+	fflush(stdout);
+	fork_start = trace_begin();
+	child = fork();
+	if (child > 0)
+		trace_end(TRACE_FORK, fork_start, (uint64_t)child);
+	if (child < 0) {
+		perror("fork");
+		close(syncfd[0]);
+		close(syncfd[1]);
+		goto out;
+	}
+	if (child == 0) {
+		close(syncfd[1]);
+		sigprocmask(SIG_SETMASK, &ev.old_mask, NULL);
+		_exit(pending_dbg_causes_tracee_threads(syncfd[0], workers, n));
+	}
+	close(syncfd[0]);
+	for (unsigned int i = 0; i < n; i++)
+		workers[i].pid = child;
+
+	if (ptrace(PTRACE_SEIZE, child, 0, (void *)(uintptr_t)(PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL)) != 0) {
+		perror("PTRACE_SEIZE");
+		close(syncfd[1]);
+		kill(child, SIGKILL);
+		waitpid(child, NULL, 0);
+		goto out;
+	}
+	if (write(syncfd[1], "", 1) != 1) {
+		perror("write(sync)");
+		close(syncfd[1]);
+		kill(child, SIGKILL);
+		waitpid(child, NULL, __WALL);
+		goto out;
+	}
+	close(syncfd[1]);
+
+	start_ns = anomaly_now_ns();
+	for (unsigned int i = 0; i < n; i++)
+		workers[i].progress_ns = start_ns;
+	while (!done) {
+		int watchdog;
+		pid_t tid;
+
+		profile_enter(pdc_profile, PDC_PHASE_RUN);
+		if (pending_dbg_causes_events_wait(&ev, &watchdog) != 0) {
+			pending_dbg_causes_threads_kill(child);
+			goto out;
+		}
+
+		while (!done && (tid = waitpid(-1, &status, WNOHANG | __WALL)) != 0) {
+			struct pending_dbg_causes_worker *w = NULL;
+			unsigned int i;
+			int signal;
+
+			if (tid < 0) {
+				if (errno == EINTR)
+					continue;
+
+				/* The leader's exit was never seen, its status is unknown */
+				perror("waitpid(threads)");
+				pending_dbg_causes_threads_kill(child);
+				goto out;
+			}
+			if (trace_enabled) {
+				const uint64_t now = rdtsc();
+
+				trace_record(TRACE_WAITPID, now, now, 0, 0, (uint64_t)tid);
+			}
+			profile_enter(pdc_profile, PDC_PHASE_CLEANUP);
 
-		signal = WSTOPSIG(status);
+			for (i = 0; i < n; i++) {
+				if (slots[i].tid == tid) {
+					w = &workers[i];
+					break;
+				}
+			}
 
-		/* Handle SIGTRAP from #DB */
-		if (signal == SIGTRAP && !got_trap) {
-			struct user_regs_struct regs;
+			/* Trial threads exit on their own, the batch ends with the leader */
+			if (WIFEXITED(status) || WIFSIGNALED(status)) {
+				if (tid == child)
+					done = 1;
+				else if (w != NULL)
+					w->exited = 1;
+				continue;
+			} else if (!WIFSTOPPED(status)) {
+				continue;
+			}
 
-			/* Read DR6 from ptrace */
-			if (ptrace_read_debugreg(child, 6, &dr6) != 0) {
-				perror("ptrace read DR6");
-				return 1;
+			/* Clone and new-thread event stops carry no signal to deliver */
+			if ((status >> 16) != 0) {
+				ptrace_continue(tid, 0);
+				continue;
 			}
+			signal = WSTOPSIG(status);
 
-			/* Clear TF in RFLAGS, clear DR0/DR6/DR7 */
-			if (ptrace_read_regs(child, &regs) != 0) {
-				perror("PTRACE_GETREGS");
-				return 1;
+			if (w != NULL && signal == SIGUSR1 && !w->armed && w->traps == 0) {
+				w->tid = tid;
+				profile_enter(pdc_profile, PDC_PHASE_DR);
+				if (pending_dbg_causes_ptrace_arm(tid, (uintptr_t)&slots[i].probe) != 0)
+					w->err = 1;
+				w->armed = !w->err;
+				w->resume_tsc = rdtsc();
+				ptrace_continue(tid, 0);
+				continue;
 			}
-			regs.eflags &= ~0x100; /* TF */
-			if (ptrace_write_regs(child, &regs) != 0 ||
-			    ptrace_write_debugreg(child, 0, 0) != 0 ||
-			    ptrace_write_debugreg(child, 6, 0) != 0 ||
-			    ptrace_write_debugreg(child, 7, 0) != 0) {
-				perror("ptrace clear regs");
-				return 1;
+
+			if (w != NULL && signal == SIGTRAP && w->armed) {
+				if (pending_dbg_causes_ptrace_trap(w, tid) != 0) {
+					w->err = 1;
+					w->armed = 0;
+					pending_dbg_causes_stop(&slots[i].ring);
+				}
+				ptrace_continue(tid, 0);
+				continue;
 			}
 
-			/* Resume without re-delivering SIGTRAP */
-			if (ptrace_continue(child, 0) != 0) {
-				perror("ptrace continue (after trap)");
-				return 1;
+			if (w != NULL && (signal == SIGILL || signal == SIGSEGV) &&
+			    anomaly_intercepts[w->intercept].fault_len != 0) {
+				if (pending_dbg_causes_ptrace_fault(w, tid) != 0)
+					w->err = 1;
+				ptrace_continue(tid, 0);
+				continue;
 			}
 
-			got_trap = 1;
+			/* Any other stop just continue and pass the signal through */
+			ptrace_continue(tid, signal);
+		}
+
+		if (watchdog && !done && !killed &&
+		    pending_dbg_causes_threads_watchdog(workers, n, &kill_ns)) {
+			kill(child, SIGKILL);
+			killed = 1;
+		}
+	}
+	elapsed_ns = anomaly_now_ns() - start_ns;
+	profile_enter(pdc_profile, PDC_PHASE_TEARDOWN);
+
+	/* The watchdog killed a hung batch, what it ran so far still counts */
+	if (!killed && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+		fprintf(stderr, "threads: tracee did not exit cleanly (status 0x%x)\n", status);
+		goto out;
+	}
+
+	for (unsigned int i = 0; i < n; i++) {
+		workers[i].elapsed_ns = elapsed_ns;
+		workers[i].trials = slots[i].ring.started;
+		pending_dbg_causes_drain(&workers[i]);
+		pending_dbg_causes_finish(&workers[i]);
+		if (workers[i].tid == 0)
+			workers[i].tid = slots[i].tid;
+	}
+	err = pending_dbg_causes_summarize(workers, (int)n, "all threads", tally);
+
+out:
+	pending_dbg_causes_events_close(&ev);
+	munmap(slots, n * sizeof(*slots));
+	free(workers);
+	profile_enter(pdc_profile, -1);
+	return err;
+}
+
+/* One pass over the selected intercepts, each adding up in tallies[intercept] */
+static int pending_dbg_causes_pass(const struct anomaly_options *opts, struct tracee_pool *pool,
+				   struct trial_log *log, struct pending_dbg_causes_tally *tallies)
+{
+	int err = 0;
+
+	for (unsigned int id = 0; id < ANOMALY_INTERCEPT_COUNT; id++) {
+		if ((opts->intercepts & ANOMALY_INTERCEPT_MASK(id)) == 0)
 			continue;
+
+		/* Label each instruction's outcomes when sweeping more than CPUID */
+		if (opts->intercepts != ANOMALY_INTERCEPT_MASK(ANOMALY_INTERCEPT_CPUID))
+			printf("%s (%s):\n", anomaly_intercepts[id].name, anomaly_intercepts[id].description);
+		pdc_snapshots = 0;
+
+		if (opts->threads != 0) {
+			err |= pending_dbg_causes_threads(opts, id, log, &tallies[id]);
+		} else if (opts->backend == ANOMALY_BACKEND_PTRACE && (opts->all_cpus || opts->tracees > 1)) {
+			err |= pending_dbg_causes_tracees(opts, id, pool, log, &tallies[id]);
+		} else if (opts->all_cpus) {
+			err |= pending_dbg_causes_all_cpus(opts, id, log, &tallies[id]);
+		} else {
+			struct pending_dbg_causes_worker worker = {
+				.cpu = -1, .intercept = id, .opts = opts, .pool = pool, .log = log
+			};
+
+			if (pending_dbg_causes_run(&worker) != 0) {
+				err = 1;
+			} else {
+				pending_dbg_causes_report(&worker);
+				pending_dbg_causes_tally(&tallies[id], &worker);
+			}
 		}
 
-		/* Any other stop just continue and pass the signal through */
-		if (ptrace_continue(child, signal) != 0) {
-			perror("ptrace continue (pass signal)");
-			return 1;
+		if (pdc_profile != NULL) {
+			profile_print(pdc_profile);
+			profile_reset(pdc_profile);
 		}
 	}
+	return err;
+}
 
-	if (!got_trap) {
-		printf("    No SIGTRAP/#DB observed (unexpected)\n");
-		return 0;
+/* The anomaly rate of every intercept under each noise profile of a sweep */
+static void pending_dbg_causes_noise_summary(const struct anomaly_options *opts,
+					     struct pending_dbg_causes_tally (*tallies)[ANOMALY_INTERCEPT_COUNT])
+{
+	printf("\nAnomaly rate by noise profile:\n");
+	printf("  %-24s %-8s %12s %12s %10s\n", "NOISE", "INTERCEPT", "TRIALS", "ANOMALIES", "RATE");
+	for (unsigned int pass = 0; pass < opts->noise_profiles; pass++) {
+		for (unsigned int id = 0; id < ANOMALY_INTERCEPT_COUNT; id++) {
+			const struct pending_dbg_causes_tally *const t = &tallies[pass][id];
+			char name[64];
+
+			if ((opts->intercepts & ANOMALY_INTERCEPT_MASK(id)) == 0)
+				continue;
+			printf("  %-24s %-8s %12" PRIu64 " %12" PRIu64 " %9.4f%%\n",
+			       anomaly_noise_profile_name(opts->noise[pass], name, sizeof(name)),
+			       anomaly_intercepts[id].name, t->trials, t->anomalies,
+			       t->trials != 0 ? 100.0 * (double)t->anomalies / (double)t->trials : 0.0);
+		}
+	}
+}
+
+/* DR6 outcomes and trial windows of every intercept with each probe placement */
+static void pending_dbg_causes_placement_summary(const struct anomaly_options *opts,
+						 const struct placement *placements, unsigned int passes,
+						 struct pending_dbg_causes_tally (*tallies)[ANOMALY_INTERCEPT_COUNT])
+{
+	printf("\nOutcome by probe placement (trial window in TSC cycles):\n");
+	printf("  %-10s %-8s %10s %10s %9s %10s %7s %10s %10s\n", "PLACEMENT", "INTERCEPT", "TRIALS",
+	       "ANOMALIES", "RATE", "B0+BS", "OTHER", "P50", "P99");
+	for (unsigned int pass = 0; pass < passes; pass++) {
+		const struct placement *const p = &placements[pass];
+
+		if (p->err != 0) {
+			printf("  %-10s skipped\n", anomaly_placement_names[p->kind]);
+			continue;
+		}
+		for (unsigned int id = 0; id < ANOMALY_INTERCEPT_COUNT; id++) {
+			const struct pending_dbg_causes_tally *const t = &tallies[pass][id];
+			const uint64_t expected = t->hist.count[dr6_hist_key(PDC_EXPECTED_DR6)];
+
+			if ((opts->intercepts & ANOMALY_INTERCEPT_MASK(id)) == 0)
+				continue;
+			printf("  %-10s %-8s %10" PRIu64 " %10" PRIu64 " %8.4f%% %10" PRIu64 " %7" PRIu64
+			       " %10" PRIu64 " %10" PRIu64 "\n", anomaly_placement_names[p->kind],
+			       anomaly_intercepts[id].name, t->trials, t->anomalies,
+			       t->trials != 0 ? 100.0 * (double)t->anomalies / (double)t->trials : 0.0,
+			       expected, dr6_hist_total(&t->hist) - expected,
+			       latency_percentile(&t->window, 50.0), latency_percentile(&t->window, 99.0));
+		}
 	}
+}
 
-	print_dr6(dr6);
+/*
+ * --corpus: one entry per intercept that had anomalies in any pass, DR0 on
+ * the probe as armed here. The entry holds the last DR6 that missed B0 or
+ * BS, or no #DB when every anomalous trial went without one. Faulting
+ * intercepts discard the pending #DB and cannot be replayed, they are left
+ * out, as are anomalies of SIMD state alone.
+ */
+static int pending_dbg_causes_corpus(const struct anomaly_options *opts, unsigned int passes,
+				     struct pending_dbg_causes_tally (*tallies)[ANOMALY_INTERCEPT_COUNT])
+{
+	const struct dr_config cfg = { .dr7 = PENDING_DBG_CAUSES_DR7 };
+	const uint64_t mask = dr6_model_mask(&cfg) | ~(uint64_t)DR6_VOLATILE;
+	struct corpus_entry entries[ANOMALY_INTERCEPT_COUNT];
+	size_t count = 0;
+
+	for (unsigned int id = 0; id < ANOMALY_INTERCEPT_COUNT; id++) {
+		uint64_t dr6 = 0;
+		int no_trap = 0;
 
+		for (unsigned int pass = 0; pass < passes; pass++) {
+			const struct pending_dbg_causes_tally *const t = &tallies[pass][id];
+
+			if (t->anomalies == 0)
+				continue;
+			if (t->dr6 != 0)
+				dr6 = t->dr6;
+			no_trap |= t->hist.no_trap != 0;
+		}
+		if ((dr6 == 0 && !no_trap) || anomaly_intercepts[id].fault_len != 0)
+			continue;
+		entries[count++] = (struct corpus_entry){
+			.dr7 = cfg.dr7,
+			.expected = dr6_model_read(&cfg, 0, 2, 1) & mask,
+			.observed = dr6 & mask,
+			.intercept = (uint8_t)id,
+			.test = ANOMALY_TEST_PENDING_DBG_CAUSES,
+			.cpu = -1,
+		};
+	}
+	if (count == 0)
+		return 0;
+	if (corpus_append_new(opts->corpus_path, entries, &count) != 0) {
+		perror(opts->corpus_path);
+		return 1;
+	}
+	printf("%zu new failing configurations added to %s\n", count, opts->corpus_path);
 	return 0;
 }
+
+int anomaly_pending_dbg_causes(const struct anomaly_options *opts)
+{
+	const unsigned int passes = opts->noise_profiles != 0 ? opts->noise_profiles :
+				    opts->placements != 0 ? (unsigned int)__builtin_popcount(opts->placements) : 1;
+	struct sigaction old_signals[3];
+	struct trial_log log, *logp = NULL;
+	struct tracee_pool pool = { 0 };
+	struct pending_dbg_causes_tally (*tallies)[ANOMALY_INTERCEPT_COUNT] = NULL;
+	struct placement placements[ANOMALY_PLACEMENT_COUNT];
+	unsigned int nr_placements = 0;
+	struct profile profile;
+	uint32_t noise_kinds = 0;
+	uint64_t anomalies = 0;
+	int signals = 0;
+	int err = 0;
+
+	if (opts->threads != 0 && (opts->backend != ANOMALY_BACKEND_PTRACE || opts->all_cpus)) {
+		fprintf(stderr, "--threads requires the ptrace backend and excludes --all-cpus\n");
+		return EINVAL;
+	}
+	if ((opts->tracees != 0 || opts->zygote != 0) &&
+	    (opts->backend != ANOMALY_BACKEND_PTRACE || opts->threads != 0)) {
+		fprintf(stderr, "--tracees and --zygote require the ptrace backend and exclude --threads\n");
+		return EINVAL;
+	}
+	if (opts->profile && opts->backend == ANOMALY_BACKEND_PERF && opts->all_cpus) {
+		fprintf(stderr, "--profile counts a single thread and excludes --all-cpus with the perf backend\n");
+		return EINVAL;
+	}
+
+	if (opts->snapshot_dir != NULL && opts->backend != ANOMALY_BACKEND_PTRACE) {
+		fprintf(stderr, "--snapshot reads the tracee's state through ptrace and requires the ptrace backend\n");
+		return EINVAL;
+	}
+	if (opts->placements != 0 &&
+	    (opts->threads != 0 || opts->noise_profiles != 0 || opts->corpus_path != NULL)) {
+		fprintf(stderr, "--placement runs a pass per probe layout and excludes "
+			"--threads, --noise and --corpus\n");
+		return EINVAL;
+	}
+	if ((opts->placements & ANOMALY_PLACEMENT_MASK(ANOMALY_PLACEMENT_CODE)) != 0 && opts->simd) {
+		fprintf(stderr, "--simd runs its own trial kernels, which the code placement cannot move\n");
+		return EINVAL;
+	}
+
+	/* Every process the ipi generator should reach registers before the first fork */
+	for (unsigned int pass = 0; pass < opts->noise_profiles; pass++)
+		noise_kinds |= opts->noise[pass];
+	if ((noise_kinds & ANOMALY_NOISE_MASK(ANOMALY_NOISE_IPI)) != 0 && noise_register() != 0) {
+		perror("membarrier(MEMBARRIER_CMD_REGISTER_GLOBAL_EXPEDITED)");
+		err = 1;
+		goto out;
+	}
+
+	if (opts->log_path != NULL) {
+		uint64_t capacity = anomaly_trial_budget(opts) * (uint64_t)__builtin_popcount(opts->intercepts);
+		cpu_set_t online;
+
+		if (opts->all_cpus && sched_getaffinity(0, sizeof(online), &online) == 0)
+			capacity *= (uint64_t)CPU_COUNT(&online);
+		if (opts->threads != 0)
+			capacity *= opts->threads;
+		if (opts->tracees != 0)
+			capacity *= opts->tracees;
+		capacity *= passes;
+		if (trial_log_create(&log, opts->log_path, capacity) != 0) {
+			perror(opts->log_path);
+			err = 1;
+			goto out;
+		}
+		logp = &log;
+	}
+
+	/* Only the thread driving the trials is counted: the tracer, or the perf trial loop */
+	if (opts->profile) {
+		if (profile_open(&profile, pdc_phase_names, PDC_PHASE_COUNT) != 0) {
+			perror("perf_event_open(profile)");
+			err = 1;
+			goto out;
+		}
+		pdc_profile = &profile;
+	}
+
+	/* Before the tracee pool forks anything, tracees use the same patterns */
+	if (opts->simd) {
+		pdc_simd = simd_detect();
+		simd_pattern_init();
+	}
+
+	/* Likewise the probe placements, which tracees find at the same addresses */
+	for (unsigned int kind = 0; kind < ANOMALY_PLACEMENT_COUNT; kind++) {
+		uint16_t selector;
+
+		if ((opts->placements & ANOMALY_PLACEMENT_MASK(kind)) == 0)
+			continue;
+		__asm__ __volatile__("movw %%ss, %0" : "=r"(selector) : : );
+		placement_init(&placements[nr_placements++], kind, selector);
+	}
+
+	/* Early enough for the forks of a --zygote pool to be on the timeline */
+	if (opts->trace_path != NULL)
+		trace_open();
+
+	/* ptrace tracees come from a pool, pre-forked with --zygote */
+	if (opts->backend == ANOMALY_BACKEND_PTRACE && opts->threads == 0 &&
+	    tracee_pool_init(&pool, sizeof(struct pending_dbg_causes_job), opts->zygote) != 0) {
+		perror("tracee pool");
+		err = 1;
+		goto out;
+	}
+
+	if (opts->backend == ANOMALY_BACKEND_PERF) {
+		if (pending_dbg_causes_perf_signals(old_signals) != 0) {
+			err = 1;
+			goto out;
+		}
+		signals = 1;
+	}
+	pdc_snapshot_dir = opts->snapshot_dir;
+
+	/* Per pass and intercept, too large for the stack with their histograms */
+	tallies = calloc(passes, sizeof(*tallies));
+	if (tallies == NULL) {
+		perror("alloc tallies");
+		err = 1;
+		goto out;
+	}
+
+	for (unsigned int pass = 0; pass < passes; pass++) {
+		const uint32_t mask = opts->noise_profiles != 0 ? opts->noise[pass] : 0;
+		struct noise noise;
+		char name[64];
+
+		if (opts->noise_profiles != 0) {
+			printf("%sNoise profile %s:\n", pass != 0 ? "\n" : "",
+			       anomaly_noise_profile_name(mask, name, sizeof(name)));
+		}
+		if (nr_placements != 0) {
+			if (pass != 0)
+				printf("\n");
+			placement_print(&placements[pass]);
+			if (placements[pass].err != 0)
+				continue;
+			pdc_placement = placements[pass].probe != NULL ? &placements[pass] : NULL;
+		}
+		if (noise_start(&noise, mask) != 0) {
+			err = 1;
+			break;
+		}
+		err |= pending_dbg_causes_pass(opts, &pool, logp, tallies[pass]);
+		noise_stop(&noise);
+		noise_print(&noise, mask);
+		pdc_placement = NULL;
+
+		for (unsigned int id = 0; id < ANOMALY_INTERCEPT_COUNT; id++)
+			anomalies += tallies[pass][id].anomalies;
+	}
+	if (opts->noise_profiles != 0)
+		pending_dbg_causes_noise_summary(opts, tallies);
+	if (nr_placements != 0)
+		pending_dbg_causes_placement_summary(opts, placements, nr_placements, tallies);
+	if (opts->corpus_path != NULL)
+		err |= pending_dbg_causes_corpus(opts, passes, tallies);
+
+out:
+	free(tallies);
+	if (signals)
+		pending_dbg_causes_perf_restore(old_signals);
+	pdc_snapshot_dir = NULL;
+	pdc_simd = SIMD_NONE;
+	tracee_pool_destroy(&pool);
+	for (unsigned int i = 0; i < nr_placements; i++)
+		placement_destroy(&placements[i]);
+	if (pdc_profile != NULL)
+		profile_close(pdc_profile);
+	pdc_profile = NULL;
+	if (logp != NULL)
+		trial_log_close(logp);
+	if (opts->trace_path != NULL && trace_enabled) {
+		if (trace_write(opts->trace_path) != 0) {
+			perror(opts->trace_path);
+			err = 1;
+		} else {
+			fprintf(stderr, "Trace written to %s\n", opts->trace_path);
+		}
+	}
+	if (err)
+		return ANOMALY_RESULT_FAIL;
+	return anomalies != 0 ? ANOMALY_RESULT_DETECTED : ANOMALY_RESULT_PASS;
+}
@@ -0,0 +1,91 @@
+/*
+ * Wrappers around perf_event system calls.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef PERF_EVENT_WRAPPER_H
+#define PERF_EVENT_WRAPPER_H 1
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/hw_breakpoint.h>
+#include <linux/perf_event.h>
+
+#ifndef PERF_EVENT_IOC_MODIFY_ATTRIBUTES
+#define PERF_EVENT_IOC_MODIFY_ATTRIBUTES _IOW('$', 11, struct perf_event_attr *)
+#endif
+
+static inline int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu,
+				  int group_fd, unsigned long flags)
+{
+	return (int)syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+static inline void perf_bp_attr(struct perf_event_attr *attr, uintptr_t addr,
+				unsigned int len, unsigned int type)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->type = PERF_TYPE_BREAKPOINT;
+	attr->size = sizeof(*attr);
+	attr->bp_addr = addr;
+	attr->bp_len = len;
+	attr->bp_type = type;
+	attr->sample_period = 1;
+	attr->exclude_kernel = 1;
+	attr->exclude_hv = 1;
+}
+
+/*
+ * Open a hardware breakpoint on the calling thread. Hits are counted by the
+ * event, the #DB itself is still reported to the thread as SIGTRAP when it
+ * carries other debug conditions (i.e. a pending single-step).
+ */
+static inline int perf_bp_open(uintptr_t addr, unsigned int len, unsigned int type)
+{
+	struct perf_event_attr attr;
+
+	perf_bp_attr(&attr, addr, len, type);
+	return perf_event_open(&attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+ * Move an already open breakpoint to a new address/length/type without
+ * closing and re-opening the event.
+ */
+static inline int perf_bp_modify(int fd, uintptr_t addr, unsigned int len, unsigned int type)
+{
+	struct perf_event_attr attr;
+
+	perf_bp_attr(&attr, addr, len, type);
+	if (ioctl(fd, PERF_EVENT_IOC_MODIFY_ATTRIBUTES, &attr) != 0)
+		return -1;
+	return 0;
+}
+
+static inline int perf_read_count(int fd, uint64_t *result_count)
+{
+	if (read(fd, result_count, sizeof(*result_count)) != sizeof(*result_count))
+		return -1;
+	return 0;
+}
+
+#endif /* PERF_EVENT_WRAPPER_H */
@@ -0,0 +1,273 @@
+/*
+ * Probe memory laid out in the placements of a --placement matrix.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H 1
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ * Every placement is mapped before any tracee is forked, so a tracee finds
+ * its probe at the same address as the tracer arming DR0 on it, in a private
+ * copy of its own. The probe holds the SS selector and is never written once
+ * the trials run, only loaded by their MOV SS.
+ *
+ * Two placements need more than memory:
+ * - code:  the trial kernels are copied from templates onto the page the
+ *          probe is on, which is mapped read and execute only
+ * - stack: the probe sits at the top of a stack the ptrace tracee switches
+ *          to for its trial loop, the perf backend uses a local of its own
+ *          trial loop instead
+ */
+#define PLACEMENT_HUGE_2M       (2ul << 20)
+#define PLACEMENT_HUGE_1G       (1ul << 30)
+#define PLACEMENT_STACK_SIZE    (256 * 1024)
+
+struct placement {
+	unsigned int kind;                      /* enum anomaly_placement */
+	int err;                                /* errno when this host cannot provide it, 0 otherwise */
+	void *map;
+	size_t map_size;
+	size_t page_size;                       /* Of the page the probe starts on */
+	uint16_t *probe;                        /* NULL for the default placement */
+	void *stack;                            /* stack: what the trial loop runs on */
+	size_t stack_size;
+	void (*trials[ANOMALY_INTERCEPT_COUNT])(uint16_t *probe);
+};
+
+/*
+ * Position independent copies of the intercept_trial_*() kernels with the
+ * probe in RDI, kept as data and copied next to the probe by the code
+ * placement. A template ends where the next one starts.
+ */
+#define X(id, name, insn, fault_len, desc) \
+	"placement_code_" #name ":\n" \
+	"xorl %eax, %eax\n" \
+	"xorl %ecx, %ecx\n" \
+	"pushq %rbx\n" \
+	"pushfq\n" \
+	"orl $0x100, (%rsp)\n" \
+	"popfq\n" \
+	"movw (%rdi), %ss\n" \
+	insn "\n" \
+	"popq %rbx\n" \
+	"ret\n"
+__asm__(".pushsection .rodata\n" ANOMALY_INTERCEPTS(X) "placement_code_end:\n" ".popsection\n");
+#undef X
+
+#define X(id, name, insn, fault_len, desc) \
+extern const unsigned char placement_code_##name[] __attribute__((visibility("hidden")));
+ANOMALY_INTERCEPTS(X)
+#undef X
+extern const unsigned char placement_code_end[] __attribute__((visibility("hidden")));
+
+static const unsigned char *const placement_code[ANOMALY_INTERCEPT_COUNT + 1] = {
+#define X(id, name, insn, fault_len, desc) [ANOMALY_INTERCEPT_##id] = placement_code_##name,
+	ANOMALY_INTERCEPTS(X)
+#undef X
+	[ANOMALY_INTERCEPT_COUNT] = placement_code_end,
+};
+
+static inline void *placement_mmap(size_t size, int flags)
+{
+	void *const p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+
+	return p != MAP_FAILED ? p : NULL;
+}
+
+/* Whether the mapping around addr is backed by a transparent huge page */
+static inline int placement_thp_backed(const void *addr)
+{
+	FILE *f = fopen("/proc/self/smaps", "r");
+	unsigned long start, end, kb = 0;
+	char line[256];
+	int in = 0;
+
+	if (f == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+			in = start <= (unsigned long)addr && (unsigned long)addr < end;
+		else if (in && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+			break;
+	}
+	fclose(f);
+	return kb != 0;
+}
+
+/* Copy the trial kernels to the start of the page, the probe goes on its last cache line */
+static inline int placement_code_page(struct placement *p)
+{
+	unsigned char *const page = p->map;
+	size_t off = 0;
+
+	for (unsigned int id = 0; id < ANOMALY_INTERCEPT_COUNT; id++) {
+		const size_t len = (size_t)(placement_code[id + 1] - placement_code[id]);
+
+		/* Never past the probe's line, let alone the mapping */
+		if (off + len > p->page_size - ANOMALY_CACHE_LINE)
+			return -1;
+		memcpy(page + off, placement_code[id], len);
+		p->trials[id] = (void (*)(uint16_t *))(void *)(page + off);
+		off += len;
+	}
+	p->probe = (uint16_t *)(page + p->page_size - ANOMALY_CACHE_LINE);
+	return 0;
+}
+
+/**
+ * Lay out the probe of a placement and load selector into it. A placement
+ * the host cannot provide, such as huge pages none were reserved for, is
+ * returned with err set and nothing mapped.
+ */
+static inline int placement_init(struct placement *p, unsigned int kind, uint16_t selector)
+{
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	unsigned char *base = NULL;
+
+	memset(p, 0, sizeof(*p));
+	p->kind = kind;
+	p->page_size = page;
+	for (unsigned int id = 0; id < ANOMALY_INTERCEPT_COUNT; id++)
+		p->trials[id] = anomaly_intercepts[id].trial;
+
+	switch (kind) {
+	case ANOMALY_PLACEMENT_DEFAULT:
+		return 0;
+	case ANOMALY_PLACEMENT_PAGE:
+	case ANOMALY_PLACEMENT_LINE_SPLIT:
+		p->map_size = page;
+		p->map = placement_mmap(p->map_size, 0);
+		base = p->map;
+		if (base != NULL && kind == ANOMALY_PLACEMENT_LINE_SPLIT)
+			base += ANOMALY_CACHE_LINE - 1;
+		break;
+	case ANOMALY_PLACEMENT_CODE:
+		p->map_size = page;
+		p->map = placement_mmap(p->map_size, 0);
+		if (p->map == NULL)
+			break;
+		if (placement_code_page(p) != 0)
+			errno = E2BIG;
+		else
+			base = (unsigned char *)p->probe;
+		break;
+	case ANOMALY_PLACEMENT_PAGE_SPLIT:
+		p->map_size = 2 * page;
+		p->map = placement_mmap(p->map_size, 0);
+		base = p->map != NULL ? (unsigned char *)p->map + page - 1 : NULL;
+		break;
+	case ANOMALY_PLACEMENT_HUGE_2M:
+	case ANOMALY_PLACEMENT_HUGE_1G:
+		p->map_size = p->page_size = kind == ANOMALY_PLACEMENT_HUGE_2M ? PLACEMENT_HUGE_2M : PLACEMENT_HUGE_1G;
+		p->map = placement_mmap(p->map_size, MAP_HUGETLB | MAP_POPULATE |
+					((kind == ANOMALY_PLACEMENT_HUGE_2M ? 21 : 30) << MAP_HUGE_SHIFT));
+		base = p->map;
+		break;
+	case ANOMALY_PLACEMENT_THP:
+		/* Twice the size, for a huge-page aligned range somewhere inside */
+		p->map_size = 2 * PLACEMENT_HUGE_2M;
+		p->map = placement_mmap(p->map_size, 0);
+		if (p->map == NULL)
+			break;
+		base = (unsigned char *)(((uintptr_t)p->map + PLACEMENT_HUGE_2M - 1) & ~(PLACEMENT_HUGE_2M - 1));
+		if (madvise(base, PLACEMENT_HUGE_2M, MADV_HUGEPAGE) != 0) {
+			base = NULL;
+			break;
+		}
+		memset(base, 0, PLACEMENT_HUGE_2M);
+		if (placement_thp_backed(base))
+			p->page_size = PLACEMENT_HUGE_2M;
+		break;
+	case ANOMALY_PLACEMENT_STACK:
+		p->map_size = PLACEMENT_STACK_SIZE;
+		p->map = placement_mmap(p->map_size, MAP_STACK);
+		if (p->map == NULL)
+			break;
+		p->stack = p->map;
+		p->stack_size = p->map_size - ANOMALY_CACHE_LINE;
+		base = (unsigned char *)p->map + p->stack_size;
+		break;
+	default:
+		errno = EINVAL;
+		break;
+	}
+
+	if (base == NULL) {
+		p->err = errno;
+		if (p->map != NULL)
+			munmap(p->map, p->map_size);
+		p->map = NULL;
+		p->probe = NULL;
+		return -1;
+	}
+	memcpy(base, &selector, sizeof(selector));
+	p->probe = (uint16_t *)base;
+
+	if (kind == ANOMALY_PLACEMENT_CODE && mprotect(p->map, p->map_size, PROT_READ | PROT_EXEC) != 0) {
+		p->err = errno;
+		munmap(p->map, p->map_size);
+		p->map = NULL;
+		p->probe = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+static inline void placement_destroy(struct placement *p)
+{
+	if (p->map != NULL)
+		munmap(p->map, p->map_size);
+	p->map = NULL;
+	p->probe = NULL;
+}
+
+/* One line on where the probe ended up, or why the placement is skipped */
+static inline void placement_print(const struct placement *p)
+{
+	printf("Probe placement %s: ", anomaly_placement_names[p->kind]);
+	if (p->err != 0) {
+		printf("not available here (%s), skipped\n", strerror(p->err));
+		return;
+	}
+	if (p->probe == NULL) {
+		printf("the worker's own probe\n");
+		return;
+	}
+	printf("%p on a ", (void *)p->probe);
+	if (p->page_size >= PLACEMENT_HUGE_1G)
+		printf("%zu GiB page", p->page_size >> 30);
+	else if (p->page_size >= PLACEMENT_HUGE_2M)
+		printf("%zu MiB page", p->page_size >> 20);
+	else
+		printf("%zu KiB page", p->page_size >> 10);
+	if (p->kind == ANOMALY_PLACEMENT_THP && p->page_size < PLACEMENT_HUGE_2M)
+		printf(" (no transparent huge page was given)");
+	printf("\n");
+}
+
+#endif /* PLACEMENT_H */
@@ -0,0 +1,192 @@
+/*
+ * Per-phase self-profiling with perf_event counter groups.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H 1
+#include <inttypes.h>
+#include <stdio.h>
+#include "perf_event.h"
+
+#define PROFILE_MAX_PHASES      8
+
+enum profile_counter {
+	PROFILE_TASK_CLOCK,                     /* Group leader, always available */
+	PROFILE_CONTEXT_SWITCHES,
+	PROFILE_PAGE_FAULTS,
+	PROFILE_CYCLES,
+	PROFILE_INSTRUCTIONS,
+	PROFILE_COUNTERS
+};
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+	const char *name;
+} profile_counter_desc[PROFILE_COUNTERS] = {
+	[PROFILE_TASK_CLOCK]       = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock" },
+	[PROFILE_CONTEXT_SWITCHES] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "ctx-switches" },
+	[PROFILE_PAGE_FAULTS]      = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults" },
+	[PROFILE_CYCLES]           = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+	[PROFILE_INSTRUCTIONS]     = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+};
+
+/**
+ * Counters of the calling thread, all in one group so a single read() samples
+ * them together. Every profile_enter() charges what was counted since the
+ * previous one to the phase being left. Hardware counters are left out on
+ * machines (or guests) without a PMU.
+ */
+struct profile {
+	int fd[PROFILE_COUNTERS];               /* -1 when unavailable */
+	int slot[PROFILE_COUNTERS];             /* Position in the group read */
+	unsigned int nr;                        /* Counters in the group */
+	const char *const *phase_names;
+	unsigned int nr_phases;
+	int phase;                              /* Phase being counted, -1 for none */
+	uint64_t last[PROFILE_COUNTERS];
+	uint64_t total[PROFILE_MAX_PHASES][PROFILE_COUNTERS];
+	uint64_t trials;                        /* Divisor for the per-trial averages */
+};
+
+static inline int profile_open_counter(unsigned int c, int group_fd)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = profile_counter_desc[c].type;
+	attr.size = sizeof(attr);
+	attr.config = profile_counter_desc[c].config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.exclude_hv = 1;
+
+	/* The harness' time is mostly syscalls, count the kernel side if we may */
+	fd = perf_event_open(&attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+	if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+		attr.exclude_kernel = 1;
+		fd = perf_event_open(&attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+	}
+	return fd;
+}
+
+static inline int profile_open(struct profile *p, const char *const *phase_names, unsigned int nr_phases)
+{
+	memset(p, 0, sizeof(*p));
+	p->phase_names = phase_names;
+	p->nr_phases = nr_phases < PROFILE_MAX_PHASES ? nr_phases : PROFILE_MAX_PHASES;
+	p->phase = -1;
+	for (unsigned int c = 0; c < PROFILE_COUNTERS; c++)
+		p->fd[c] = -1;
+
+	for (unsigned int c = 0; c < PROFILE_COUNTERS; c++) {
+		p->fd[c] = profile_open_counter(c, c == PROFILE_TASK_CLOCK ? -1 : p->fd[PROFILE_TASK_CLOCK]);
+		if (p->fd[c] < 0) {
+			if (c == PROFILE_TASK_CLOCK)
+				return -1;
+			continue;
+		}
+		p->slot[c] = (int)p->nr++;
+	}
+	return 0;
+}
+
+static inline void profile_close(struct profile *p)
+{
+	for (unsigned int c = 0; c < PROFILE_COUNTERS; c++) {
+		if (p->fd[c] >= 0)
+			close(p->fd[c]);
+		p->fd[c] = -1;
+	}
+}
+
+/**
+ * Charge everything counted since the last switch to the current phase and
+ * start counting towards phase, or towards nothing when phase is -1. A NULL
+ * profile does nothing so call sites need no checks of their own.
+ */
+static inline void profile_enter(struct profile *p, int phase)
+{
+	uint64_t buf[1 + PROFILE_COUNTERS];
+
+	if (p == NULL || phase == p->phase)
+		return;
+	if (read(p->fd[PROFILE_TASK_CLOCK], buf, sizeof(buf)) < (ssize_t)((1 + p->nr) * sizeof(uint64_t)))
+		return;
+
+	for (unsigned int c = 0; c < PROFILE_COUNTERS; c++) {
+		uint64_t value;
+
+		if (p->fd[c] < 0)
+			continue;
+		value = buf[1 + p->slot[c]];
+		if (p->phase >= 0 && (unsigned int)p->phase < p->nr_phases)
+			p->total[p->phase][c] += value - p->last[c];
+		p->last[c] = value;
+	}
+	p->phase = phase;
+}
+
+static inline void profile_reset(struct profile *p)
+{
+	profile_enter(p, -1);
+	memset(p->total, 0, sizeof(p->total));
+	p->trials = 0;
+}
+
+/*
+ * Print each phase's totals and per-trial averages. task-clock is in
+ * nanoseconds and shown in milliseconds (totals) and microseconds (per trial).
+ */
+static inline void profile_print(const struct profile *p)
+{
+	const double trials = p->trials != 0 ? (double)p->trials : 1.0;
+
+	printf("  %-18s %-7s", "harness profile", "");
+	for (unsigned int c = 0; c < PROFILE_COUNTERS; c++)
+		printf(" %14s", profile_counter_desc[c].name);
+	printf("\n");
+
+	for (unsigned int ph = 0; ph < p->nr_phases; ph++) {
+		printf("  %-18s %-7s", p->phase_names[ph], "total");
+		for (unsigned int c = 0; c < PROFILE_COUNTERS; c++) {
+			if (p->fd[c] < 0)
+				printf(" %14s", "n/a");
+			else if (c == PROFILE_TASK_CLOCK)
+				printf(" %11.3f ms", (double)p->total[ph][c] / 1e6);
+			else
+				printf(" %14" PRIu64, p->total[ph][c]);
+		}
+		printf("\n  %-18s %-7s", "", "/trial");
+		for (unsigned int c = 0; c < PROFILE_COUNTERS; c++) {
+			if (p->fd[c] < 0)
+				printf(" %14s", "n/a");
+			else if (c == PROFILE_TASK_CLOCK)
+				printf(" %11.3f us", (double)p->total[ph][c] / 1e3 / trials);
+			else
+				printf(" %14.2f", (double)p->total[ph][c] / trials);
+		}
+		printf("\n");
+	}
+}
+
+#endif /* PROFILE_H */
@@ -26,9 +26,19 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/user.h>
 #include <sys/wait.h>
+#include <unistd.h>
+#include "trace.h"
+
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
 
 static inline int ptrace_trace(void)
 {
@@ -39,14 +49,22 @@ static inline int ptrace_trace(void)
 
 static inline int ptrace_continue(pid_t pid, int signal)
 {
-	if (ptrace(PTRACE_CONT, pid, 0, (void *)(uintptr_t)signal) != 0)
+	const uint64_t t = trace_begin();
+	const long ret = ptrace(PTRACE_CONT, pid, 0, (void *)(uintptr_t)signal);
+
+	trace_end(TRACE_CONT, t, (uint64_t)pid);
+	if (ret != 0)
 		return -1;
 	return 0;
 }
 
 static inline int ptrace_write_regs(pid_t pid, struct user_regs_struct *regs)
 {
-	if (ptrace(PTRACE_SETREGS, pid, 0, regs) != 0) {
+	const uint64_t t = trace_begin();
+	const long ret = ptrace(PTRACE_SETREGS, pid, 0, regs);
+
+	trace_end(TRACE_SETREGS, t, (uint64_t)pid);
+	if (ret != 0) {
 		return -1;
 	}
 	return 0;
@@ -54,7 +72,11 @@ static inline int ptrace_write_regs(pid_t pid, struct user_regs_struct *regs)
 
 static inline int ptrace_read_regs(pid_t pid, struct user_regs_struct *result_regs)
 {
-	if (ptrace(PTRACE_GETREGS, pid, 0, result_regs) != 0)
+	const uint64_t t = trace_begin();
+	const long ret = ptrace(PTRACE_GETREGS, pid, 0, result_regs);
+
+	trace_end(TRACE_GETREGS, t, (uint64_t)pid);
+	if (ret != 0)
 		return -1;
 	return 0;
 }
@@ -62,7 +84,10 @@ static inline int ptrace_read_regs(pid_t pid, struct user_regs_struct *result_re
 static inline int ptrace_write_debugreg(pid_t pid, int index, uintptr_t value)
 {
 	const size_t off = offsetof(struct user, u_debugreg[index]);
-	if (ptrace(PTRACE_POKEUSER, pid, (void *)off, (void *)value) == -1 && errno)
+	const uint64_t t = trace_begin();
+	const long ret = ptrace(PTRACE_POKEUSER, pid, (void *)off, (void *)value);
+	trace_end(TRACE_POKEUSER, t, (uint64_t)index);
+	if (ret == -1 && errno)
 		return -1;
 	return 0;
 }
@@ -70,11 +95,29 @@ static inline int ptrace_write_debugreg(pid_t pid, int index, uintptr_t value)
 static inline int ptrace_read_debugreg(pid_t pid, int index, uint64_t *result_value)
 {
 	const size_t off = offsetof(struct user, u_debugreg[index]);
-	long result = ptrace(PTRACE_PEEKUSER, pid, (void *)off, 0);
+	const uint64_t t = trace_begin();
+	const long result = ptrace(PTRACE_PEEKUSER, pid, (void *)off, 0);
+	trace_end(TRACE_PEEKUSER, t, (uint64_t)index);
 	if (result == -1 && errno)
 		return -1;
 	*result_value = (uint64_t)(unsigned long)result;
 	return 0;
 }
 
+/*
+ * pidfd of a tracee, readable once it has exited. Returns -1 on kernels older
+ * than 5.3, callers fall back to the PID.
+ */
+static inline int ptrace_pidfd_open(pid_t pid)
+{
+	return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+static inline int ptrace_kill(pid_t pid, int pidfd)
+{
+	if (pidfd >= 0)
+		return (int)syscall(SYS_pidfd_send_signal, pidfd, SIGKILL, NULL, 0);
+	return kill(pid, SIGKILL);
+}
+
 #endif /* PTRACE_WRAPPER_H */
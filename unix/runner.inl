@@ -0,0 +1,148 @@
+/*
+ * Concurrent runner executing registered tests in isolated child processes.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#include <sys/wait.h>
+
+struct anomaly_runner_slot {
+	pid_t pid;
+	FILE *output;                           /* Captured stdout/stderr of the test */
+	uint64_t start_ns;
+};
+
+static unsigned int anomaly_default_jobs(void)
+{
+	const long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned int)n : 1;
+}
+
+static void anomaly_runner_print_output(const struct anomaly_test *test,
+					const struct anomaly_test_result *result, FILE *output)
+{
+	char buf[4096];
+	size_t n;
+
+	printf("=== %s: %s (%.3f s) ===\n", test->name, anomaly_result_name(result->result),
+	       (double)result->elapsed_ns / 1e9);
+	rewind(output);
+	while ((n = fread(buf, 1, sizeof(buf), output)) != 0)
+		fwrite(buf, 1, n, stdout);
+	fflush(stdout);
+}
+
+/*
+ * Run every test in its own forked child, at most jobs at a time. Output of
+ * each child goes to a private temporary file and is printed in one block
+ * when the child finishes, so concurrent tests never interleave.
+ */
+static int anomaly_run_isolated(const struct anomaly_test *const *tests, size_t count,
+				unsigned int jobs, const struct anomaly_options *opts,
+				struct anomaly_test_result *results)
+{
+	struct anomaly_runner_slot *slots;
+	size_t next = 0, running = 0;
+
+	slots = calloc(count, sizeof(*slots));
+	if (slots == NULL) {
+		perror("alloc runner");
+		return -1;
+	}
+
+	while (next < count || running != 0) {
+		int status;
+		pid_t pid;
+		size_t i;
+
+		while (next < count && running < jobs) {
+			struct anomaly_runner_slot *const slot = &slots[next];
+
+			slot->output = tmpfile();
+			if (slot->output == NULL) {
+				perror("tmpfile");
+				results[next].result = ANOMALY_RESULT_FAIL;
+				results[next].status = -1;
+				next++;
+				continue;
+			}
+
+			fflush(stdout);
+			fflush(stderr);
+			slot->start_ns = anomaly_now_ns();
+			slot->pid = fork();
+			if (slot->pid < 0) {
+				perror("fork");
+				fclose(slot->output);
+				slot->output = NULL;
+				results[next].result = ANOMALY_RESULT_FAIL;
+				results[next].status = -1;
+				next++;
+				continue;
+			}
+
+			if (slot->pid == 0) {
+				dup2(fileno(slot->output), STDOUT_FILENO);
+				dup2(fileno(slot->output), STDERR_FILENO);
+				const int rc = tests[next]->run(opts);
+				fflush(NULL);
+				_exit(rc);
+			}
+
+			next++;
+			running++;
+		}
+
+		if (running == 0)
+			continue;
+
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("waitpid(runner)");
+			break;
+		}
+
+		for (i = 0; i < next; i++) {
+			if (slots[i].pid == pid && slots[i].output != NULL)
+				break;
+		}
+		if (i == next)
+			continue;
+
+		results[i].elapsed_ns = anomaly_now_ns() - slots[i].start_ns;
+		if (WIFEXITED(status)) {
+			results[i].status = WEXITSTATUS(status);
+			results[i].result = anomaly_classify(results[i].status);
+		} else {
+			results[i].status = WIFSIGNALED(status) ? -WTERMSIG(status) : -1;
+			results[i].result = ANOMALY_RESULT_FAIL;
+		}
+
+		anomaly_runner_print_output(tests[i], &results[i], slots[i].output);
+		fclose(slots[i].output);
+		slots[i].output = NULL;
+		running--;
+	}
+
+	free(slots);
+	return 0;
+}
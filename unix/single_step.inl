@@ -0,0 +1,312 @@
+/*
+ * Single-step #DB delivery throughput and accuracy over a known instruction
+ * stream with intercepting instructions interleaved.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#include "ptrace.h"
+#include "tracee_pool.h"
+#include <signal.h>
+#include <ucontext.h>
+
+/* Passes over the stream per mode unless --iterations says otherwise */
+#define SINGLE_STEP_DEFAULT_PASSES 20
+
+/*
+ * The stream runs with TF set from the instruction after its POPFQ up to and
+ * including the POPFQ which clears it again. Every stepped instruction
+ * appends the offset of the instruction following it, the RIP its #DB
+ * reports, to single_step_offsets. CPUID, RDTSC, RDTSCP and PAUSE exit to the
+ * hypervisor, which has to emulate or skip them and still deliver the step.
+ */
+__asm__(
+	".macro single_step_insn insn:vararg\n"
+	"\t\\insn\n"
+	"9999:\n"
+	"\t.pushsection .rodata.single_step, \"a\"\n"
+	"\t.long 9999b - single_step_stream\n"
+	"\t.popsection\n"
+	".endm\n"
+	"\t.pushsection .rodata.single_step, \"a\"\n"
+	"\t.balign 4\n"
+	"\t.globl single_step_offsets\n"
+	"\t.hidden single_step_offsets\n"
+	"single_step_offsets:\n"
+	"\t.popsection\n"
+	"\t.text\n"
+	"\t.p2align 4\n"
+	"\t.globl single_step_stream\n"
+	"\t.hidden single_step_stream\n"
+	"\t.type single_step_stream, @function\n"
+	"single_step_stream:\n"
+	"\tpushq %rbx\n"
+	"\tpushfq\n"
+	"\torl $0x100, (%rsp)\n"
+	"\tpopfq\n"
+	"\t.rept 256\n"
+	"\tsingle_step_insn nop\n"
+	"\tsingle_step_insn xorl %eax, %eax\n"
+	"\tsingle_step_insn xorl %ecx, %ecx\n"
+	"\tsingle_step_insn cpuid\n"
+	"\tsingle_step_insn addq $1, %r8\n"
+	"\tsingle_step_insn rdtsc\n"
+	"\tsingle_step_insn pause\n"
+	"\tsingle_step_insn rdtscp\n"
+	"\tsingle_step_insn leaq 8(%rsp), %r9\n"
+	"\tsingle_step_insn movq (%r9), %r10\n"
+	"\t.endr\n"
+	"\tsingle_step_insn pushfq\n"
+	"\tsingle_step_insn andl $~0x100, (%rsp)\n"
+	"\tsingle_step_insn popfq\n"
+	"\tpopq %rbx\n"
+	"\tret\n"
+	"\t.size single_step_stream, . - single_step_stream\n"
+	"\t.pushsection .rodata.single_step, \"a\"\n"
+	"\t.globl single_step_offsets_end\n"
+	"\t.hidden single_step_offsets_end\n"
+	"single_step_offsets_end:\n"
+	"\t.popsection\n"
+	".purgem single_step_insn\n"
+);
+
+extern void single_step_stream(void) __attribute__((visibility("hidden")));
+extern const int32_t single_step_offsets[] __attribute__((visibility("hidden")));
+extern const int32_t single_step_offsets_end[] __attribute__((visibility("hidden")));
+
+/*
+ * Outcome of stepping the stream. A trap whose RIP is the next expected one
+ * matches; one repeating the previous RIP is a duplicate; one further down the
+ * stream matches after skipping (losing) the steps in between; anything else
+ * is stray. Lost steps are whatever never matched.
+ */
+struct single_step_result {
+	uint64_t expected;
+	uint64_t traps;
+	uint64_t matched;
+	uint64_t duplicate;
+	uint64_t stray;
+	uint64_t no_bs;                         /* Trap without BS in DR6 */
+	uint64_t next;                          /* Index of the next expected step */
+	uint64_t last_rip;
+	uint64_t elapsed_ns;
+};
+
+static inline uint64_t single_step_rip(uint64_t index)
+{
+	const uint64_t nr = (uint64_t)(single_step_offsets_end - single_step_offsets);
+
+	return (uintptr_t)single_step_stream + (uint64_t)(int64_t)single_step_offsets[index % nr];
+}
+
+static void single_step_check(struct single_step_result *r, uint64_t rip, int bs)
+{
+	const uint64_t nr = (uint64_t)(single_step_offsets_end - single_step_offsets);
+
+	r->traps++;
+	r->no_bs += !bs;
+
+	if (rip == single_step_rip(r->next)) {
+		r->matched++;
+		r->next++;
+	} else if (rip == r->last_rip) {
+		r->duplicate++;
+	} else {
+		uint64_t j;
+
+		for (j = r->next + 1; j <= r->next + nr; j++) {
+			if (rip == single_step_rip(j))
+				break;
+		}
+		if (j > r->next + nr) {
+			r->stray++;
+		} else {
+			r->matched++;
+			r->next = j + 1;
+		}
+	}
+	r->last_rip = rip;
+}
+
+static int single_step_report(const char *name, const struct single_step_result *r)
+{
+	const double secs = (double)r->elapsed_ns / 1e9;
+	const uint64_t lost = r->expected > r->matched ? r->expected - r->matched : 0;
+
+	printf("single-step (%s): %" PRIu64 " steps in %.3f s (%.0f steps/sec)\n",
+	       name, r->traps, secs, secs > 0 ? (double)r->traps / secs : 0.0);
+	printf("  %12" PRIu64 " expected, %" PRIu64 " lost, %" PRIu64 " duplicate, %" PRIu64
+	       " stray, %" PRIu64 " without BS\n",
+	       r->expected, lost, r->duplicate, r->stray, r->no_bs);
+	return lost != 0 || r->duplicate != 0 || r->stray != 0 || r->no_bs != 0;
+}
+
+static struct single_step_result single_step_inproc;
+
+/* DR6 is not handed to signal handlers, TRAP_TRACE is how BS shows up */
+static void single_step_sigtrap(int sig, siginfo_t *info, void *ucontext)
+{
+	const ucontext_t *const uc = ucontext;
+	(void)sig;
+
+	single_step_check(&single_step_inproc, (uint64_t)uc->uc_mcontext.gregs[REG_RIP],
+			  info->si_code == TRAP_TRACE);
+}
+
+static int single_step_in_process(uint64_t passes, struct single_step_result *r)
+{
+	struct sigaction sa, old_trap;
+	uint64_t start_ns;
+
+	memset(&single_step_inproc, 0, sizeof(single_step_inproc));
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = single_step_sigtrap;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGTRAP, &sa, &old_trap) != 0) {
+		perror("sigaction(SIGTRAP)");
+		return 1;
+	}
+
+	start_ns = anomaly_now_ns();
+	for (uint64_t i = 0; i < passes; i++)
+		single_step_stream();
+	single_step_inproc.elapsed_ns = anomaly_now_ns() - start_ns;
+
+	sigaction(SIGTRAP, &old_trap, NULL);
+	*r = single_step_inproc;
+	return 0;
+}
+
+struct single_step_job {
+	uint64_t passes;
+};
+
+static int single_step_tracee(void *arg)
+{
+	const struct single_step_job *const job = arg;
+
+	for (uint64_t i = 0; i < job->passes; i++)
+		single_step_stream();
+	return 0;
+}
+
+/*
+ * Step the stream in a traced child. Every step is a SIGTRAP stop where the
+ * tracer reads DR6 and RIP, clears DR6 and resumes.
+ */
+static int single_step_ptrace(uint64_t passes, struct single_step_result *r)
+{
+	struct tracee_pool pool;
+	struct tracee t;
+	uint64_t start_ns;
+	int status = 0;
+	int alive = 1;
+	int err = 1;
+
+	if (tracee_pool_init(&pool, sizeof(struct single_step_job), 0) != 0)
+		return 1;
+	if (tracee_pool_get(&pool, &t) != 0) {
+		tracee_pool_destroy(&pool);
+		return 1;
+	}
+
+	((struct single_step_job *)t.arg)->passes = passes;
+	t.job->fn = single_step_tracee;
+	t.job->cpu = -1;
+
+	start_ns = anomaly_now_ns();
+	if (ptrace_continue(t.pid, 0) != 0) {
+		perror("ptrace continue");
+		goto out;
+	}
+
+	for (;;) {
+		struct user_regs_struct regs;
+		uint64_t dr6;
+		int signal;
+
+		if (waitpid(t.pid, &status, __WALL) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("waitpid(single-step)");
+			goto out;
+		}
+		if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			alive = 0;
+			break;
+		}
+		if (!WIFSTOPPED(status))
+			continue;
+
+		signal = WSTOPSIG(status);
+		if (signal == SIGTRAP) {
+			if (ptrace_read_debugreg(t.pid, 6, &dr6) != 0 ||
+			    ptrace_read_regs(t.pid, &regs) != 0 ||
+			    ptrace_write_debugreg(t.pid, 6, 0) != 0) {
+				perror("ptrace read DR6/RIP");
+				goto out;
+			}
+			single_step_check(r, regs.rip, (dr6 & DR6_BS_BIT) != 0);
+			signal = 0;
+		}
+		if (ptrace_continue(t.pid, signal) != 0) {
+			perror("ptrace continue");
+			goto out;
+		}
+	}
+	r->elapsed_ns = anomaly_now_ns() - start_ns;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		fprintf(stderr, "single-step: tracee did not exit cleanly (status 0x%x)\n", status);
+	else
+		err = 0;
+
+out:
+	if (alive) {
+		ptrace_kill(t.pid, t.pidfd);
+		waitpid(t.pid, NULL, __WALL);
+	}
+	tracee_release(&t);
+	tracee_pool_destroy(&pool);
+	return err;
+}
+
+int anomaly_single_step(const struct anomaly_options *opts)
+{
+	const uint64_t nr = (uint64_t)(single_step_offsets_end - single_step_offsets);
+	const uint64_t passes = opts->iterations_set ? opts->iterations : SINGLE_STEP_DEFAULT_PASSES;
+	struct single_step_result r;
+	int anomalous = 0;
+
+	memset(&r, 0, sizeof(r));
+	if (single_step_in_process(passes, &r) != 0)
+		return ANOMALY_RESULT_FAIL;
+	r.expected = nr * passes;
+	anomalous |= single_step_report("in-process", &r);
+
+	memset(&r, 0, sizeof(r));
+	if (single_step_ptrace(passes, &r) != 0)
+		return ANOMALY_RESULT_FAIL;
+	r.expected = nr * passes;
+	anomalous |= single_step_report("ptrace", &r);
+
+	return anomalous ? ANOMALY_RESULT_DETECTED : ANOMALY_RESULT_PASS;
+}
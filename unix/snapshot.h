@@ -0,0 +1,219 @@
+/*
+ * Full-state snapshots of a traced thread, written when a trial goes wrong.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H 1
+#include <cpuid.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+#include "ptrace.h"
+
+#ifndef NT_X86_XSTATE
+#define NT_X86_XSTATE   0x202
+#endif
+
+/* Enough for every XSAVE component Linux exposes today, AMX tiles included */
+#define SNAPSHOT_XSTATE_MAX     16384
+
+/**
+ * A snapshot is a text file of "[section]" headers followed by "key=value"
+ * lines, except for the xstate hex dump and the verbatim maps and cpuinfo
+ * sections. Everything needed to file a bug report is in the one file:
+ * the trial as recorded, the host, and the thread's registers, debug
+ * registers, XSAVE area and address space as they were at the #DB stop.
+ */
+#define SNAPSHOT_VERSION        1
+
+/* Copy a /proc file into the snapshot, up to the first empty line if first_block */
+static inline void snapshot_copy_file(FILE *out, const char *path, int first_block)
+{
+	char line[512];
+	FILE *in = fopen(path, "r");
+
+	if (in == NULL) {
+		fprintf(out, "# %s: %s\n", path, strerror(errno));
+		return;
+	}
+	while (fgets(line, sizeof(line), in) != NULL) {
+		if (first_block && line[0] == '\n')
+			break;
+		fputs(line, out);
+	}
+	fclose(in);
+}
+
+static inline void snapshot_host(FILE *out)
+{
+	unsigned int eax, ebx, ecx, edx;
+	uint32_t vendor[4] = { 0 };
+	char model[TRIAL_LOG_META_STR];
+	struct utsname uts;
+
+	fprintf(out, "[host]\n");
+	if (uname(&uts) == 0) {
+		fprintf(out, "nodename=%s\nsysname=%s\nrelease=%s\nversion=%s\nmachine=%s\n",
+			uts.nodename, uts.sysname, uts.release, uts.version, uts.machine);
+	}
+
+	__get_cpuid(0, &eax, &vendor[0], &vendor[2], &vendor[1]);
+	fprintf(out, "cpu_vendor=%.12s\n", (const char *)vendor);
+	trial_log_cpu_model(model, sizeof(model));
+	fprintf(out, "cpu_model=%s\n", model);
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) != 0) {
+		fprintf(out, "cpuid_1=0x%08x 0x%08x 0x%08x 0x%08x\n", eax, ebx, ecx, edx);
+
+		/* CPUID.1:ECX[31], the hypervisor present bit */
+		if (ecx & (1u << 31)) {
+			__cpuid(0x40000000, eax, vendor[0], vendor[1], vendor[2]);
+			fprintf(out, "hypervisor=%.12s\nhypervisor_max_leaf=0x%08x\n", (const char *)vendor, eax);
+		}
+	}
+	fprintf(out, "\n[cpuinfo]\n");
+	snapshot_copy_file(out, "/proc/cpuinfo", 1);
+}
+
+static inline void snapshot_regs(FILE *out, const struct user_regs_struct *regs)
+{
+	static const struct {
+		const char *name;
+		size_t offset;
+	} fields[] = {
+#define SNAPSHOT_REG(r) { #r, offsetof(struct user_regs_struct, r) }
+		SNAPSHOT_REG(rip), SNAPSHOT_REG(eflags), SNAPSHOT_REG(rsp), SNAPSHOT_REG(rbp),
+		SNAPSHOT_REG(rax), SNAPSHOT_REG(rbx), SNAPSHOT_REG(rcx), SNAPSHOT_REG(rdx),
+		SNAPSHOT_REG(rsi), SNAPSHOT_REG(rdi), SNAPSHOT_REG(r8), SNAPSHOT_REG(r9),
+		SNAPSHOT_REG(r10), SNAPSHOT_REG(r11), SNAPSHOT_REG(r12), SNAPSHOT_REG(r13),
+		SNAPSHOT_REG(r14), SNAPSHOT_REG(r15), SNAPSHOT_REG(orig_rax),
+		SNAPSHOT_REG(cs), SNAPSHOT_REG(ss), SNAPSHOT_REG(ds), SNAPSHOT_REG(es),
+		SNAPSHOT_REG(fs), SNAPSHOT_REG(gs), SNAPSHOT_REG(fs_base), SNAPSHOT_REG(gs_base),
+#undef SNAPSHOT_REG
+	};
+
+	fprintf(out, "[regs]\n");
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+		unsigned long long value;
+
+		memcpy(&value, (const char *)regs + fields[i].offset, sizeof(value));
+		fprintf(out, "%s=0x%016llx\n", fields[i].name, value);
+	}
+}
+
+static inline void snapshot_debugregs(FILE *out, pid_t tid)
+{
+	fprintf(out, "[debugregs]\n");
+	for (int i = 0; i < 8; i++) {
+		uint64_t value;
+
+		/* DR4/DR5 are aliases the kernel does not expose */
+		if (i == 4 || i == 5)
+			continue;
+		if (ptrace_read_debugreg(tid, i, &value) != 0)
+			fprintf(out, "dr%d=# %s\n", i, strerror(errno));
+		else
+			fprintf(out, "dr%d=0x%016" PRIx64 "\n", i, value);
+	}
+}
+
+/* The XSAVE area as PTRACE_GETREGSET returns it, 32 bytes per line */
+static inline void snapshot_xstate(FILE *out, pid_t tid)
+{
+	static uint8_t xstate[SNAPSHOT_XSTATE_MAX] __attribute__((aligned(64)));
+	struct iovec iov = { .iov_base = xstate, .iov_len = sizeof(xstate) };
+
+	fprintf(out, "[xstate]\n");
+	if (ptrace(PTRACE_GETREGSET, tid, (void *)NT_X86_XSTATE, &iov) != 0) {
+		fprintf(out, "# PTRACE_GETREGSET(NT_X86_XSTATE): %s\n", strerror(errno));
+		return;
+	}
+	fprintf(out, "size=%zu\n", iov.iov_len);
+	for (size_t off = 0; off < iov.iov_len; off += 32) {
+		fprintf(out, "%04zx:", off);
+		for (size_t i = off; i < off + 32 && i < iov.iov_len; i++)
+			fprintf(out, " %02x", xstate[i]);
+		fprintf(out, "\n");
+	}
+}
+
+/**
+ * Write a snapshot of thread tid, stopped at the #DB of trial rec, to
+ * dir/<prefix>-<intercept>-<tid>-<trial>.snap. regs are the registers as
+ * read at the stop, before the tracer changed anything. The path written is
+ * returned in path. Only ever called for the rare trial that went wrong, so
+ * none of this is on the fast path.
+ */
+static inline int snapshot_write(const char *dir, const char *prefix, pid_t tid,
+				 const struct trial_record *rec, uint64_t expected_dr6,
+				 const struct user_regs_struct *regs, char *path, size_t size)
+{
+	char bits[DR6_BITS_STR_MAX];
+	char proc[64];
+	struct timespec now;
+	FILE *out;
+	int fd;
+
+	snprintf(path, size, "%s/%s-%s-%d-%" PRIu64 ".snap", dir, prefix,
+		 anomaly_intercepts[rec->intercept].name, (int)tid, rec->trial);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	out = fdopen(fd, "w");
+	if (out == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	fprintf(out, "# debug_test anomaly snapshot\nversion=%d\n", SNAPSHOT_VERSION);
+	fprintf(out, "time=%lld.%09ld\n\n", (long long)now.tv_sec, now.tv_nsec);
+
+	fprintf(out, "[trial]\n");
+	fprintf(out, "test=%s\nintercept=%s\n", prefix, anomaly_intercepts[rec->intercept].name);
+	fprintf(out, "pid=%d\ntrial=%" PRIu64 "\ncpu=%u\ntsc=%" PRIu64 "\nlatency=%" PRIu64 "\n",
+		(int)tid, rec->trial, rec->cpu, rec->tsc, rec->latency);
+	format_dr6_bits(rec->dr6, bits, sizeof(bits));
+	fprintf(out, "dr6=0x%" PRIx64 " (%s)\n", rec->dr6, bits);
+	format_dr6_bits(expected_dr6, bits, sizeof(bits));
+	fprintf(out, "expected_dr6=0x%" PRIx64 " (%s)\n", expected_dr6, bits);
+	fprintf(out, "dr7=0x%" PRIx64 "\nrip=0x%" PRIx64 "\nflags=0x%x\n\n", rec->dr7, rec->rip, rec->flags);
+
+	snapshot_host(out);
+	fprintf(out, "\n");
+	snapshot_regs(out, regs);
+	fprintf(out, "\n");
+	snapshot_debugregs(out, tid);
+	fprintf(out, "\n");
+	snapshot_xstate(out, tid);
+	fprintf(out, "\n[maps]\n");
+	snprintf(proc, sizeof(proc), "/proc/%d/maps", (int)tid);
+	snapshot_copy_file(out, proc, 0);
+
+	return fclose(out) != 0 ? -1 : 0;
+}
+
+#endif /* SNAPSHOT_H */
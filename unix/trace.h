@@ -0,0 +1,243 @@
+/*
+ * Timeline of harness events, exported as Chrome trace JSON.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef TRACE_H
+#define TRACE_H 1
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/**
+ * Events are timed with the TSC, which all processes on the machine share,
+ * so tracer and tracee events land on one timeline without any exchange
+ * between them. Each thread appends to a buffer of its own, found through a
+ * thread-local pointer and linked into a global list with a CAS the first
+ * time it records, so recording never takes a lock. Everything is turned
+ * into JSON only by trace_write(), after the run.
+ */
+enum trace_id {
+	TRACE_FORK,                             /* fork() of a tracee */
+	TRACE_HANDSHAKE,                        /* Waiting for a new tracee's initial SIGSTOP */
+	TRACE_POKEUSER,                         /* arg: debug register written */
+	TRACE_PEEKUSER,                         /* arg: debug register read */
+	TRACE_GETREGS,
+	TRACE_SETREGS,
+	TRACE_CONT,
+	TRACE_EPOLL,                            /* Tracer blocked until something happened */
+	TRACE_WAITPID,                          /* A stop or exit reaped, arg: pid */
+	TRACE_DB,                               /* #DB stop serviced by the tracer, arg: trial */
+	TRACE_DELIVERY,                         /* perf: trial start to the SIGTRAP handler, arg: trial */
+	TRACE_TRIAL,                            /* MOV SS + intercept window of a trial, arg: trial */
+	TRACE_COUNT
+};
+
+static const char *const trace_names[TRACE_COUNT] = {
+	[TRACE_FORK]      = "fork",
+	[TRACE_HANDSHAKE] = "SIGSTOP handshake",
+	[TRACE_POKEUSER]  = "PTRACE_POKEUSER",
+	[TRACE_PEEKUSER]  = "PTRACE_PEEKUSER",
+	[TRACE_GETREGS]   = "PTRACE_GETREGS",
+	[TRACE_SETREGS]   = "PTRACE_SETREGS",
+	[TRACE_CONT]      = "PTRACE_CONT",
+	[TRACE_EPOLL]     = "epoll_wait",
+	[TRACE_WAITPID]   = "waitpid",
+	[TRACE_DB]        = "#DB handling",
+	[TRACE_DELIVERY]  = "#DB delivery",
+	[TRACE_TRIAL]     = "trial",
+};
+
+/* Events per thread, the rest are counted as dropped */
+#define TRACE_BUF_EVENTS        (1u << 20)
+
+struct trace_event {
+	uint64_t start;                         /* TSC */
+	uint32_t cycles;                        /* Duration, saturated */
+	uint16_t id;
+	uint16_t reserved;
+	int32_t pid;                            /* 0 for the recording thread's own */
+	int32_t tid;
+	uint64_t arg;
+};
+
+struct trace_buf {
+	struct trace_buf *next;
+	pid_t pid;
+	pid_t tid;
+	uint64_t nr;                            /* Events recorded, may exceed TRACE_BUF_EVENTS */
+	struct trace_event *events;
+};
+
+static int trace_enabled;
+static struct trace_buf *trace_bufs;
+static __thread struct trace_buf *trace_buf;
+static uint64_t trace_start_tsc, trace_start_ns;
+
+static inline uint64_t trace_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* First event of a thread: give it a buffer and publish that to trace_write() */
+static __attribute__((noinline)) struct trace_buf *trace_attach(void)
+{
+	const int saved_errno = errno;         /* Callers look at it after tracing a syscall */
+	struct trace_buf *b = calloc(1, sizeof(*b));
+
+	errno = saved_errno;
+	if (b == NULL)
+		return NULL;
+	/* Reserved only, pages are touched as events come in */
+	b->events = mmap(NULL, TRACE_BUF_EVENTS * sizeof(struct trace_event), PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	errno = saved_errno;
+	if (b->events == MAP_FAILED) {
+		free(b);
+		return NULL;
+	}
+	b->pid = getpid();
+	b->tid = (pid_t)syscall(SYS_gettid);
+	b->next = __atomic_load_n(&trace_bufs, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&trace_bufs, &b->next, b, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	trace_buf = b;
+	return b;
+}
+
+/**
+ * Record an event from start to end, both TSC values. pid/tid name the
+ * thread it happened on when that is not the recording one (0 otherwise).
+ */
+static inline void trace_record(unsigned int id, uint64_t start, uint64_t end, pid_t pid, pid_t tid,
+				uint64_t arg)
+{
+	struct trace_buf *b = trace_buf;
+	struct trace_event *e;
+
+	if (__builtin_expect(b == NULL, 0) && (b = trace_attach()) == NULL)
+		return;
+	if (b->nr++ >= TRACE_BUF_EVENTS)
+		return;
+	e = &b->events[b->nr - 1];
+	e->start = start;
+	e->cycles = end - start > UINT32_MAX ? UINT32_MAX : (uint32_t)(end - start);
+	e->id = (uint16_t)id;
+	e->pid = pid;
+	e->tid = tid;
+	e->arg = arg;
+}
+
+/* Start of an event of the calling thread, 0 while not tracing */
+static inline uint64_t trace_begin(void)
+{
+	return __builtin_expect(trace_enabled, 0) ? rdtsc() : 0;
+}
+
+static inline void trace_end(unsigned int id, uint64_t start, uint64_t arg)
+{
+	if (__builtin_expect(start != 0, 0))
+		trace_record(id, start, rdtsc(), 0, 0, arg);
+}
+
+static inline void trace_open(void)
+{
+	trace_start_ns = trace_now_ns();
+	trace_start_tsc = rdtsc();
+	trace_enabled = 1;
+}
+
+/*
+ * Write every buffer as Chrome trace JSON, which Perfetto and
+ * chrome://tracing open, and free them. TSC values become microseconds since
+ * trace_open() at the rate the TSC ran at meanwhile.
+ */
+static inline int trace_write(const char *path)
+{
+	const uint64_t end_tsc = rdtsc(), end_ns = trace_now_ns();
+	const double us_per_cycle = end_tsc > trace_start_tsc ?
+		(double)(end_ns - trace_start_ns) / 1e3 / (double)(end_tsc - trace_start_tsc) : 0.0;
+	struct trace_buf *const bufs = __atomic_exchange_n(&trace_bufs, NULL, __ATOMIC_ACQUIRE);
+	struct trace_buf *b;
+	pid_t named[64];
+	unsigned int nr_named = 0;
+	uint64_t dropped = 0;
+	FILE *out;
+	int first = 1;
+
+	trace_enabled = 0;
+	out = fopen(path, "w");
+
+	if (out != NULL)
+		fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (b = bufs; b != NULL && out != NULL; b = b->next) {
+		const uint64_t nr = b->nr < TRACE_BUF_EVENTS ? b->nr : TRACE_BUF_EVENTS;
+
+		dropped += b->nr - nr;
+		for (uint64_t i = 0; i < nr; i++) {
+			const struct trace_event *const e = &b->events[i];
+			const pid_t pid = e->pid != 0 ? e->pid : b->pid;
+			unsigned int n;
+
+			/* Name each process the first time it shows up */
+			for (n = 0; n < nr_named && named[n] != pid; n++)
+				;
+			if (n == nr_named && n < sizeof(named) / sizeof(named[0])) {
+				named[nr_named++] = pid;
+				fprintf(out, "%s\n{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+					"\"args\":{\"name\":\"%s %d\"}}", first ? "" : ",", (int)pid,
+					pid == getpid() ? "debug_test" : "tracee", (int)pid);
+				first = 0;
+			}
+
+			fprintf(out, "%s\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,"
+				"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"arg\":%" PRIu64 "}}",
+				first ? "" : ",", trace_names[e->id], (int)pid,
+				(int)(e->pid != 0 ? e->tid : b->tid),
+				(double)(int64_t)(e->start - trace_start_tsc) * us_per_cycle,
+				(double)e->cycles * us_per_cycle, e->arg);
+			first = 0;
+		}
+	}
+	if (out != NULL)
+		fprintf(out, "\n],\"otherData\":{\"tsc_mhz\":%.3f,\"dropped\":%" PRIu64 "}}\n",
+			us_per_cycle != 0.0 ? 1.0 / us_per_cycle : 0.0, dropped);
+
+	for (b = bufs; b != NULL;) {
+		struct trace_buf *const next = b->next;
+
+		munmap(b->events, TRACE_BUF_EVENTS * sizeof(struct trace_event));
+		free(b);
+		b = next;
+	}
+	trace_buf = NULL;
+	return out == NULL || fclose(out) != 0 ? -1 : 0;
+}
+
+#endif /* TRACE_H */
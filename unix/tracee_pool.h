@@ -0,0 +1,311 @@
+/*
+ * Pool of pre-forked, traced and stopped child processes.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+#ifndef TRACEE_POOL_H
+#define TRACEE_POOL_H 1
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "ptrace.h"
+
+/**
+ * Job of a tracee, written by the tracer while the tracee sits in its initial
+ * SIGSTOP. The tracee pins itself to cpu (unless negative) and exits with the
+ * value fn returns. A NULL fn makes it exit right away.
+ */
+struct tracee_job {
+	int (*fn)(void *arg);
+	int cpu;
+} __attribute__((aligned(64)));
+
+/**
+ * A traced child. arg points at memory shared with the child and mapped at the
+ * same address in both processes, so it can hold the job's parameters and
+ * results as well as anything the tracer points debug registers at.
+ */
+struct tracee {
+	pid_t pid;
+	int pidfd;                              /* -1 on kernels without pidfd_open */
+	struct tracee_job *job;
+	void *arg;
+	size_t map_size;
+};
+
+struct tracee_pool_entry {
+	struct tracee tracee;
+	int ready;                              /* Seen in its initial SIGSTOP */
+};
+
+/**
+ * Up to capacity tracees which already went through fork(), PTRACE_TRACEME
+ * and raise(SIGSTOP), so handing one out costs nothing. Entries are started
+ * from whatever thread refills the pool, which must also be the one tracing
+ * them. A pool of capacity 0 forks every tracee on demand.
+ */
+struct tracee_pool {
+	size_t map_size;
+	unsigned int capacity;
+	unsigned int nr;                        /* Entries, ready or still starting */
+	struct tracee_pool_entry *entries;
+};
+
+static inline void tracee_release(struct tracee *t)
+{
+	if (t->pidfd >= 0)
+		close(t->pidfd);
+	if (t->job != NULL)
+		munmap(t->job, t->map_size);
+	t->pid = 0;
+	t->pidfd = -1;
+	t->job = NULL;
+	t->arg = NULL;
+}
+
+static inline __attribute__((noreturn)) void tracee_main(struct tracee *t)
+{
+	/* Become a tracee and wait for the tracer to hand out a job */
+	if (ptrace_trace() != 0)
+		_exit(3);
+	raise(SIGSTOP);
+
+	if (t->job->fn == NULL)
+		_exit(0);
+	if (t->job->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(t->job->cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) != 0)
+			_exit(2);
+	}
+	_exit(t->job->fn(t->arg));
+}
+
+/* Fork a tracee without waiting for it to stop */
+static inline int tracee_spawn(struct tracee_pool *pool, struct tracee *t)
+{
+	uint64_t trace_start;
+
+	t->map_size = pool->map_size;
+	t->job = mmap(NULL, t->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (t->job == MAP_FAILED) {
+		t->job = NULL;
+		return -1;
+	}
+	t->arg = t->job + 1;
+	t->pidfd = -1;
+
+	fflush(stdout);
+	fflush(stderr);
+	trace_start = trace_begin();
+	t->pid = fork();
+	if (t->pid > 0)
+		trace_end(TRACE_FORK, trace_start, (uint64_t)t->pid);
+	if (t->pid < 0) {
+		t->pid = 0;
+		tracee_release(t);
+		return -1;
+	}
+	if (t->pid == 0)
+		tracee_main(t);
+
+	t->pidfd = ptrace_pidfd_open(t->pid);
+	return 0;
+}
+
+/*
+ * Wait for a freshly forked tracee's initial SIGSTOP. An exit instead means
+ * it could not become a tracee.
+ */
+static inline int tracee_wait_stopped(struct tracee *t, int flags)
+{
+	const uint64_t trace_start = trace_begin();
+	int status;
+	pid_t pid;
+
+	do {
+		pid = waitpid(t->pid, &status, flags | __WALL);
+	} while (pid < 0 && errno == EINTR);
+
+	if (pid == 0)
+		return 0;
+	if (pid > 0 && WIFSTOPPED(status)) {
+		trace_end(TRACE_HANDSHAKE, trace_start, (uint64_t)pid);
+		return 1;
+	}
+	if (pid > 0 && !WIFEXITED(status) && !WIFSIGNALED(status))
+		return 0;
+	return -1;
+}
+
+static inline void tracee_pool_remove(struct tracee_pool *pool, unsigned int i)
+{
+	pool->entries[i] = pool->entries[--pool->nr];
+}
+
+/**
+ * Account an event from waitpid(-1) if it belongs to a pool entry. Returns 1
+ * when it did and the caller should not look at it any further.
+ */
+static inline int tracee_pool_event(struct tracee_pool *pool, pid_t pid, int status)
+{
+	for (unsigned int i = 0; i < pool->nr; i++) {
+		struct tracee_pool_entry *const e = &pool->entries[i];
+
+		if (e->tracee.pid != pid)
+			continue;
+		if (WIFSTOPPED(status)) {
+			/* Only when it was reaped is known, not since when it was due */
+			if (trace_enabled) {
+				const uint64_t now = rdtsc();
+
+				trace_record(TRACE_HANDSHAKE, now, now, 0, 0, (uint64_t)pid);
+			}
+			e->ready = 1;
+		} else if (WIFEXITED(status) || WIFSIGNALED(status)) {
+			/* Reaped already, only the mapping and pidfd are left */
+			tracee_release(&e->tracee);
+			tracee_pool_remove(pool, i);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Start tracees until the pool is full again without waiting for any of
+ * them. Their initial stops are picked up by tracee_pool_event() from the
+ * caller's wait loop, or by tracee_pool_get(). Returns the number started.
+ */
+static inline unsigned int tracee_pool_refill(struct tracee_pool *pool)
+{
+	unsigned int started = 0;
+
+	while (pool->nr < pool->capacity) {
+		struct tracee_pool_entry *const e = &pool->entries[pool->nr];
+
+		if (tracee_spawn(pool, &e->tracee) != 0)
+			break;
+		e->ready = 0;
+		pool->nr++;
+		started++;
+	}
+	return started;
+}
+
+/**
+ * Hand out a stopped tracee, forking one on the spot when the pool has none
+ * ready. The caller sets up t->job and t->arg, then resumes it with
+ * PTRACE_CONT, and owns it until tracee_release() after it has been reaped.
+ */
+static inline int tracee_pool_get(struct tracee_pool *pool, struct tracee *t)
+{
+	int state;
+
+	/* Collect initial stops nobody has waited for yet */
+	for (unsigned int i = 0; i < pool->nr; i++) {
+		struct tracee_pool_entry *const e = &pool->entries[i];
+
+		if (e->ready)
+			continue;
+		state = tracee_wait_stopped(&e->tracee, WNOHANG);
+		if (state < 0) {
+			tracee_release(&e->tracee);
+			tracee_pool_remove(pool, i--);
+		} else {
+			e->ready = state;
+		}
+	}
+
+	for (unsigned int i = 0; i < pool->nr; i++) {
+		if (pool->entries[i].ready) {
+			*t = pool->entries[i].tracee;
+			tracee_pool_remove(pool, i);
+			return 0;
+		}
+	}
+
+	/* Nothing ready, a starting entry is still closer than a new fork */
+	while (pool->nr != 0) {
+		*t = pool->entries[0].tracee;
+		tracee_pool_remove(pool, 0);
+		if (tracee_wait_stopped(t, 0) == 1)
+			return 0;
+		tracee_release(t);
+	}
+
+	if (tracee_spawn(pool, t) != 0) {
+		perror("fork(tracee)");
+		return -1;
+	}
+	if (tracee_wait_stopped(t, 0) != 1) {
+		fprintf(stderr, "tracee %d did not stop as expected\n", (int)t->pid);
+		ptrace_kill(t->pid, t->pidfd);
+		waitpid(t->pid, NULL, __WALL);
+		tracee_release(t);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Create a pool whose tracees each share arg_size bytes with the tracer, and
+ * start capacity of them right away.
+ */
+static inline int tracee_pool_init(struct tracee_pool *pool, size_t arg_size, unsigned int capacity)
+{
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	pool->map_size = (sizeof(struct tracee_job) + arg_size + page - 1) & ~(page - 1);
+	pool->capacity = capacity;
+	pool->nr = 0;
+	pool->entries = NULL;
+	if (capacity == 0)
+		return 0;
+
+	pool->entries = calloc(capacity, sizeof(*pool->entries));
+	if (pool->entries == NULL)
+		return -1;
+	tracee_pool_refill(pool);
+	return 0;
+}
+
+/* Kill and reap every spare tracee */
+static inline void tracee_pool_destroy(struct tracee_pool *pool)
+{
+	for (unsigned int i = 0; i < pool->nr; i++) {
+		struct tracee *const t = &pool->entries[i].tracee;
+
+		ptrace_kill(t->pid, t->pidfd);
+		waitpid(t->pid, NULL, __WALL);
+		tracee_release(t);
+	}
+	free(pool->entries);
+	pool->entries = NULL;
+	pool->nr = 0;
+	pool->capacity = 0;
+}
+
+#endif /* TRACEE_POOL_H */
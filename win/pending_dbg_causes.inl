@@ -23,26 +23,51 @@
  */
 
 static uint64_t g_dr6 = 0;
+static uint64_t g_traps = 0;
+static uint64_t g_faults = 0;
+static unsigned int g_fault_len = 0;
 static uint16_t ss_probe = 0;
 
 LONG WINAPI pending_dbg_causes_veh(EXCEPTION_POINTERS* info)
 {
-	if (info->ExceptionRecord->ExceptionCode != EXCEPTION_SINGLE_STEP)
+	const DWORD code = info->ExceptionRecord->ExceptionCode;
+	const PCONTEXT ctx = info->ContextRecord;
+
+	/* Step over an intercepting instruction which faults at CPL3. */
+	if ((code == EXCEPTION_ILLEGAL_INSTRUCTION || code == EXCEPTION_PRIV_INSTRUCTION) &&
+	    g_fault_len != 0) {
+		ctx->Rip += g_fault_len;
+		g_faults++;
+		return EXCEPTION_CONTINUE_EXECUTION;
+	}
+
+	if (code != EXCEPTION_SINGLE_STEP)
 		return EXCEPTION_CONTINUE_SEARCH;
 
-	const PCONTEXT ctx = info->ContextRecord;
 	g_dr6 = ctx->Dr6;
+	g_traps++;
 
+	/* DR0/DR7 stay armed for the next trial in the batch. */
 	ctx->EFlags &= ~0x100; /* clear trap flag (single-step). */
-	ctx->Dr0 = 0;
 	ctx->Dr6 = 0;
-	ctx->Dr7 = 0;
 
 	return EXCEPTION_CONTINUE_EXECUTION;
 }
 
-int anomaly_pending_dbg_causes(void)
+int anomaly_pending_dbg_causes(const struct anomaly_options *opts)
 {
+	const uint64_t budget = anomaly_trial_budget(opts);
+	struct dr6_hist hist = { 0 };
+	struct sprt sprt;
+	uint64_t start_ns, elapsed_ns;
+	uint64_t anomalies = 0, found;
+	uint64_t trials;
+
+	if (opts->all_cpus) {
+		fprintf(stderr, "--all-cpus is not supported on this platform\n");
+		return EINVAL;
+	}
+
 	void *const veh_handle = AddVectoredExceptionHandler(1, pending_dbg_causes_veh);
 	if (veh_handle == NULL) {
 		fprintf(stderr, "failed to add veh!");
@@ -59,27 +84,70 @@ int anomaly_pending_dbg_causes(void)
 	ctx.Dr7 = DR7_L0_BIT | DR7_G0_BIT | DR7_RW0_DATA_RW | DR7_LEN0_2_BYTE;
 	SetThreadContext(GetCurrentThread(), &ctx);
 
-	/*
-	 * Trigger the test.
-	 * - DR7 should be programmed to watch ss_probe
-	 * - Enable single-stepping
-	 * - MOV SS from probe page, to cause delayed B0+BS conditions
-	 * - Execute intercepting instruction (i.e. CPUID)
-	 */
-	__asm__ __volatile__(
-		"pushq %%rbx\n"
-		"pushfq\n"
-		"orl $0x100, (%%rsp)\n"    /* set TF in saved RFLAGS on stack */
-		"popfq\n"
-		"movw (%0), %%ss\n"        /* load SS from probe page */
-		"cpuid\n"                  /* trigger intercepting instruction */
-		"popq %%rbx\n"             /* #DB fires here with DR6 missing B0 under KVM/VMX pre-patch */
-		: : "r"(&ss_probe) : "rax", "rcx", "rdx", "memory"
-	);
-
-	print_dr6(g_dr6);
+	for (unsigned int id = 0; id < ANOMALY_INTERCEPT_COUNT; id++) {
+		const struct anomaly_intercept *const intercept = &anomaly_intercepts[id];
+
+		if ((opts->intercepts & ANOMALY_INTERCEPT_MASK(id)) == 0)
+			continue;
+
+		/* Label each instruction's outcomes when sweeping more than CPUID. */
+		if (opts->intercepts != ANOMALY_INTERCEPT_MASK(ANOMALY_INTERCEPT_CPUID))
+			printf("%s (%s):\n", intercept->name, intercept->description);
+
+		memset(&hist, 0, sizeof(hist));
+		sprt_init(&sprt, &opts->sprt);
+		found = 0;
+		g_faults = 0;
+		g_fault_len = intercept->fault_len;
+
+		start_ns = anomaly_now_ns();
+		for (trials = 0; trials < budget; trials++) {
+			const uint64_t traps = g_traps;
+			const uint64_t faults = g_faults;
+			int anomalous = 0;
+
+			if (opts->adaptive && sprt.decision != SPRT_CONTINUE)
+				break;
+
+			intercept->trial(&ss_probe);
+			if (g_traps == traps) {
+				hist.no_trap++;
+				anomalous = 1;
+			} else {
+				dr6_hist_add(&hist, g_dr6);
+				/* A faulting intercept discards the pending #DB, nothing to expect. */
+				anomalous = g_faults == faults &&
+					    (g_dr6 & (DR6_B0_BIT | DR6_BS_BIT)) != (DR6_B0_BIT | DR6_BS_BIT);
+			}
+			found += anomalous;
+			if (opts->adaptive)
+				sprt_update(&sprt, anomalous);
+		}
+		elapsed_ns = anomaly_now_ns() - start_ns;
+		g_fault_len = 0;
+
+		/* A rate the SPRT called clean does not count against the platform. */
+		if (!opts->adaptive || sprt.decision != SPRT_CLEAN)
+			anomalies += found;
+
+		if (budget == 1) {
+			print_dr6(g_dr6);
+		} else {
+			anomaly_print_rate("pending-dbg-causes", trials, elapsed_ns);
+			dr6_hist_print(&hist);
+		}
+		if (g_faults != 0)
+			printf("  %12" PRIu64 " faults on %s skipped\n", g_faults, intercept->name);
+		if (opts->adaptive)
+			sprt_print(&sprt, budget);
+	}
+
+	/* Disarm the hardware breakpoint. */
+	ctx.Dr0 = 0;
+	ctx.Dr7 = 0;
+	SetThreadContext(GetCurrentThread(), &ctx);
 
 	RemoveVectoredExceptionHandler(veh_handle);
 
-	return 0;
+	return anomalies != 0 ? ANOMALY_RESULT_DETECTED : ANOMALY_RESULT_PASS;
 }
@@ -0,0 +1,50 @@
+/*
+ * Runner executing registered tests, one after another in this process.
+ *
+ * Copyright (C) 2024-2026 Aidan Khoury
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ * Authors: Aidan Khoury <aidan@aktech.ai>
+ */
+
+static unsigned int anomaly_default_jobs(void)
+{
+	return 1;
+}
+
+/*
+ * Windows has no fork(), so tests run sequentially in this process and their
+ * output goes straight to the console. The job count is ignored.
+ */
+static int anomaly_run_isolated(const struct anomaly_test *const *tests, size_t count,
+				unsigned int jobs, const struct anomaly_options *opts,
+				struct anomaly_test_result *results)
+{
+	(void)jobs;
+
+	for (size_t i = 0; i < count; i++) {
+		const uint64_t start_ns = anomaly_now_ns();
+
+		printf("=== %s ===\n", tests[i]->name);
+		results[i].status = tests[i]->run(opts);
+		results[i].result = anomaly_classify(results[i].status);
+		results[i].elapsed_ns = anomaly_now_ns() - start_ns;
+		fflush(stdout);
+	}
+
+	return 0;
+}